@@ -0,0 +1,34 @@
+--[[
+-- Counts channel messages for bench/dispatch.sh, which loads it as
+-- dispatch1, dispatch2, ... Prints the CPU time luna++ spent from the first
+-- message to the closing "END".
+--]]
+local name = ...
+
+local script = {}
+
+script.info = {
+    name        = name,
+    description = "Dispatch benchmark",
+    version     = "1"
+}
+
+local count, start = 0, nil
+
+function script.script_load()
+    luna.add_signal_handler("channel_message", "dispatch",
+        function(who, where, what)
+            count = count + 1
+
+            if count == 1 then
+                start = os.clock()
+            end
+
+            if what == "END" then
+                print(("BENCH %s %d %.3f"):format(
+                    name, count - 1, os.clock() - start))
+            end
+        end)
+end
+
+return script
@@ -0,0 +1,87 @@
+#!/bin/sh
+#
+# Events per second per script: runs luna++ with a number of scripts that
+# each count channel messages, against tools/fake_ircd.py sending a flood
+# of them, and reports how long dispatching them took.
+#
+# Usage: dispatch.sh LUNA [SCRIPTS] [MESSAGES]
+#
+# LUNA is the luna++ binary, SCRIPTS defaults to 8 and MESSAGES to 200000.
+# The server listens on port 16668, or $PORT.
+
+set -e
+
+luna=$(readlink -f "$1")
+scripts=${2:-8}
+messages=${3:-200000}
+port=${PORT:-16668}
+
+here=$(cd "$(dirname "$0")" && pwd)
+tools=$(cd "$here/../tools" && pwd)
+lib=$(cd "$here/../scripts/lib" && pwd)
+
+work=$(mktemp -d)
+server=
+client=
+
+cleanup() {
+    [ -n "$client" ] && kill "$client" 2>/dev/null
+    [ -n "$server" ] && kill "$server" 2>/dev/null
+    rm -rf "$work"
+}
+
+trap cleanup EXIT
+
+mkdir "$work/scripts"
+ln -s "$lib" "$work/scripts/lib"
+
+list=
+for i in $(seq "$scripts"); do
+    cp "$here/dispatch.lua" "$work/scripts/dispatch$i.lua"
+    list="$list\"dispatch$i\", "
+done
+
+cat > "$work/config.lua" <<EOC
+nick = "luna"
+user = "luna"
+realname = "luna"
+server_addr = "127.0.0.1"
+server_port = $port
+server_password = ""
+ssl = false
+scripts = { $list}
+autojoin = { "#test" }
+loglevel = "info"
+ingress_burst = 1000000000
+ingress_rate = 1000000000
+EOC
+
+python3 "$tools/fake_ircd.py" "$port" flood "$messages" &
+server=$!
+sleep 0.5
+
+cd "$work"
+"$luna" config.lua > luna.log 2>&1 &
+client=$!
+
+# Every script reports once it saw the closing message
+waited=0
+while [ "$(grep -c "BENCH" luna.log)" -lt "$scripts" ]; do
+    if [ "$waited" -ge 600 ] || ! kill -0 "$client" 2>/dev/null; then
+        echo "dispatch.sh: luna++ did not finish, see its log:" >&2
+        cat luna.log >&2
+        exit 1
+    fi
+
+    sleep 0.2
+    waited=$((waited + 1))
+done
+
+sed 's/.*BENCH //' luna.log | grep "^dispatch" | awk \
+    -v scripts="$scripts" -v messages="$messages" '
+    $3 > cpu { cpu = $3 }
+    END {
+        printf "%d scripts, %d messages: %.3f s CPU\n", scripts, messages, cpu
+        printf "%.0f events/s per script, %.0f handler calls/s\n",
+            messages / cpu, scripts * messages / cpu
+    }'
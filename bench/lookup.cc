@@ -0,0 +1,236 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Looking up channels and members that aren't there, with the lookup_*
+// functions against catching what the find_* ones throw. The client is
+// filled by a minimal server on a loopback socket.
+
+#include "irc/client.hh"
+#include "irc/channel.hh"
+#include "irc/environment.hh"
+#include "irc/irc_except.hh"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace {
+
+std::size_t allocations = 0;
+
+std::size_t const members = 5000;
+int const rounds = 200000;
+
+void send_all(int fd, std::string const& data)
+{
+    for (std::size_t done = 0; done < data.size(); ) {
+        ssize_t n = ::send(fd, data.data() + done, data.size() - done, 0);
+
+        if (n <= 0) {
+            return;
+        }
+
+        done += static_cast<std::size_t>(n);
+    }
+}
+
+// Registers the client, joins it to a channel of `members' users and
+// hangs up once the client quits.
+void serve(int listener)
+{
+    int fd = ::accept(listener, nullptr, nullptr);
+    std::string in;
+    char buf[4096];
+
+    while (in.find("USER ") == std::string::npos) {
+        ssize_t n = ::recv(fd, buf, sizeof buf, 0);
+
+        if (n <= 0) {
+            ::close(fd);
+            return;
+        }
+
+        in.append(buf, static_cast<std::size_t>(n));
+    }
+
+    std::string out =
+        ":irc.bench 001 bench :Welcome\r\n"
+        ":irc.bench 005 bench PREFIX=(ov)@+ CHANTYPES=# :are supported\r\n"
+        ":irc.bench 376 bench :End of MOTD\r\n"
+        ":bench!b@bench.host JOIN #busy\r\n";
+
+    for (std::size_t i = 0; i < members; ) {
+        out += ":irc.bench 353 bench = #busy :";
+
+        for (std::size_t j = 0; (j < 50) and (i < members); ++i, ++j) {
+            out += "nick" + std::to_string(i) + "!u@h ";
+        }
+
+        out += "\r\n";
+    }
+
+    out += ":irc.bench 366 bench #busy :End of NAMES\r\n";
+
+    send_all(fd, out);
+
+    in.clear();
+
+    for (ssize_t n; (n = ::recv(fd, buf, sizeof buf, 0)) > 0; ) {
+        in.append(buf, static_cast<std::size_t>(n));
+
+        if (in.find("QUIT ") != std::string::npos) {
+            break;
+        }
+    }
+
+    ::close(fd);
+}
+
+class bench_client : public irc::client {
+public:
+    using irc::client::client;
+
+protected:
+    void on_message(irc::message const& msg) override
+    {
+        if (msg.command == "366") {
+            stop();
+            disconnect("done");
+        }
+    }
+
+    // The server hanging up is how this ends
+    void report_error(std::exception_ptr, int) const override
+    {
+    }
+};
+
+template <typename Fn>
+void measure(char const* name, Fn fn)
+{
+    std::size_t hits = 0;
+    std::size_t before = allocations;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < rounds; ++i) {
+        hits += fn();
+    }
+
+    std::chrono::duration<double, std::nano> took =
+        std::chrono::steady_clock::now() - start;
+
+    std::printf("%-16s %8.1f ns/round %6.2f allocations/round (%zu hits)\n",
+        name, took.count() / rounds,
+        double(allocations - before) / rounds, hits);
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+int main()
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof addr;
+
+    if ((::bind(listener, reinterpret_cast<sockaddr*>(&addr), len) != 0)
+            or (::listen(listener, 1) != 0)
+            or (::getsockname(
+                listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0)) {
+        std::perror("bench_lookup: listen");
+        return 1;
+    }
+
+    std::thread server{serve, listener};
+
+    bench_client client{"bench", "b", "bench"};
+    client.run("127.0.0.1", ntohs(addr.sin_port));
+
+    server.join();
+    ::close(listener);
+
+    irc::environment const& env = client.environment();
+    irc::channel& chan = env.find_channel("#busy");
+
+    std::printf("%zu members, per round: one member and one channel miss\n",
+        chan.users().size());
+
+    std::string const user = "outsider!u@h";
+    std::string const name = "#nowhere";
+
+    measure("find_* + catch", [&] {
+        int hits = 0;
+
+        try {
+            chan.find_user(user);
+            ++hits;
+        } catch (irc::protocol_error const&) {
+        }
+
+        try {
+            env.find_channel(name);
+            ++hits;
+        } catch (irc::protocol_error const&) {
+        }
+
+        return hits;
+    });
+
+    measure("lookup_*", [&] {
+        return int{chan.lookup_user(user) != nullptr}
+             + int{env.lookup_channel(name) != nullptr};
+    });
+
+    return 0;
+}
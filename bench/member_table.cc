@@ -0,0 +1,161 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Channel members in irc::member_table against the node per member layout
+// it replaced: heap held per member once filled, and time per lookup.
+
+#include "irc/member_table.hh"
+#include "irc/network_user.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Bytes held on the heap right now. Each block is prefixed with its size.
+std::size_t held = 0;
+std::size_t const header = alignof(std::max_align_t);
+
+// What channel_user looked like before member_table
+struct node_member {
+    void* channel;
+    irc::network_user* user;
+    std::string modes;
+};
+
+using node_table =
+    std::unordered_map<std::uint64_t, std::unique_ptr<node_member>>;
+
+template <typename Fill, typename Find>
+void measure(
+    char const* name,
+    std::vector<std::unique_ptr<irc::network_user>> const& users,
+    Fill fill,
+    Find find)
+{
+    std::size_t before = held;
+    auto table = fill();
+    double bytes = double(held - before) / users.size();
+
+    std::size_t hits = 0;
+    int const rounds = 20;
+
+    // Once untimed, to have it in cache as far as it fits
+    for (auto const& u : users) {
+        find(table, *u);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < rounds; ++r) {
+        for (auto const& u : users) {
+            hits += find(table, *u);
+        }
+    }
+
+    std::chrono::duration<double, std::nano> took =
+        std::chrono::steady_clock::now() - start;
+
+    std::printf("%9zu  %-14s %7.1f B/member %7.1f ns/lookup\n",
+        users.size(), name, bytes, took.count() / hits);
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    char* p = static_cast<char*>(std::malloc(header + size));
+
+    if (not p) {
+        throw std::bad_alloc{};
+    }
+
+    *reinterpret_cast<std::size_t*>(p) = size;
+    held += size;
+
+    return p + header;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr) {
+        char* p = static_cast<char*>(ptr) - header;
+
+        held -= *reinterpret_cast<std::size_t*>(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+int main()
+{
+    std::printf("  members  layout              held          lookup\n");
+
+    for (std::size_t n : {1000, 10000, 100000}) {
+        std::vector<std::unique_ptr<irc::network_user>> users;
+
+        for (std::size_t i = 0; i < n; ++i) {
+            users.emplace_back(new irc::network_user{
+                i + 1, "nick" + std::to_string(i), "user", "host"});
+        }
+
+        measure("member_table", users,
+            [&] {
+                auto t = std::make_unique<irc::member_table>();
+
+                for (auto const& u : users) {
+                    t->insert(*u);
+                }
+
+                return t;
+            },
+            [] (auto const& t, irc::network_user const& u) {
+                return t->find(u) != nullptr;
+            });
+
+        measure("node per user", users,
+            [&] {
+                auto t = std::make_unique<node_table>();
+
+                for (auto const& u : users) {
+                    t->emplace(u->uid(), std::unique_ptr<node_member>{
+                        new node_member{nullptr, u.get(), ""}});
+                }
+
+                return t;
+            },
+            [] (auto const& t, irc::network_user const& u) {
+                return t->find(u.uid()) != std::end(*t);
+            });
+    }
+
+    return 0;
+}
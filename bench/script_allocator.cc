@@ -0,0 +1,124 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Lua workloads typical of scripts (building strings, short lived tables
+// and closures) run under Lua's default allocator and under
+// script_allocator, best of a few runs each.
+
+#include "lua/script_allocator.hh"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+struct workload {
+    char const* name;
+    char const* code;
+};
+
+workload const workloads[] = {
+    {"strings", R"(
+        local parts = {}
+        for i = 1, 200000 do
+            local s = ("nick%d!user@host%d"):format(i, i % 97)
+            parts[i % 64 + 1] = s:upper() .. " " .. s:sub(1, 8)
+        end
+    )"},
+    {"tables", R"(
+        local keep = {}
+        for i = 1, 200000 do
+            local t = { who = "nick" .. i % 500, what = { i, i + 1 } }
+            keep[i % 1000 + 1] = t
+        end
+    )"},
+    {"closures", R"(
+        local n = 0
+        for i = 1, 200000 do
+            local f = function(x) return x + i end
+            n = f(n) % 1000
+        end
+    )"},
+};
+
+void* default_alloc(void*, void* ptr, std::size_t, std::size_t nsize)
+{
+    if (nsize == 0) {
+        std::free(ptr);
+        return nullptr;
+    }
+
+    return std::realloc(ptr, nsize);
+}
+
+// Seconds the workload took in a fresh state, closing it included
+double run(lua_State* s, char const* code)
+{
+    luaL_openlibs(s);
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (luaL_dostring(s, code) != LUA_OK) {
+        std::fprintf(stderr, "%s\n", lua_tostring(s, -1));
+    }
+
+    lua_close(s);
+
+    std::chrono::duration<double> took =
+        std::chrono::steady_clock::now() - start;
+
+    return took.count();
+}
+
+}
+
+int main()
+{
+    int const runs = 10;
+
+    std::printf("%-10s %12s %12s %14s\n",
+        "workload", "default", "script", "peak reserved");
+
+    for (workload const& w : workloads) {
+        double plain = 1e9;
+        double pooled = 1e9;
+        std::size_t peak = 0;
+
+        for (int i = 0; i < runs; ++i) {
+            plain = std::min(plain,
+                run(lua_newstate(default_alloc, nullptr), w.code));
+
+            script_allocator a;
+            pooled = std::min(pooled,
+                run(lua_newstate(&script_allocator::alloc, &a), w.code));
+
+            peak = a.stats().peak;
+        }
+
+        std::printf("%-10s %10.1f ms %10.1f ms %10zu KiB\n",
+            w.name, plain * 1e3, pooled * 1e3, peak / 1024);
+    }
+
+    return 0;
+}
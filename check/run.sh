@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# Runs luna++ with scripts/check.lua against tools/fake_ircd.py playing
+# scenario.txt, and compares what the script recorded with the "#=" lines
+# of the scenario and the messages luna++ sent with its "#>" lines.
+#
+# Usage: run.sh LUNA
+#
+# LUNA is the luna++ binary. The server listens on port 16669, or $PORT.
+
+set -e
+
+luna=$(readlink -f "$1")
+port=${PORT:-16669}
+
+here=$(cd "$(dirname "$0")" && pwd)
+tools=$(cd "$here/../tools" && pwd)
+lib=$(cd "$here/../scripts/lib" && pwd)
+
+work=$(mktemp -d)
+client=
+
+cleanup() {
+    [ -n "$client" ] && kill "$client" 2>/dev/null
+    rm -rf "$work"
+}
+
+trap cleanup EXIT
+
+mkdir "$work/scripts"
+ln -s "$lib" "$work/scripts/lib"
+cp "$here/scripts/check.lua" "$work/scripts/"
+
+cat > "$work/config.lua" <<EOC
+nick = "luna"
+user = "luna"
+realname = "luna"
+server_addr = "127.0.0.1"
+server_port = $port
+server_password = ""
+ssl = false
+scripts = { "check" }
+autojoin = { "#test", "#other" }
+loglevel = "info"
+ingress_burst = 1000
+ingress_rate = 1000
+EOC
+
+python3 "$tools/fake_ircd.py" "$port" scenario "$here/scenario.txt" \
+    "$work/sent.log" &
+server=$!
+sleep 0.5
+
+cd "$work"
+"$luna" config.lua > luna.log 2>&1 &
+client=$!
+
+# The server returns once the whole scenario was played
+wait "$server"
+
+sed -n 's/^#= //p' "$here/scenario.txt" > expected.log
+sed -n 's/^#> //p' "$here/scenario.txt" > expected_sent.log
+grep "^PRIVMSG" sent.log > privmsg.log || true
+
+if ! diff -u expected.log check.log ||
+   ! diff -u expected_sent.log privmsg.log; then
+    echo "run.sh: check failed, luna++ log:" >&2
+    cat luna.log >&2
+    exit 1
+fi
+
+echo "check: $(wc -l < expected.log) events and" \
+    "$(wc -l < expected_sent.log) messages as expected"
@@ -0,0 +1,187 @@
+--[[
+-- Script API checks, run by check/run.sh against the messages in
+-- check/scenario.txt. Every event is written to check.log, which run.sh
+-- compares with what the scenario expects.
+--]]
+local base64 = require("base64")
+
+local script = {}
+
+script.info = {
+    name        = "check",
+    description = "Script API checks",
+    version     = "1"
+}
+
+local log = assert(io.open("check.log", "w"))
+log:setvbuf("line")
+
+local function record(...)
+    local words = {}
+
+    for i = 1, select("#", ...) do
+        words[i] = tostring((select(i, ...)))
+    end
+
+    log:write(table.concat(words, " "), "\n")
+end
+
+-- Handler order, channel lists, adding and removing handlers while a signal
+-- is dispatched and errors in handlers
+local function check_dispatch()
+    record("remove unknown", (pcall(luna.remove_signal_handler, "nope")))
+
+    luna.add_signal_handler("channel_message", "h1",
+        function(who, where, what)
+            record("h1", where:name(), what, luna.current_signal_handler())
+
+            if what == "remove-h2" then
+                luna.remove_signal_handler("h2")
+            elseif what == "reset" then
+                for _, id in ipairs{ "h3", "h4", "h5", "h1" } do
+                    luna.remove_signal_handler(id)
+                end
+            elseif what == "add-h4" then
+                luna.add_signal_handler("channel_message", "h4",
+                    function(who, where, what) record("h4", what) end)
+            end
+        end)
+
+    luna.add_signal_handler("channel_message", "h2",
+        function(who, where, what) record("h2", what) end)
+
+    luna.add_channel_signal_handler("channel_message", { "#other" }, "h3",
+        function(who, where, what) record("h3", what) end)
+
+    luna.add_channel_signal_handler("channel_message", "#TEST", "h5",
+        function(who, where, what) record("h5", what) end)
+
+    luna.add_signal_handler("channel_message", function(who, where, what)
+        record("once", what)
+        luna.remove_current_handler()
+    end)
+
+    luna.add_signal_handler("channel_message", function(who, where, what)
+        if what == "boom" then
+            record("boom")
+            error("expected error")
+        end
+    end)
+end
+
+-- Command triggers and contexts, argument types, looking commands up
+-- regardless of case and following the own nick
+local function check_commands()
+    luna.add_signal_handler("channel_command", function(who, where, cmd, args)
+        record("channel_command", cmd, "[" .. args .. "]")
+    end)
+
+    luna.add_command("echo", "*l", function(who, where, cmd, args)
+        record("echo", cmd, "[" .. args .. "]", luna.current_signal_handler())
+    end)
+
+    luna.add_command("Words", "*w", function(who, where, cmd, args)
+        record("words", cmd, #args, table.concat(args, "|"))
+    end)
+
+    luna.add_command("shell", function(who, where, cmd, args)
+        record("shell", #args, table.concat(args, "|"))
+    end)
+
+    luna.add_command("once", function(who, where, cmd, args)
+        record("once command")
+        luna.remove_current_handler()
+    end)
+end
+
+-- Message watchers: what they are handed, removing them, errors in them and
+-- how often they matched
+local function check_watchers()
+    local pattern
+
+    pattern = luna.add_message_watcher("fo+ba?r",
+        function(who, where, what, first, last)
+            record("pattern", first, last,
+                luna.current_signal_handler() == pattern)
+        end)
+
+    luna.add_message_watcher("exact.", function(who, where, what, first, last)
+        record("plain", first, last)
+        luna.remove_current_handler()
+    end, true)
+
+    luna.add_message_watcher("(ex)(pl)ode",
+        function(who, where, what, first, last, ex, pl)
+            record("captures", first, last, ex, pl)
+            error("expected error")
+        end)
+
+    luna.add_message_watcher("plode", function(who, where, what, first, last)
+        record("after error", first, last)
+    end)
+
+    luna.remove_signal_handler(luna.add_message_watcher("never", function()
+        record("removed watcher")
+    end))
+
+    luna.add_command("stats", function(who, where)
+        local stats, patterns = luna.message_watcher_stats(), {}
+
+        for _, watcher in pairs(stats) do
+            patterns[#patterns + 1] = watcher
+        end
+
+        table.sort(patterns, function(a, b) return a.pattern < b.pattern end)
+
+        for _, watcher in ipairs(patterns) do
+            record("stats", watcher.pattern, watcher.hits,
+                watcher.candidates >= watcher.hits)
+        end
+    end)
+end
+
+-- Channel filters, set through luna and straight through their shared
+-- variables
+local function check_filters()
+    local key = "luna.channel.#test.filter_in"
+
+    luna.add_command("filter", "*l", function(who, where, cmd, args)
+        args = args:lower()
+
+        if args == "on" then
+            where:set_incoming_filter(function(chan, msg)
+                return msg:upper()
+            end)
+
+            where:set_outgoing_filter(function(chan, msg)
+                return "<" .. msg .. ">"
+            end)
+        elseif args == "off" then
+            where:set_incoming_filter(nil)
+            where:set_outgoing_filter(nil)
+        elseif args == "reverse" then
+            luna.shared[key] = base64.encode(string.dump(function(chan, msg)
+                return msg:reverse()
+            end))
+        elseif args == "drop" then
+            luna.shared[key] = nil
+        end
+
+        record("filter", args, where:incoming_filter() ~= nil,
+            luna.channel_outgoing_filter("#Test") ~= nil)
+    end)
+
+    luna.add_command("say", "*l", function(who, where, cmd, args)
+        record("say", args)
+        where:privmsg(args)
+    end)
+end
+
+function script.script_load()
+    check_dispatch()
+    check_commands()
+    check_watchers()
+    check_filters()
+end
+
+return script
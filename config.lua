@@ -19,3 +19,19 @@ ssl = true
 scripts = {"scriptloader", "base"}
 autojoin = {}
 
+-- Most memory (in MiB) each script may hold, unlimited if unset
+-- script_memory_limit = 64
+
+-- Messages a host may send at once, and per second after that. Hosts that
+-- send more are dropped for ingress_penalty seconds. Buckets are kept for
+-- the ingress_sources most recently seen hosts, and the ingress_offenders
+-- most recent offenders are remembered.
+-- ingress_burst = 8
+-- ingress_rate = 1
+-- ingress_penalty = 30
+-- ingress_sources = 256
+-- ingress_offenders = 64
+
+-- Stream channel and user state changes to local consumers
+-- journal_socket = "/tmp/luna.journal"
+
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LIBIRCCLIENT_ATOM_HH_INCLUDED
+#define LIBIRCCLIENT_ATOM_HH_INCLUDED
+
+/*! \file
+ *  \brief Interned, case-folded names.
+ */
+
+#include "irc/macros.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+namespace irc {
+
+/*! \brief Handle to an interned name.
+ *
+ * Two names map to the same atom if and only if they are equal under rfc1459
+ * case mapping, so atoms can be compared and hashed as plain integers. The
+ * default constructed atom refers to no name at all.
+ */
+class DLL_PUBLIC atom {
+public:
+    constexpr atom() : _id{0}
+    {
+    }
+
+    constexpr explicit atom(uint32_t id) : _id{id}
+    {
+    }
+
+    constexpr uint32_t id() const
+    {
+        return _id;
+    }
+
+    constexpr explicit operator bool() const
+    {
+        return _id != 0;
+    }
+
+    friend constexpr bool operator==(atom a, atom b)
+    {
+        return a._id == b._id;
+    }
+
+    friend constexpr bool operator!=(atom a, atom b)
+    {
+        return a._id != b._id;
+    }
+
+private:
+    uint32_t _id;
+};
+
+
+/*! \brief Maps names to atoms.
+ *
+ * Names are reference counted, see atom_ref, and forgotten as soon as the
+ * last reference to them goes away. An atom keeps referring to the same name
+ * for as long as it is referenced; ids are never handed out twice, so an atom
+ * that outlived its name matches nothing instead of some other name.
+ *
+ * Looking up a name never allocates: the case-folded hash is computed on the
+ * fly and compared against the one stored with each atom.
+ */
+class DLL_PUBLIC atom_table {
+public:
+    atom_table();
+
+    atom_table(atom_table const&)            = delete;
+    atom_table& operator=(atom_table const&) = delete;
+
+    //! The table shared by everything in the process.
+    static atom_table& global();
+
+    //! Returns the atom for the name, interning it if necessary, and adds a
+    //! reference to it.
+    atom acquire(std::string const& name);
+
+    //! Adds a reference to a name that is still interned.
+    void retain(atom a);
+
+    //! Drops a reference, forgetting the name if it was the last one.
+    void release(atom a);
+
+    //! Returns the atom for the name, or no atom if it isn't interned.
+    atom find(std::string const& name) const;
+    atom find(char const* name, std::size_t length) const;
+
+    //! Whether the atom still refers to a name.
+    bool valid(atom a) const;
+
+    //! The case-folded name of the atom.
+    std::string const& folded(atom a) const;
+
+    //! The case-folded hash of the atom's name.
+    std::size_t hash(atom a) const;
+
+    //! Number of names currently interned.
+    std::size_t size() const;
+
+    //! Hash of the name under rfc1459 case mapping.
+    static std::size_t fold_hash(char const* name, std::size_t length);
+
+private:
+    struct entry {
+        std::string folded;
+        std::size_t hash;
+        std::size_t refs;
+    };
+
+    DLL_LOCAL entry& get(atom a);
+    DLL_LOCAL entry const& get(atom a) const;
+    DLL_LOCAL std::size_t probe(
+        char const* name,
+        std::size_t length,
+        std::size_t hash) const;
+
+    DLL_LOCAL void erase_slot(std::size_t slot);
+    DLL_LOCAL void rehash(std::size_t slots);
+
+private:
+    std::unordered_map<uint32_t, entry> _entries;
+    uint32_t _last_id = 0;
+
+    // Open addressing with linear probing, holding atom ids (0 = free slot).
+    // The size is a power of two, at least twice the number of atoms and, past
+    // the initial 64 slots, at most eight times.
+    std::vector<uint32_t> _index;
+};
+
+
+/*! \brief A counted reference to an atom of the global table.
+ *
+ * Keeps the name interned for as long as it exists, and converts to the atom
+ * it refers to. Anything that holds on to an atom beyond the object it came
+ * from has to do so through one of these.
+ */
+class DLL_PUBLIC atom_ref {
+public:
+    atom_ref() = default;
+
+    //! Interns the name if necessary.
+    explicit atom_ref(std::string const& name);
+
+    //! \p a has to be still interned, or no atom.
+    explicit atom_ref(atom a);
+
+    atom_ref(atom_ref const& other);
+    atom_ref(atom_ref&& other) noexcept;
+
+    atom_ref& operator=(atom_ref other) noexcept;
+
+    ~atom_ref();
+
+    atom get() const
+    {
+        return _atom;
+    }
+
+    operator atom() const
+    {
+        return _atom;
+    }
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(_atom);
+    }
+
+private:
+    atom _atom;
+};
+
+}
+
+namespace std {
+
+template <>
+struct hash<irc::atom> {
+    std::size_t operator()(irc::atom a) const
+    {
+        return a.id();
+    }
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_ATOM_HH_INCLUDED
@@ -23,19 +23,28 @@
 
 #include "irc/macros.h"
 #include "irc/irc_utils.hh"
+#include "irc/atom.hh"
+#include "irc/handle_table.hh"
+#include "irc/member_table.hh"
+#include "irc/list_mode.hh"
+#include "irc/mask_matcher.hh"
+#include "irc/member_query.hh"
 
 #include <ctime>
+#include <cstdint>
 
 #include <tuple>
 #include <vector>
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <utility>
 
 namespace irc {
 
 class environment;
 class channel_user;
+class network_user;
 
 
 /*! \brief An IRC channel.
@@ -52,91 +61,178 @@ public:
             std::string,  // User that set it
             std::time_t>; // Time when set
 
-    // Value may be empty (simple modes). One mode can map to multiple arguments
-    // due to user list modes. The interpretation of the contents in this map
-    // depends on the mode type of the value (see
+    // Value may be empty (simple modes). Address list modes (bans, ...) are
+    // kept separately in list_modes. The interpretation of the contents in
+    // this map depends on the mode type of the value (see
     // environment::get_mode_argument_type()).
     //
     // channel::[un]set_mode(), channel::change_mode() and channel::get_mode()
     //  will do the correct thing according to the mode in question.
-    using mode_list = std::unordered_multimap<char, std::string>;
-    using user_list = unordered_user_map<std::unique_ptr<channel_user>>;
+    using mode_list  = std::unordered_multimap<char, std::string>;
+    using list_modes = std::unordered_map<char, list_mode>;
+    using user_list  = member_table;
 
-    channel(std::string name);
+    channel(environment& env, std::string name);
 
-    channel(channel const& c);
-    channel& operator=(channel const& c);
-
-    channel(channel&&)            = default;
-    channel& operator=(channel&&) = default;
+    // Users index the channels they are in, so it must stay in place.
+    channel(channel const&)            = delete;
+    channel& operator=(channel const&) = delete;
 
     // Accessors
     std::string      name()    const;
+    atom        name_atom()    const;
+
+    // Stays valid while the channel exists, see environment::resolve().
+    irc::handle<channel> handle() const;
     std::time_t      created() const;
     topic_info       topic()   const;
     user_list const& users()   const;
     mode_list const& modes()   const;
+    list_modes const& lists()  const;
+
+    // Bumped whenever members (joins, parts, nick, host and prefix changes),
+    // modes or the topic change. Generations are unique across all channels,
+    // so anything derived from a channel can tell whether it is stale.
+    uint64_t member_generation() const;
+    uint64_t   mode_generation() const;
+    uint64_t  topic_generation() const;
 
     // Operations
     bool           has_user(std::string const& user) const;
     channel_user& find_user(std::string const& user) const;
+    channel_user& find_user(uint64_t uid) const;
+
+    // Same as find_user(), but nullptr if the user is not in the channel.
+    channel_user* lookup_user(std::string const& user) const;
+    channel_user* lookup_user(uint64_t uid) const;
 
     std::vector<std::string> get_mode(       char modefl) const;
     std::string              get_mode_simple(char modefl) const;
 
+    // Entries of a list mode, nullptr if the list is empty.
+    list_mode const* find_list(char modefl) const;
+
     bool is_mode_set(char modefl) const;
 
+    // Compiled masks of a list mode, indices follow the entries of
+    // find_list(). Compiled on first use and kept until an entry is removed.
+    mask_matcher const& list_matcher(char modefl) const;
+
+    // Entries of a list mode matching the user, e.g. the bans hitting them.
+    std::vector<list_entry const*> matching_entries(
+        char modefl,
+        network_user const& user) const;
+
+    // Members matching a hostmask, e.g. those a ban would hit.
+    std::vector<channel_user const*> matching_users(
+        std::string const& mask) const;
+
+    /*! \brief Members matching the query, evaluated in place.
+     *
+     * Scans the members from `cursor' on (0 to start at the beginning) and
+     * stops after `limit' matches. Returns the cursor to continue from, or 0
+     * once all members were scanned. Cursors only stay meaningful as long as
+     * no members join or leave.
+     */
+    std::size_t query(
+        member_query const& q,
+        std::vector<channel_user const*>& out,
+        std::size_t limit  = std::size_t(-1),
+        std::size_t cursor = 0) const;
+
+    // Prefix modes of a member by mode character, in PREFIX order ("ov").
+    std::string user_modes(channel_user const& user) const;
+    bool user_has_mode(channel_user const& user, char modefl) const;
+
+    // Prefix symbol of the member's highest mode ('@'), or 0 if none.
+    char user_prefix(channel_user const& user) const;
+
     // Meta-Management
     void set_topic(std::string topic);
     void set_topic_meta(std::string setter, std::time_t settime);
 
     void set_created(time_t created);
 
-    // Mode management
+    // Mode management. List entries added with a setter are stamped with the
+    // current time.
     void apply_modes(
         std::string const& modes,
         std::vector<std::string> const& args,
-        environment const& env);
+        environment const& env,
+        std::string const& setter = "");
 
-    // User management
-    channel_user& create_user(std::string prefix);
-    channel_user& create_user(
-        std::string nick,
-        std::string user,
-        std::string host);
+    // Adds a list entry as reported by RPL_BANLIST and friends.
+    void add_list_entry(
+        char modefl,
+        std::string mask,
+        std::string setter,
+        std::time_t set_time);
 
-    void rename_user(
-        std::string const& old_nick,
-        std::string const& new_nick);
+private:
+    // Membership is managed by the environment, which keeps the users'
+    // reverse index in sync.
+    friend class environment;
 
-    void remove_user(channel_user& user);
+    DLL_LOCAL channel_user& add_user(network_user& user);
+    DLL_LOCAL void       remove_user(network_user& user);
 
-private:
     DLL_LOCAL void set_mode(
         char modefl,
         std::string const& argument,
-        environment const& env);
+        environment const& env,
+        std::string const& setter);
 
     DLL_LOCAL void unset_mode(
         char modefl,
         std::string const& argument,
         environment const& env);
 
-    DLL_LOCAL void set_list_mode(char modefl, std::string const& argument);
+    DLL_LOCAL void set_list_mode(
+        char modefl,
+        std::string const& argument,
+        std::string const& setter);
+
     DLL_LOCAL void set_simple_mode(char modefl, std::string const& argument);
 
     DLL_LOCAL void unset_list_mode(char modefl, std::string const& argument);
     DLL_LOCAL void unset_simple_mode(char modefl);
 
+    DLL_LOCAL void matcher_added(char modefl, list_mode const& list);
+
+    DLL_LOCAL void members_changed();
+    DLL_LOCAL void    modes_changed();
+    DLL_LOCAL void    topic_changed();
+
+    // Note what the next snapshot of the channel has to update.
+    DLL_LOCAL void member_changed(uint64_t uid);
+    DLL_LOCAL void  entry_changed(char modefl, std::string const& mask);
+
 private:
-    mode_list _modes;
-    user_list _users;
+    environment* _env;
+
+    mode_list  _modes;
+    list_modes _lists;
+    mutable std::unordered_map<char, mask_matcher> _matchers;
+    user_list  _users;
 
     std::string _name;
+    atom_ref _name_atom;
+
+    irc::handle<channel> _handle;
+
     std::time_t _created;
     topic_info  _topic;
 
-    uint64_t _next_uid = 0;
+    uint64_t _member_gen;
+    uint64_t   _mode_gen;
+    uint64_t  _topic_gen;
+
+    // Members and list entries changed since the environment last published
+    // the channel, see environment::publish(). Not kept while the channel
+    // has to be published in full anyway.
+    std::vector<uint64_t> _changed_members;
+    std::vector<std::pair<char, std::string>> _changed_entries;
+    bool _publish_all = true;
 };
 
 }
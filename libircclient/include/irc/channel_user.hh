@@ -23,65 +23,70 @@
 
 #include "irc/macros.h"
 
+#include <ctime>
 #include <cstdint>
 
 #include <string>
 
 namespace irc {
 
-class channel;
+class network_user;
+class member_table;
 
 /*! \brief An IRC channel user.
  *
- * Used by the channel to update information about an active IRC channel user.
- * Can be used by anyone to fetch details about, or to use it as a target for
- * commands.
+ * Membership of a network_user in a channel. Only the channel specific state
+ * is stored here, the identity is shared by all of the user's memberships.
+ *
+ * The user's prefix modes (operator, voice, ...) are kept as a bitset where
+ * bit `n` stands for the `n`th mode of the server's `PREFIX`, so bit 0 is the
+ * highest rank. Use channel::user_modes() and friends to get at them by mode
+ * character.
  */
 class DLL_PUBLIC channel_user {
 public:
-    channel_user(class channel& channel, uint64_t uid, std::string prefix);
-    channel_user(
-        class channel& channel,
-        uint64_t uid,
-        std::string nick,
-        std::string user,
-        std::string host);
+    using prefix_set = uint32_t;
+
+    //! Number of distinct prefix modes that can be tracked.
+    static constexpr unsigned max_prefixes = 32;
 
-    channel_user(channel_user const&)            = default;
-    channel_user& operator=(channel_user const&) = default;
+    channel_user(irc::network_user& user);
 
-    channel_user(channel_user&&)            = default;
-    channel_user& operator=(channel_user&&) = default;
+    //! An unused member_table slot.
+    channel_user() = default;
 
-    irc::channel& channel() const;
+    irc::network_user& network_user() const;
 
     uint64_t     uid() const;
     std::string nick() const;
     std::string user() const;
     std::string host() const;
 
-    std::string modes() const;
-    bool has_mode(char modefl) const;
+    prefix_set prefixes() const;
+    bool has_prefix(unsigned rank) const;
 
-    void rename(std::string new_nick);
+    //! Rank of the highest prefix the user has, or -1 if they have none.
+    int highest_prefix() const;
 
-    void set_mode(char modefl);
-    void unset_mode(char modefl);
+    void set_prefix(unsigned rank);
+    void unset_prefix(unsigned rank);
+
+    //! When the member last joined or spoke, 0 if not since we joined.
+    std::time_t last_active() const;
+    void set_active(std::time_t when);
 
 private:
-    friend class channel;
-    friend class client;
+    friend class member_table;
+    friend class environment;
 
-    irc::channel* _channel;
-    uint64_t _uid;
+    irc::network_user* _user = nullptr;
+    prefix_set _prefixes     = 0;
 
-    std::string _nick;
-    std::string _user;
-    std::string _host;
-    std::string _modes;
+    // Seconds since the epoch, in 32 unsigned bits (good until 2106) so an
+    // entry stays at 16 bytes
+    uint32_t _last_active = 0;
 };
 
 }
 
 #endif // defined LIBIRCCLIENT_CHANNEL_USER_HH_INCLUDED
-
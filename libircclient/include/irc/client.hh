@@ -38,6 +38,8 @@ namespace irc {
 
 struct message;
 class environment;
+class environment_snapshot;
+class state_journal;
 
 class DLL_PUBLIC client {
 public:
@@ -88,6 +90,18 @@ public:
 
     irc::environment const& environment() const;
 
+    // The latest published snapshot of the environment (nullptr before the
+    // first one). Unlike environment(), this may be called from any thread.
+    // Snapshots are published on every idle tick that follows changes, their
+    // versions count up from 1 for each connection.
+    std::shared_ptr<environment_snapshot const> snapshot() const;
+
+    // Changes to the environment as they happen. It lives as long as the
+    // client, every new connection starts with a reset delta. Like
+    // environment(), only to be used from the thread running the client.
+    state_journal&       journal();
+    state_journal const& journal() const;
+
 protected:
     bool is_me(std::string user) const;
 
@@ -122,6 +136,9 @@ private:
     DLL_LOCAL void run_core_handler(handler const& handler, message const& msg);
     DLL_LOCAL void run_user_handler(message const& msg);
 
+    DLL_LOCAL bool is_split_quit(message const& msg) const;
+    DLL_LOCAL void flush_split_quits();
+
     DLL_LOCAL void init_core_handlers();
 
 private:
@@ -22,17 +22,29 @@
 #define LIBIRCCLIENT_ENVIRONMENT_HH_INCLUDED
 
 #include "irc/irc_utils.hh"
+#include "irc/atom.hh"
+#include "irc/handle_table.hh"
+#include "irc/state_journal.hh"
+#include "irc/channel_user.hh"
 
 #include <ctime>
+#include <cstddef>
+#include <cstdint>
 
+#include <array>
 #include <tuple>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include <memory>
 
 namespace irc {
 
 class channel;
+class channel_user;
+class network_user;
+class environment_snapshot;
+struct channel_snapshot;
 
 /*! \brief The different classifications of channel modes */
 enum class channel_mode_argument_type {
@@ -47,13 +59,21 @@ enum class channel_mode_argument_type {
  *
  * Contains information about supported server features and details of
  * implementation. Used by the client to create, find and remove channels.
+ *
+ * The environment itself may only be used from the thread driving the
+ * client. Other threads read immutable snapshots of it instead, which the
+ * client publishes after each batch of changes (see client::snapshot()).
  */
 class DLL_PUBLIC environment {
 public:
     // use pointers to channels so we can expose an immutable _channels, with
     // mutable channel elements.
     using channel_list =
-        unordered_rfc1459_map<std::string, std::unique_ptr<channel>>;
+        std::unordered_map<atom, std::unique_ptr<channel>>;
+
+    // Every user sharing a channel with us, once per network, by uid.
+    using user_list =
+        std::unordered_map<uint64_t, std::unique_ptr<network_user>>;
 
     using channel_prefixes = std::unordered_map<char, char>;
 
@@ -73,10 +93,12 @@ public:
     environment();
 
     environment(environment const& rhs);
-    environment(environment&&)      = default;
+    ~environment();
 
+    // Channels refer back to their environment, so it must stay in place.
+    environment(environment&&)                 = delete;
     environment& operator=(environment const&) = delete;
-    environment& operator=(environment&&)      = default;
+    environment& operator=(environment&&)      = delete;
 
     void        set_capability(std::string const& cap, std::string const& val);
     std::string get_capability(std::string const& cap) const;
@@ -85,11 +107,25 @@ public:
 
     // {{'@', 'o'}, {'+', 'v'}, ...}
     channel_prefixes const&   prefixes()  const;
+
+    // Prefix modes and their symbols ordered by rank, highest first ("ov",
+    // "@+"). The rank of a mode is its position in there, -1 if not a prefix.
+    std::string prefix_modes()   const;
+    std::string prefix_symbols() const;
+
+    int  prefix_rank(char mode)       const;
+    char prefix_symbol(unsigned rank) const;
+
+    // Rank of the mode behind a prefix symbol ('@' -> 0), -1 if not a prefix.
+    int symbol_rank(char symbol) const;
     channel_mode_types const& chanmodes() const;
 
     std::string channel_types() const;
     bool is_channel(std::string const& subj) const;
 
+    // Maximum number of parameterized modes per MODE command (0 = unlimited)
+    std::size_t max_modes() const;
+
     // Distributes channel modes with their respective flags
     channel_mode_changes partition_mode_changes(
         std::string const& modes,
@@ -98,20 +134,117 @@ public:
     channel_list const& channels() const;
 
     bool has_channel(std::string const& channel) const;
+    bool has_channel(atom channel) const;
+
     channel& find_channel(std::string const& channel) const;
+    channel& find_channel(atom channel) const;
+
+    // Same as find_channel(), but nullptr if there is no such channel.
+    channel* lookup_channel(std::string const& channel) const;
+    channel* lookup_channel(atom channel) const;
+
+    user_list const& users() const;
+
+    // Users may be given as nick names or full prefixes.
+    bool has_user(std::string const& user) const;
+    network_user& find_user(std::string const& user) const;
+    network_user& find_user(uint64_t uid) const;
+
+    // Same as find_user(), but nullptr if there is no such user.
+    network_user* lookup_user(std::string const& user) const;
+    network_user* lookup_user(uint64_t uid) const;
 
     channel_mode_argument_type get_mode_argument_type(char mode) const;
 
+    // Resolve handles of channels and users, nullptr if they are gone.
+    channel*      resolve(handle<channel> h)      const;
+    network_user* resolve(handle<network_user> h) const;
+
 private:
     // anything a client can do to us
     friend class client;
+    friend class channel;
 
     DLL_LOCAL channel& create_channel(std::string name);
     DLL_LOCAL void     remove_channel(channel& channel);
 
+    // Adds the user to the channel, registering them first if they are not
+    // known yet. Empty user or host names don't overwrite known ones, and
+    // prefixes add to the ones the member already has.
+    DLL_LOCAL channel_user& join_user(
+        channel& channel,
+        std::string const& nick,
+        std::string const& user,
+        std::string const& host,
+        channel_user::prefix_set prefixes = 0);
+
+    /*! Adds the members of an RPL_NAMREPLY ("@nick +nick2 nick3", may be
+     * multi-prefix and/or userhost-in-names) to the channel in one go.
+     * Prefixes add to the ones members already have.
+     */
+    DLL_LOCAL void add_names(channel& channel, std::string const& names);
+
+    // Gives the member those of the prefixes they don't have yet, returns
+    // whether there were any
+    DLL_LOCAL bool add_prefixes(
+        channel& channel,
+        channel_user& member,
+        channel_user::prefix_set prefixes);
+
+    DLL_LOCAL void part_user(channel& channel, network_user& user);
+    DLL_LOCAL void quit_user(network_user& user);
+
+    // Removes a whole netsplit worth of users, skipping those already gone.
+    DLL_LOCAL void quit_users(std::vector<handle<network_user>> const& users);
+
+    DLL_LOCAL void rename_user(network_user& user, std::string new_nick);
+    DLL_LOCAL void change_host(
+        network_user& user,
+        std::string new_user,
+        std::string new_host);
+
+    DLL_LOCAL void set_account(network_user& user, std::string account);
+
+    DLL_LOCAL network_user& register_user(
+        std::string nick,
+        std::string user,
+        std::string host);
+
+    DLL_LOCAL network_user* lookup_nick(
+        char const* nick,
+        std::size_t length) const;
+
+    DLL_LOCAL void forget_user(network_user& user);
+
+    // Returns a snapshot of the current state, sharing everything that did
+    // not change with the previous one. Returns the previous one as is if
+    // nothing changed at all.
+    DLL_LOCAL std::shared_ptr<environment_snapshot const> publish();
+
+    // Apply the changes noted by the channel to its last snapshot
+    DLL_LOCAL void publish_changes(
+        channel& chan,
+        channel_snapshot& snap) const;
+
+    // Note changes for the next snapshot
+    DLL_LOCAL void touch_channel(atom channel);
+    DLL_LOCAL void touch_user(uint64_t uid);
+
+    // A member's nick or host changed in all of their channels
+    DLL_LOCAL void identity_changed(network_user const& user);
+
+    // Note changes in the journal, if there is one
+    DLL_LOCAL void record(
+        state_delta::kind type,
+        atom channel,
+        uint64_t uid,
+        char mode = '\0',
+        std::string arg = "");
+
 private:
     DLL_LOCAL void init_channel_modes(std::string const& chanmodes);
     DLL_LOCAL void init_channel_prefixes(std::string const& prefix);
+    DLL_LOCAL void init_symbol_ranks();
 
 private:
     unordered_rfc1459_map<std::string, std::string> _capabilities;
@@ -121,10 +254,35 @@ private:
         channel_mode_types{"beI", "k", "l", "imnpstaqr"};
 
     channel_prefixes _channel_prefixes = {{'@', 'o'}, {'%', 'h'}, {'+', 'v'}};
-    std::string _prefix_modes  = "ovh";
+    std::string _prefix_modes   = "ohv";
+    std::string _prefix_symbols = "@%+";
+
+    // symbol_rank() by (unsigned) character
+    std::array<int8_t, 256> _symbol_ranks;
     std::string _channel_types = "#&";
 
+    // RFC 2812 guarantees at least 3 until the server says otherwise.
+    std::size_t _max_modes = 3;
+
     channel_list _channels;
+
+    user_list _users;
+    std::unordered_map<atom, network_user*> _nicks;
+
+    handle_table<channel>      _channel_handles;
+    handle_table<network_user> _user_handles;
+
+    uint64_t _next_uid = 0;
+
+    // Changed (or removed) since the last snapshot, may hold duplicates.
+    bool _dirty_server = true;
+    std::vector<atom_ref> _dirty_channels;
+    std::vector<uint64_t> _dirty_users;
+
+    std::shared_ptr<environment_snapshot const> _published;
+
+    // Owned by the client, copies of the environment don't record anything.
+    state_journal* _journal = nullptr;
 };
 
 }
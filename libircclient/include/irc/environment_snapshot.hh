@@ -0,0 +1,149 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_ENVIRONMENT_SNAPSHOT_HH_INCLUDED
+#define LIBIRCCLIENT_ENVIRONMENT_SNAPSHOT_HH_INCLUDED
+
+#include "irc/macros.h"
+#include "irc/atom.hh"
+#include "irc/channel.hh"
+#include "irc/environment.hh"
+#include "irc/persistent_map.hh"
+
+#include <ctime>
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace irc {
+
+//! A user as of a snapshot.
+struct DLL_PUBLIC user_snapshot {
+    uint64_t uid;
+
+    std::string nick;
+    std::string user;
+    std::string host;
+    std::string account;
+
+    //! Case-folded names of the channels the user is in.
+    std::vector<std::string> channels;
+};
+
+//! A channel as of a snapshot.
+struct DLL_PUBLIC channel_snapshot {
+    struct member {
+        uint64_t uid;
+        uint32_t prefixes;  //!< Prefix modes by rank, see channel_user
+    };
+
+    using member_map = persistent_map<uint64_t, member>;
+
+    //! The entries of a list mode, keyed by case-folded mask.
+    using entry_map = persistent_map<std::string, list_entry>;
+
+    std::string name;
+    std::time_t created;
+
+    channel::topic_info topic;
+    channel::mode_list  modes;
+
+    //! By mode, only modes with entries are present.
+    std::unordered_map<char, entry_map> lists;
+
+    //! Keyed by uid.
+    member_map members;
+
+    //! Returns the member with the uid, nullptr if not in the channel.
+    member const* find_member(uint64_t uid) const;
+};
+
+//! Server features as of a snapshot.
+struct DLL_PUBLIC server_snapshot {
+    unordered_rfc1459_map<std::string, std::string> capabilities;
+
+    environment::channel_mode_types chanmodes;
+
+    std::string prefix_modes;
+    std::string prefix_symbols;
+    std::string channel_types;
+
+    std::size_t max_modes;
+};
+
+
+/*! \brief An immutable version of an environment.
+ *
+ * Published by the environment from the thread that drives the client, and
+ * safe to read from any number of other threads. Parts that did not change
+ * between two versions are shared rather than copied: publishing costs in
+ * proportion to what changed, and holding on to a snapshot costs nothing but
+ * the memory of what changed since.
+ *
+ * Channels and nicks are keyed by their case-folded name, so lookups don't
+ * touch the (single threaded) atom table.
+ */
+class DLL_PUBLIC environment_snapshot {
+public:
+    using channel_map =
+        persistent_map<std::string, channel_snapshot>;
+
+    using user_map =
+        persistent_map<uint64_t, user_snapshot>;
+
+    //! Counts up from 1 with every published version of an environment.
+    uint64_t version() const;
+
+    server_snapshot const& server() const;
+
+    channel_map const& channels() const;
+    user_map    const& users()    const;
+
+    //! Returns nullptr if there is no such channel.
+    std::shared_ptr<channel_snapshot const> find_channel(
+        std::string const& name) const;
+
+    //! Users may be given as nick names or full prefixes. Returns nullptr
+    //! if there is no such user.
+    std::shared_ptr<user_snapshot const> find_user(
+        std::string const& user) const;
+
+    std::shared_ptr<user_snapshot const> find_user(uint64_t uid) const;
+
+private:
+    friend class environment;
+
+    uint64_t _version = 0;
+
+    std::shared_ptr<server_snapshot const> _server;
+
+    channel_map _channels;
+    user_map    _users;
+    persistent_map<std::string, user_snapshot> _nicks;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_ENVIRONMENT_SNAPSHOT_HH_INCLUDED
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_HANDLE_TABLE_HH_INCLUDED
+#define LIBIRCCLIENT_HANDLE_TABLE_HH_INCLUDED
+
+#include "irc/macros.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+namespace irc {
+
+//! Generation for a newly issued handle, unique across all handle tables.
+extern DLL_PUBLIC uint32_t next_handle_generation();
+
+/*! \brief Weak reference to an object in a handle_table.
+ *
+ * Refers to a slot in the table together with the generation of the object
+ * that was in there when the handle was issued. Once the object is gone, the
+ * handle no longer resolves, even if the slot has been reused since. The
+ * default constructed handle never resolves.
+ */
+template <typename T>
+class handle {
+public:
+    constexpr handle() : _index{0}, _generation{0}
+    {
+    }
+
+    constexpr handle(uint32_t index, uint32_t generation)
+        : _index{index}, _generation{generation}
+    {
+    }
+
+    constexpr uint32_t index()      const { return _index; }
+    constexpr uint32_t generation() const { return _generation; }
+
+    constexpr explicit operator bool() const
+    {
+        return _generation != 0;
+    }
+
+    friend constexpr bool operator==(handle a, handle b)
+    {
+        return (a._index == b._index) and (a._generation == b._generation);
+    }
+
+    friend constexpr bool operator!=(handle a, handle b)
+    {
+        return not (a == b);
+    }
+
+private:
+    uint32_t _index;
+    uint32_t _generation;
+};
+
+
+/*! \brief Hands out handles to objects owned elsewhere.
+ *
+ * Resolving a handle is a bounds check, an array access and a comparison.
+ * Slots of removed objects are reused, but since every handle gets a fresh
+ * generation (from a process wide counter), stale handles are told apart
+ * from the new occupant, and handles from other tables don't resolve by
+ * accident either.
+ */
+template <typename T>
+class handle_table {
+public:
+    //! Registers the object, which must stay in place until erased.
+    handle<T> insert(T& obj)
+    {
+        uint32_t index;
+
+        if (_free.empty()) {
+            index = static_cast<uint32_t>(_slots.size());
+            _slots.emplace_back();
+        } else {
+            index = _free.back();
+            _free.pop_back();
+        }
+
+        _slots[index] = slot{&obj, next_handle_generation()};
+
+        return handle<T>{index, _slots[index].generation};
+    }
+
+    //! Invalidates the handle, does nothing if it's stale already.
+    void erase(handle<T> h)
+    {
+        if (get(h)) {
+            _slots[h.index()] = slot{nullptr, 0};
+            _free.push_back(h.index());
+        }
+    }
+
+    //! Returns the object, nullptr if the handle is stale.
+    T* get(handle<T> h) const
+    {
+        if ((h.index() >= _slots.size())
+                or (_slots[h.index()].generation != h.generation())
+                or (h.generation() == 0)) {
+            return nullptr;
+        }
+
+        return _slots[h.index()].object;
+    }
+
+    void clear()
+    {
+        _slots.clear();
+        _free.clear();
+    }
+
+private:
+    struct slot {
+        T* object;
+        uint32_t generation;
+    };
+
+    std::vector<slot>     _slots;
+    std::vector<uint32_t> _free;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_HANDLE_TABLE_HH_INCLUDED
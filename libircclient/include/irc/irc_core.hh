@@ -387,6 +387,15 @@ namespace command {
     // <nickname>{<space><nickname>}
     constexpr char const* ISON     = "ISON";
 
+    /// IRCv3 extensions
+    //
+
+    // <account> (account-notify, "*" if logged out)
+    constexpr char const* ACCOUNT  = "ACCOUNT";
+
+    // <new user> <new host> (chghost)
+    constexpr char const* CHGHOST  = "CHGHOST";
+
 } // namespace command
 
 
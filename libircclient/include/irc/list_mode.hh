@@ -0,0 +1,96 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LIBIRCCLIENT_LIST_MODE_HH_INCLUDED
+#define LIBIRCCLIENT_LIST_MODE_HH_INCLUDED
+
+#include "irc/macros.h"
+
+#include <ctime>
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace irc {
+
+//! An entry of an address list mode (ban, exception, invite exception, ...)
+struct DLL_PUBLIC list_entry {
+    std::string mask;
+    std::string setter;     //!< Who set it, may be empty if unknown
+    std::time_t set_time;   //!< When it was set, 0 if unknown
+};
+
+/*! \brief The entries of one address list mode of a channel.
+ *
+ * Entries are stored contiguously and indexed by their case-folded mask, so
+ * lookups, insertions and removals take constant time regardless of the size
+ * of the list. Removing an entry moves the last entry into its place, so the
+ * order of entries is unspecified and indices are only stable as long as the
+ * list is not changed.
+ */
+class DLL_PUBLIC list_mode {
+public:
+    using const_iterator = std::vector<list_entry>::const_iterator;
+
+    std::size_t size()  const;
+    bool        empty() const;
+
+    const_iterator begin() const;
+    const_iterator end()   const;
+
+    list_entry const& operator[](std::size_t i) const;
+
+    //! Returns the entry with the given mask, or nullptr if there is none.
+    list_entry const* find(std::string const& mask) const;
+    bool contains(std::string const& mask) const;
+
+    /*! \brief Add an entry.
+     *
+     * If the mask is already listed, only missing setter and time information
+     * is filled in. Returns whether the mask was added.
+     */
+    bool insert(std::string mask, std::string setter, std::time_t set_time);
+
+    //! Remove an entry, returns whether the mask was listed.
+    bool erase(std::string const& mask);
+
+    void clear();
+
+private:
+    DLL_LOCAL std::size_t probe(
+        std::string const& mask,
+        std::size_t hash) const;
+
+    DLL_LOCAL void rehash(std::size_t capacity);
+
+private:
+    std::vector<list_entry>  _entries;
+    std::vector<std::size_t> _hashes;   // Folded hash of each entry's mask
+
+    // Open addressing with linear probing, holding entry index + 1 (0 = free
+    // slot). The size is 0 or a power of two at least twice the entry count.
+    std::vector<uint32_t> _index;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_LIST_MODE_HH_INCLUDED
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_MASK_MATCHER_HH_INCLUDED
+#define LIBIRCCLIENT_MASK_MATCHER_HH_INCLUDED
+
+#include "irc/macros.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace irc {
+
+class list_mode;
+
+/*! \brief A set of compiled hostmasks (nick!user@host globs).
+ *
+ * Masks are case-folded once when added and put into a bucket by their most
+ * selective literal part: the last two labels of the host ("*!*@*.example.com"),
+ * the first two labels of the host ("*!*@192.168.*"), or the first character
+ * of the nick. Matching a user only tries the masks of the buckets the user
+ * falls into, plus those that could not be bucketed at all, so it scales with
+ * the number of candidate masks rather than the size of the set.
+ *
+ * Extended bans ("$a:account", "~q:mask", "R:account") are not hostmasks.
+ * They are kept but never matched, see extbans().
+ */
+class DLL_PUBLIC mask_matcher {
+public:
+    mask_matcher();
+
+    //! Compiles all entries of a list mode, indices follow the list's order.
+    explicit mask_matcher(list_mode const& list);
+
+    //! Adds a mask and returns its index.
+    std::size_t add(std::string const& mask);
+
+    std::size_t size()  const;
+    bool        empty() const;
+
+    std::string const& mask(std::size_t i) const;
+
+    //! Indices of the masks that are extended bans.
+    std::vector<std::size_t> const& extbans() const;
+
+    //! Indices of all masks matching the user, in ascending order.
+    std::vector<std::size_t> match(
+        std::string const& nick,
+        std::string const& user,
+        std::string const& host) const;
+
+    //! Whether the mask with the given index matches the user.
+    bool matches(
+        std::size_t i,
+        std::string const& nick,
+        std::string const& user,
+        std::string const& host) const;
+
+    //! Whether any mask matches the user.
+    bool matches_any(
+        std::string const& nick,
+        std::string const& user,
+        std::string const& host) const;
+
+    //! Whether the mask is an extended ban rather than a hostmask.
+    static bool is_extban(std::string const& mask);
+
+    /*! \brief Match a single glob against a string.
+     *
+     * '*' matches any sequence, '?' any single character. Comparison uses
+     * rfc1459 case mapping.
+     */
+    static bool glob_match(std::string const& glob, std::string const& str);
+
+    //! Same, for a glob that is case-folded already. Doesn't allocate.
+    static bool folded_glob_match(
+        std::string const& glob,
+        std::string const& str);
+
+private:
+    struct compiled {
+        std::string glob;       // Case-folded
+        std::size_t literals;   // Minimum length of a matching string
+    };
+
+    template <typename F>
+    DLL_LOCAL bool for_candidates(
+        std::string const& nick,
+        std::string const& user,
+        std::string const& host,
+        F&& f) const;
+
+private:
+    std::vector<std::string> _masks;
+    std::vector<compiled>    _compiled;
+    std::vector<std::size_t> _extbans;
+
+    std::unordered_map<std::string, std::vector<uint32_t>> _host_suffix;
+    std::unordered_map<std::string, std::vector<uint32_t>> _host_prefix;
+    std::vector<std::vector<uint32_t>> _nick_first;
+    std::vector<uint32_t>              _unanchored;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_MASK_MATCHER_HH_INCLUDED
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_MEMBER_QUERY_HH_INCLUDED
+#define LIBIRCCLIENT_MEMBER_QUERY_HH_INCLUDED
+
+#include "irc/macros.h"
+
+#include <ctime>
+
+#include <string>
+
+namespace irc {
+
+/*! \brief Filter for channel members, see channel::query().
+ *
+ * Members have to satisfy every criterion that is set. Masks are globs ('*'
+ * and '?') compared using rfc1459 case mapping.
+ */
+struct DLL_PUBLIC member_query {
+    std::string modes;          //!< Prefix modes they need all of ("ov")
+    char        at_least = 0;   //!< Prefix mode they need or outrank ('v')
+
+    std::string mask;           //!< Against "nick!user@host"
+    std::string nick;
+    std::string user;
+    std::string host;
+    std::string account;        //!< Never matches users without an account
+
+    /*! Seconds since the member last joined or spoke, -1 for don't care.
+     * Members who did neither since we joined count as idle forever.
+     */
+    std::time_t idle_less_than = -1;
+    std::time_t idle_more_than = -1;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_MEMBER_QUERY_HH_INCLUDED
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LIBIRCCLIENT_MEMBER_TABLE_HH_INCLUDED
+#define LIBIRCCLIENT_MEMBER_TABLE_HH_INCLUDED
+
+#include "irc/macros.h"
+#include "irc/channel_user.hh"
+
+#include <cstddef>
+
+#include <iterator>
+#include <vector>
+
+namespace irc {
+
+class network_user;
+
+/*! \brief The members of a channel.
+ *
+ * An open addressing hash table (linear probing, backward shift deletion)
+ * storing channel_user entries inline, keyed by the network_user they belong
+ * to. A member costs the size of a channel_user divided by the load factor,
+ * without any per-member allocation.
+ *
+ * Inserting or erasing members invalidates references and iterators to all
+ * other members.
+ */
+class DLL_PUBLIC member_table {
+public:
+    template <typename Value, typename Slots>
+    class basic_iterator
+        : public std::iterator<std::forward_iterator_tag, Value> {
+    public:
+        basic_iterator(Slots* slots, std::size_t pos)
+            : _slots{slots}, _pos{pos}
+        {
+            skip();
+        }
+
+        Value& operator*()  const { return (*_slots)[_pos]; }
+        Value* operator->() const { return &(*_slots)[_pos]; }
+
+        basic_iterator& operator++()
+        {
+            ++_pos;
+            skip();
+
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            basic_iterator old{*this};
+            ++(*this);
+
+            return old;
+        }
+
+        //! Slot of the member, see member_table::from().
+        std::size_t position() const
+        {
+            return _pos;
+        }
+
+        friend bool operator==(basic_iterator const& a, basic_iterator const& b)
+        {
+            return a._pos == b._pos;
+        }
+
+        friend bool operator!=(basic_iterator const& a, basic_iterator const& b)
+        {
+            return a._pos != b._pos;
+        }
+
+    private:
+        void skip()
+        {
+            while ((_pos < _slots->size()) and not (*_slots)[_pos]._user) {
+                ++_pos;
+            }
+        }
+
+        Slots* _slots;
+        std::size_t _pos;
+    };
+
+    using iterator =
+        basic_iterator<channel_user, std::vector<channel_user>>;
+    using const_iterator =
+        basic_iterator<channel_user const, std::vector<channel_user> const>;
+
+    std::size_t size()     const;
+    std::size_t capacity() const;
+    bool        empty()    const;
+
+    iterator begin();
+    iterator end();
+
+    const_iterator begin() const;
+    const_iterator end()   const;
+
+    //! Iterates on from the member in slot `pos' (or the next one after it).
+    const_iterator from(std::size_t pos) const;
+
+    channel_user*       find(network_user const& user);
+    channel_user const* find(network_user const& user) const;
+
+    //! Adds the user unless already present, returns their entry either way.
+    channel_user& insert(network_user& user);
+
+    //! Removes the user, returns whether they were present.
+    bool erase(network_user const& user);
+
+    //! Makes room for `size' members without growing in between.
+    void reserve(std::size_t size);
+
+    void clear();
+
+private:
+    DLL_LOCAL std::size_t home(network_user const* user) const;
+    DLL_LOCAL std::size_t probe(network_user const* user) const;
+
+    DLL_LOCAL void rehash(std::size_t capacity);
+
+private:
+    // Size is 0 or a power of two, free slots have no user.
+    std::vector<channel_user> _slots;
+    std::size_t _size = 0;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_MEMBER_TABLE_HH_INCLUDED
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LIBIRCCLIENT_MODE_BATCHER_HH_INCLUDED
+#define LIBIRCCLIENT_MODE_BATCHER_HH_INCLUDED
+
+#include "irc/macros.h"
+#include "irc/irc_core.hh"
+#include "irc/irc_utils.hh"
+#include "irc/environment.hh"
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+namespace irc {
+
+/*! \brief Collects channel mode changes and sends them in bulk.
+ *
+ * Mode changes are queued per channel and only turned into MODE messages when
+ * flushed. Flushing drops changes that are superseded by a later change to the
+ * same mode (and argument, where it identifies a user or list entry), drops
+ * changes that would not change the channel's tracked state, and packs the
+ * rest into as few messages as the server's `MODES` limit and the maximum
+ * line length allow.
+ */
+class DLL_PUBLIC mode_batcher {
+public:
+    //! Maximum length of a message sent to the server (excluding CRLF).
+    static constexpr std::size_t max_line_length = 510;
+
+    /*!
+     * \param reserve Number of bytes per line to leave unused, e.g. for the
+     *                prefix the server prepends when relaying the message.
+     */
+    mode_batcher(std::size_t reserve = 0);
+
+    /*! \brief Queue a mode change.
+     *
+     * Throws protocol_error if the mode requires an argument that was not
+     * given. Arguments given to modes that take none are discarded.
+     */
+    void queue(
+        std::string const& channel,
+        bool setting,
+        char modefl,
+        std::string argument,
+        environment const& env);
+
+    //! Drop all pending changes.
+    void clear();
+
+    //! Drop all pending changes for the given channel.
+    void clear(std::string const& channel);
+
+    bool empty() const;
+    std::size_t pending(std::string const& channel) const;
+
+    //! Compile and drop all pending changes for all channels.
+    std::vector<message> flush(environment const& env);
+
+    //! Compile and drop all pending changes for a single channel.
+    std::vector<message> flush(
+        std::string const& channel,
+        environment const& env);
+
+private:
+    DLL_LOCAL void compile(
+        std::string const& channel,
+        environment::channel_mode_changes const& changes,
+        environment const& env,
+        std::vector<message>& out) const;
+
+private:
+    std::size_t _reserve;
+
+    unordered_rfc1459_map<
+        std::string,
+        environment::channel_mode_changes> _pending;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_MODE_BATCHER_HH_INCLUDED
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_NETSPLIT_HH_INCLUDED
+#define LIBIRCCLIENT_NETSPLIT_HH_INCLUDED
+
+#include "irc/macros.h"
+#include "irc/irc_utils.hh"
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <chrono>
+#include <utility>
+
+namespace irc {
+
+//! A user caught in a netsplit, with the channels they left or rejoined.
+struct DLL_PUBLIC netsplit_user {
+    std::string prefix;
+    std::vector<std::string> channels;
+};
+
+//! A whole split or join burst between two servers.
+struct DLL_PUBLIC netsplit_event {
+    enum class kind {
+        split,
+        join
+    };
+
+    kind type;
+
+    std::string server1;
+    std::string server2;
+
+    std::vector<netsplit_user> users;
+};
+
+/*! \brief Groups the QUITs and JOINs of netsplits into bursts.
+ *
+ * Servers announce a split by quitting every user behind it with the names of
+ * the two servers that lost each other as reason, and rejoin them all once the
+ * servers are linked again. The tracker collects those messages per pair of
+ * servers and hands out one event per burst once no more messages arrived for
+ * it for a while. Users stay known to the split they left in until they rejoin
+ * or until the split is given up on.
+ */
+class DLL_PUBLIC netsplit_tracker {
+public:
+    using clock = std::chrono::steady_clock;
+
+    /*!
+     * \param settle How long a burst has to be quiet before it is reported.
+     * \param expiry How long to wait for users to come back after a split.
+     */
+    netsplit_tracker(
+        clock::duration settle = std::chrono::seconds{2},
+        clock::duration expiry = std::chrono::minutes{30});
+
+    /*! \brief Whether a quit reason is that of a netsplit.
+     *
+     * Those are exactly two server names separated by a single space
+     * ("hub.example.net leaf.example.net", or "*.net *.split" on networks that
+     * hide their servers). Users can't fake them, servers prefix user supplied
+     * reasons with "Quit: " or similar.
+     */
+    static bool is_split_reason(std::string const& reason);
+
+    /*! \brief Note a netsplit QUIT.
+     *
+     * Returns false and ignores the quit if the reason is not that of a
+     * netsplit.
+     */
+    bool quit(
+        std::string const& prefix,
+        std::string const& reason,
+        std::vector<std::string> channels,
+        clock::time_point now = clock::now());
+
+    /*! \brief Note a JOIN.
+     *
+     * Returns true if the JOIN is part of a netjoin and was taken over by the
+     * tracker, false if it is a regular one.
+     */
+    bool join(
+        std::string const& prefix,
+        std::string const& channel,
+        clock::time_point now = clock::now());
+
+    //! Whether any burst is still waiting to be reported.
+    bool pending() const;
+
+    //! Takes all bursts that have settled, in the order they happened.
+    std::vector<netsplit_event> flush(clock::time_point now = clock::now());
+
+    //! Forget all splits, e.g. after disconnecting.
+    void clear();
+
+private:
+    struct split {
+        std::string server1;
+        std::string server2;
+
+        // Burst currently being collected, if any
+        netsplit_event::kind burst;
+        std::vector<netsplit_user> users;
+        clock::time_point last;
+
+        // Number of users who left and did not rejoin yet
+        std::size_t missing;
+    };
+
+    using split_iterator = std::list<split>::iterator;
+
+    DLL_LOCAL split_iterator find_split(
+        std::string const& server1,
+        std::string const& server2);
+
+    DLL_LOCAL void report(split& s, std::vector<netsplit_event>& out);
+
+private:
+    clock::duration _settle;
+    clock::duration _expiry;
+
+    // Stable, so users can refer to their split.
+    std::list<split> _splits;
+
+    // Users who left in a split, and users in a join burst that is still
+    // being collected with their position in it
+    unordered_rfc1459_map<std::string, split_iterator> _missing;
+    unordered_rfc1459_map<
+        std::string,
+        std::pair<split_iterator, std::size_t>> _rejoining;
+
+    // Bursts cut short by one of the other kind
+    std::vector<netsplit_event> _ready;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_NETSPLIT_HH_INCLUDED
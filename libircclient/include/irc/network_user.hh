@@ -0,0 +1,89 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LIBIRCCLIENT_NETWORK_USER_HH_INCLUDED
+#define LIBIRCCLIENT_NETWORK_USER_HH_INCLUDED
+
+#include "irc/macros.h"
+#include "irc/atom.hh"
+#include "irc/handle_table.hh"
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace irc {
+
+class channel;
+
+/*! \brief A user known to the network.
+ *
+ * Holds the identity of a user that shares at least one channel with the
+ * client. Each user exists only once per environment, no matter how many
+ * channels they are in; channels refer to it through their channel_user
+ * membership entries, and the user keeps a list of those channels in turn.
+ */
+class DLL_PUBLIC network_user {
+public:
+    network_user(
+        uint64_t uid,
+        std::string nick,
+        std::string user,
+        std::string host);
+
+    network_user(network_user const&)            = delete;
+    network_user& operator=(network_user const&) = delete;
+
+    uint64_t     uid() const;
+    std::string nick() const;
+    atom   nick_atom() const;
+    std::string user() const;
+    std::string host() const;
+
+    //! Services account the user is logged in to, empty if none or unknown.
+    std::string account() const;
+
+    //! Stays valid while the user is known, see environment::resolve().
+    irc::handle<network_user> handle() const;
+
+    //! All channels the user is in.
+    std::vector<channel*> const& channels() const;
+
+private:
+    friend class environment;
+    friend class channel;
+
+    uint64_t _uid;
+    irc::handle<network_user> _handle;
+
+    std::string _nick;
+    atom_ref _nick_atom;
+
+    std::string _user;
+    std::string _host;
+    std::string _account;
+
+    std::vector<channel*> _channels;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_NETWORK_USER_HH_INCLUDED
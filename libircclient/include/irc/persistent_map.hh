@@ -0,0 +1,334 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_PERSISTENT_MAP_HH_INCLUDED
+#define LIBIRCCLIENT_PERSISTENT_MAP_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace irc {
+
+/*! \brief An immutable hash map sharing structure between versions.
+ *
+ * A hash array mapped trie: every node branches on 5 bits of the key's hash
+ * and only stores the branches in use. insert() and erase() leave the map
+ * alone and return a new version, which copies the nodes on the path to the
+ * changed key (at most a few dozen pointers) and shares everything else with
+ * the original. Copying a map only copies its root pointer.
+ *
+ * Nodes are only ever changed in place while a single version refers to
+ * them, see set().
+ *
+ * Values are held by shared pointers to const, so they can be shared between
+ * versions (and between maps) as well. Since nothing is ever modified in
+ * place, any number of threads may read a map while new versions of it are
+ * being built.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class persistent_map {
+public:
+    using value_ptr = std::shared_ptr<V const>;
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    //! Returns the value for the key, nullptr if there is none.
+    value_ptr find(K const& key) const
+    {
+        std::size_t hash = Hash{}(key);
+        node const* n = _root.get();
+
+        for (unsigned depth = 0; n; ++depth) {
+            if (depth == max_depth) {
+                for (slot const& s : n->slots) {
+                    if (s.key == key) {
+                        return s.value;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            uint32_t bit = branch_bit(hash, depth);
+
+            if (not (n->bitmap & bit)) {
+                return nullptr;
+            }
+
+            slot const& s = n->slots[slot_index(n->bitmap, bit)];
+
+            if (not s.child) {
+                return (s.key == key) ? s.value : nullptr;
+            }
+
+            n = s.child.get();
+        }
+
+        return nullptr;
+    }
+
+    //! Returns a version with the key set to the value.
+    persistent_map insert(K const& key, value_ptr value) const
+    {
+        persistent_map res{*this};
+        res.set(key, std::move(value));
+
+        return res;
+    }
+
+    //! Returns a version without the key.
+    persistent_map erase(K const& key) const
+    {
+        persistent_map res{*this};
+        res.remove(key);
+
+        return res;
+    }
+
+    /*! \brief Set the key to the value in this version.
+     *
+     * Other versions are not affected: shared nodes are copied as with
+     * insert(), but nodes only this version refers to (those copied by an
+     * earlier change to it) are changed in place. Building a version with
+     * many changes is much cheaper this way.
+     */
+    void set(K const& key, value_ptr value)
+    {
+        bool added = false;
+
+        insert(_root, 0, Hash{}(key), key, std::move(value), added);
+
+        if (added) {
+            ++_size;
+        }
+    }
+
+    //! Remove the key from this version, see set().
+    void remove(K const& key)
+    {
+        if (find(key)) {
+            erase(_root, 0, Hash{}(key), key);
+            --_size;
+        }
+    }
+
+    //! Calls f(key, value) for every entry, in no particular order.
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        if (_root) {
+            visit(*_root, f);
+        }
+    }
+
+private:
+    struct node;
+
+    // Either a branch to a child node, or an entry.
+    struct slot {
+        std::shared_ptr<node const> child;
+
+        K key;
+        value_ptr value;
+    };
+
+    // Below max_depth, slots are ordered by their bit in the bitmap. At
+    // max_depth the hash is used up and slots are a plain list of entries
+    // whose hashes collide.
+    struct node {
+        uint32_t bitmap = 0;
+        std::vector<slot> slots;
+    };
+
+    static constexpr unsigned bits = 5;
+    static constexpr unsigned max_depth =
+        (std::numeric_limits<std::size_t>::digits + bits - 1) / bits;
+
+    static uint32_t branch_bit(std::size_t hash, unsigned depth)
+    {
+        return uint32_t{1} << ((hash >> (depth * bits)) & ((1u << bits) - 1));
+    }
+
+    static std::size_t slot_index(uint32_t bitmap, uint32_t bit)
+    {
+        return static_cast<std::size_t>(__builtin_popcount(bitmap & (bit - 1)));
+    }
+
+    // Returns the node for changing, copying it unless only the caller's
+    // pointer refers to it.
+    static node& edit(std::shared_ptr<node const>& n)
+    {
+        if (not n) {
+            n = std::make_shared<node>();
+        } else if (n.use_count() != 1) {
+            n = std::make_shared<node>(*n);
+        }
+
+        // Fine, since every node is created non-const.
+        return const_cast<node&>(*n);
+    }
+
+    static void insert(
+        std::shared_ptr<node const>& n,
+        unsigned depth,
+        std::size_t hash,
+        K const& key,
+        value_ptr value,
+        bool& added)
+    {
+        node& e = edit(n);
+
+        if (depth == max_depth) {
+            for (slot& s : e.slots) {
+                if (s.key == key) {
+                    s.value = std::move(value);
+                    return;
+                }
+            }
+
+            e.slots.push_back(slot{nullptr, key, std::move(value)});
+            added = true;
+
+            return;
+        }
+
+        uint32_t bit = branch_bit(hash, depth);
+        std::size_t idx = slot_index(e.bitmap, bit);
+
+        if (not (e.bitmap & bit)) {
+            e.bitmap |= bit;
+            e.slots.insert(
+                std::begin(e.slots) + idx,
+                slot{nullptr, key, std::move(value)});
+
+            added = true;
+
+            return;
+        }
+
+        slot& s = e.slots[idx];
+
+        if (s.child) {
+            insert(s.child, depth + 1, hash, key, std::move(value), added);
+        } else if (s.key == key) {
+            s.value = std::move(value);
+        } else {
+            // Push the entry already here one level down, next to the new one.
+            std::shared_ptr<node const> child;
+            bool dummy = false;
+
+            insert(child, depth + 1, Hash{}(s.key), s.key, s.value, dummy);
+            insert(child, depth + 1, hash, key, std::move(value), added);
+
+            s.child = std::move(child);
+            s.key   = K{};
+            s.value = nullptr;
+        }
+    }
+
+    // The key must be in there.
+    static void erase(
+        std::shared_ptr<node const>& n,
+        unsigned depth,
+        std::size_t hash,
+        K const& key)
+    {
+        if (depth == max_depth) {
+            if (n->slots.size() == 1) {
+                n = nullptr;
+                return;
+            }
+
+            node& e = edit(n);
+
+            e.slots.erase(std::find_if(std::begin(e.slots), std::end(e.slots),
+                [&key] (slot const& s) {
+                    return s.key == key;
+                }));
+
+            return;
+        }
+
+        node& e = edit(n);
+
+        uint32_t bit = branch_bit(hash, depth);
+        std::size_t idx = slot_index(e.bitmap, bit);
+        slot& s = e.slots[idx];
+
+        if (s.child) {
+            erase(s.child, depth + 1, hash, key);
+
+            if (s.child) {
+                if ((s.child->slots.size() == 1)
+                        and not s.child->slots[0].child) {
+                    // Pull a lone entry back up, so lookups don't descend
+                    // for it.
+                    slot lone = s.child->slots[0];
+                    s = std::move(lone);
+                }
+
+                return;
+            }
+        }
+
+        e.bitmap &= ~bit;
+        e.slots.erase(std::begin(e.slots) + idx);
+
+        if (e.slots.empty()) {
+            n = nullptr;
+        }
+    }
+
+    template <typename F>
+    static void visit(node const& n, F& f)
+    {
+        for (slot const& s : n.slots) {
+            if (s.child) {
+                visit(*s.child, f);
+            } else {
+                f(s.key, s.value);
+            }
+        }
+    }
+
+private:
+    std::shared_ptr<node const> _root;
+    std::size_t _size = 0;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_PERSISTENT_MAP_HH_INCLUDED
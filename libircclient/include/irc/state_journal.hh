@@ -0,0 +1,134 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBIRCCLIENT_STATE_JOURNAL_HH_INCLUDED
+#define LIBIRCCLIENT_STATE_JOURNAL_HH_INCLUDED
+
+#include "irc/macros.h"
+#include "irc/atom.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+
+namespace irc {
+
+//! A single change to the tracked state of channels and users.
+struct DLL_PUBLIC state_delta {
+    enum class kind : uint8_t {
+        reset,              //!< Fresh session, drop everything
+        channel_created,    //!< channel
+        channel_removed,    //!< channel (members go with it)
+        user_joined,        //!< channel, uid, arg = "nick!user@host"
+        user_parted,        //!< channel, uid
+        user_quit,          //!< uid (leaves all channels)
+        user_renamed,       //!< uid, arg = new nick
+        user_host_changed,  //!< uid, arg = "user@host"
+        user_account,       //!< uid, arg = account ("" if logged out)
+        prefix_set,         //!< channel, uid, mode
+        prefix_unset,       //!< channel, uid, mode
+        mode_set,           //!< channel, mode, arg
+        mode_unset,         //!< channel, mode, arg
+        topic_changed       //!< channel, arg = topic
+    };
+
+    uint64_t seq;
+    kind     type;
+    atom_ref channel;
+    uint64_t uid;
+    char     mode;
+
+    std::string arg;
+};
+
+/*! \brief Ring buffer of the most recent state changes.
+ *
+ * Every delta gets the next sequence number, starting from 1. Only the last
+ * `capacity` deltas are kept around, consumers that fall further behind than
+ * that have to start over from the state itself (or a snapshot of it).
+ *
+ * Consumers either poll with read(), or subscribe to have deltas handed to
+ * them as they are appended.
+ */
+class DLL_PUBLIC state_journal {
+public:
+    using listener = std::function<void (state_delta const&)>;
+
+    state_journal(std::size_t capacity = 8192);
+
+    std::size_t capacity() const;
+
+    //! Sequence number of the oldest delta still kept.
+    uint64_t first_seq() const;
+
+    //! Sequence number the next delta will get.
+    uint64_t next_seq() const;
+
+    uint64_t append(
+        state_delta::kind type,
+        atom channel,
+        uint64_t uid,
+        char mode = '\0',
+        std::string arg = "");
+
+    /*! \brief Copy all deltas starting from sequence number `from`.
+     *
+     * Returns false (copying nothing) if some of them were overwritten
+     * already.
+     */
+    bool read(uint64_t from, std::vector<state_delta>& out) const;
+
+    /*! \brief Hand the deltas starting from `from` to `fn`.
+     *
+     * Kept deltas are replayed right away, later ones are passed on as they
+     * are appended. Throws std::out_of_range if some of them were overwritten
+     * already. Returns an id for unsubscribe().
+     */
+    std::size_t subscribe(uint64_t from, listener fn);
+    void unsubscribe(std::size_t id);
+
+    /*! \brief Append a delta in the journal's wire format to `out`.
+     *
+     * Integers are written as unsigned LEB128 varints, strings as their
+     * varint length followed by their bytes:
+     *
+     *     seq, type (1 byte), channel (case-folded name), uid, mode (1 byte),
+     *     arg
+     */
+    static void encode(state_delta const& delta, std::string& out);
+
+private:
+    std::size_t _capacity;
+
+    std::vector<state_delta> _ring;
+    uint64_t _next_seq = 1;
+
+    std::vector<std::pair<std::size_t, listener>> _listeners;
+    std::size_t _next_listener = 1;
+};
+
+}
+
+#endif // defined LIBIRCCLIENT_STATE_JOURNAL_HH_INCLUDED
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc/atom.hh"
+
+#include "irc/irc_utils.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <utility>
+
+namespace irc {
+
+atom_table::atom_table()
+    : _index(64, 0)
+{
+}
+
+
+atom_table& atom_table::global()
+{
+    static atom_table table;
+
+    return table;
+}
+
+
+atom atom_table::acquire(std::string const& name)
+{
+    std::size_t h = fold_hash(name.data(), name.size());
+    std::size_t slot = probe(name.data(), name.size(), h);
+
+    if (_index[slot] != 0) {
+        atom a{_index[slot]};
+        ++get(a).refs;
+
+        return a;
+    }
+
+    if (_last_id == UINT32_MAX) {
+        throw std::length_error{"atom ids exhausted"};
+    }
+
+    atom a{++_last_id};
+
+    _entries.emplace(a.id(), entry{rfc1459_lower(name), h, 1});
+    _index[slot] = a.id();
+
+    if ((_entries.size() * 2) > _index.size()) {
+        rehash(_index.size() * 2);
+    }
+
+    return a;
+}
+
+void atom_table::retain(atom a)
+{
+    ++get(a).refs;
+}
+
+void atom_table::release(atom a)
+{
+    entry& e = get(a);
+
+    if (--e.refs > 0) {
+        return;
+    }
+
+    erase_slot(probe(e.folded.data(), e.folded.size(), e.hash));
+    _entries.erase(a.id());
+
+    if ((_index.size() > 64) and ((_entries.size() * 8) < _index.size())) {
+        rehash(_index.size() / 2);
+    }
+}
+
+
+atom atom_table::find(std::string const& name) const
+{
+    return find(name.data(), name.size());
+}
+
+atom atom_table::find(char const* name, std::size_t length) const
+{
+    return atom{_index[probe(name, length, fold_hash(name, length))]};
+}
+
+bool atom_table::valid(atom a) const
+{
+    return _entries.find(a.id()) != std::end(_entries);
+}
+
+
+std::string const& atom_table::folded(atom a) const
+{
+    return get(a).folded;
+}
+
+std::size_t atom_table::hash(atom a) const
+{
+    return get(a).hash;
+}
+
+std::size_t atom_table::size() const
+{
+    return _entries.size();
+}
+
+
+std::size_t atom_table::fold_hash(char const* name, std::size_t length)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+
+    for (std::size_t i = 0; i < length; ++i) {
+        h ^= static_cast<unsigned char>(rfc1459_lower(name[i]));
+        h *= 1099511628211ull;
+    }
+
+    return static_cast<std::size_t>(h);
+}
+
+
+atom_table::entry& atom_table::get(atom a)
+{
+    return const_cast<entry&>(static_cast<atom_table const&>(*this).get(a));
+}
+
+atom_table::entry const& atom_table::get(atom a) const
+{
+    auto iter = _entries.find(a.id());
+
+    if (iter == std::end(_entries)) {
+        throw std::out_of_range{"invalid atom " + std::to_string(a.id())};
+    }
+
+    return iter->second;
+}
+
+std::size_t atom_table::probe(
+    char const* name,
+    std::size_t length,
+    std::size_t hash) const
+{
+    std::size_t mask = _index.size() - 1;
+
+    for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        if (_index[slot] == 0) {
+            return slot;
+        }
+
+        entry const& e = get(atom{_index[slot]});
+
+        if ((e.hash != hash) or (e.folded.size() != length)) {
+            continue;
+        }
+
+        bool same = true;
+
+        for (std::size_t i = 0; same and (i < length); ++i) {
+            same = (e.folded[i] == rfc1459_lower(name[i]));
+        }
+
+        if (same) {
+            return slot;
+        }
+    }
+}
+
+// Backward shift deletion: later entries of the same probe sequence move
+// into the hole, so lookups never have to skip over deleted slots.
+void atom_table::erase_slot(std::size_t slot)
+{
+    std::size_t mask = _index.size() - 1;
+    std::size_t hole = slot;
+
+    for (std::size_t i = (slot + 1) & mask; _index[i] != 0;
+            i = (i + 1) & mask) {
+        std::size_t home = get(atom{_index[i]}).hash & mask;
+
+        // Only if the hole lies between where it belongs and where it is
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            _index[hole] = _index[i];
+            hole = i;
+        }
+    }
+
+    _index[hole] = 0;
+}
+
+void atom_table::rehash(std::size_t slots)
+{
+    std::vector<uint32_t> index(slots, 0);
+    std::size_t mask = index.size() - 1;
+
+    for (uint32_t id : _index) {
+        if (id == 0) {
+            continue;
+        }
+
+        std::size_t slot = get(atom{id}).hash & mask;
+
+        while (index[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+
+        index[slot] = id;
+    }
+
+    _index = std::move(index);
+}
+
+
+atom_ref::atom_ref(std::string const& name)
+    : _atom{atom_table::global().acquire(name)}
+{
+}
+
+atom_ref::atom_ref(atom a)
+    : _atom{a}
+{
+    if (_atom) {
+        atom_table::global().retain(_atom);
+    }
+}
+
+atom_ref::atom_ref(atom_ref const& other)
+    : atom_ref{other._atom}
+{
+}
+
+atom_ref::atom_ref(atom_ref&& other) noexcept
+    : _atom{other._atom}
+{
+    other._atom = atom{};
+}
+
+atom_ref& atom_ref::operator=(atom_ref other) noexcept
+{
+    std::swap(_atom, other._atom);
+
+    return *this;
+}
+
+atom_ref::~atom_ref()
+{
+    if (_atom) {
+        atom_table::global().release(_atom);
+    }
+}
+
+}
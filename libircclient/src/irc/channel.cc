@@ -19,11 +19,20 @@
 
 #include "irc/channel.hh"
 
+#include "irc/atom.hh"
 #include "irc/channel_user.hh"
+#include "irc/member_table.hh"
+#include "irc/list_mode.hh"
+#include "irc/mask_matcher.hh"
+#include "irc/state_journal.hh"
+#include "irc/network_user.hh"
 
 #include "irc/irc_except.hh"
 #include "irc/environment.hh"
 
+#include <ctime>
+#include <atomic>
+
 #include <tuple>
 #include <vector>
 #include <algorithm>
@@ -34,30 +43,28 @@
 
 namespace irc {
 
-channel::channel(std::string name)
-    : _name{std::move(name)}
+namespace {
+
+// Shared by every channel of every environment, so a generation never
+// repeats even when a channel is parted and joined again.
+uint64_t next_generation()
 {
+    static std::atomic<uint64_t> generation{0};
+
+    return ++generation;
 }
 
-channel::channel(channel const& c)
-    : _modes{c._modes},
-      _name{c._name},
-      _created{c._created},
-      _topic{c._topic},
-      _next_uid{c._next_uid}
-{
-    for (auto& cu : c._users) {
-        _users[cu.first] = std::make_unique<channel_user>(*(cu.second));
-        _users[cu.first]->_channel = this;
-    }
 }
 
-channel& channel::operator=(channel const& c)
-{
-    channel cpy{*this};
 
-    std::swap(*this, cpy);
-    return *this;
+channel::channel(environment& env, std::string name)
+    : _env{&env},
+      _name{std::move(name)},
+      _name_atom{_name},
+      _member_gen{next_generation()},
+      _mode_gen{next_generation()},
+      _topic_gen{next_generation()}
+{
 }
 
 
@@ -66,6 +73,16 @@ std::string channel::name() const
     return _name;
 }
 
+atom channel::name_atom() const
+{
+    return _name_atom;
+}
+
+handle<channel> channel::handle() const
+{
+    return _handle;
+}
+
 std::time_t channel::created() const
 {
     return _created;
@@ -81,31 +98,89 @@ channel::user_list const& channel::users() const
     return _users;
 }
 
+uint64_t channel::member_generation() const
+{
+    return _member_gen;
+}
+
+uint64_t channel::mode_generation() const
+{
+    return _mode_gen;
+}
+
+uint64_t channel::topic_generation() const
+{
+    return _topic_gen;
+}
+
 channel::mode_list const& channel::modes() const
 {
     return _modes;
 }
 
+channel::list_modes const& channel::lists() const
+{
+    return _lists;
+}
+
 
 bool channel::has_user(const std::string& user) const
 {
-    return _users.find(user) != std::end(_users);
+    return lookup_user(user) != nullptr;
 }
 
 
 channel_user& channel::find_user(std::string const& user) const
 {
-    if (_users.find(user) == std::end(_users)) {
+    channel_user* cu = lookup_user(user);
+
+    if (not cu) {
         throw protocol_error{protocol_error_type::no_such_user, user};
     }
 
-    return *_users.find(user)->second;
+    return *cu;
+}
+
+channel_user& channel::find_user(uint64_t uid) const
+{
+    channel_user* cu = lookup_user(uid);
+
+    if (not cu) {
+        throw protocol_error{
+            protocol_error_type::no_such_user, std::to_string(uid)};
+    }
+
+    return *cu;
+}
+
+channel_user* channel::lookup_user(std::string const& user) const
+{
+    network_user const* u = _env->lookup_user(user);
+
+    return u ? const_cast<channel_user*>(_users.find(*u)) : nullptr;
+}
+
+channel_user* channel::lookup_user(uint64_t uid) const
+{
+    network_user const* u = _env->lookup_user(uid);
+
+    return u ? const_cast<channel_user*>(_users.find(*u)) : nullptr;
 }
 
 std::vector<std::string> channel::get_mode(char modefl) const
 {
     std::vector<std::string> res;
 
+    if (list_mode const* list = find_list(modefl)) {
+        res.reserve(list->size());
+
+        for (list_entry const& e : *list) {
+            res.push_back(e.mask);
+        }
+
+        return res;
+    }
+
     res.reserve(_modes.count(modefl));
 
     auto iters = _modes.equal_range(modefl);
@@ -127,113 +202,322 @@ std::string channel::get_mode_simple(char modefl) const
     return _modes.find(modefl)->second;
 }
 
+list_mode const* channel::find_list(char modefl) const
+{
+    auto iter = _lists.find(modefl);
+
+    return (iter != std::end(_lists)) ? &iter->second : nullptr;
+}
+
 bool channel::is_mode_set(char modefl) const
 {
-    return _modes.count(modefl) > 0;
+    return (_modes.count(modefl) > 0) or find_list(modefl);
+}
+
+
+mask_matcher const& channel::list_matcher(char modefl) const
+{
+    auto iter = _matchers.find(modefl);
+
+    if (iter != std::end(_matchers)) {
+        return iter->second;
+    }
+
+    list_mode const* list = find_list(modefl);
+
+    return _matchers.emplace(
+        modefl, list ? mask_matcher{*list} : mask_matcher{}).first->second;
+}
+
+std::vector<list_entry const*> channel::matching_entries(
+    char modefl,
+    network_user const& user) const
+{
+    std::vector<list_entry const*> res;
+    list_mode const* list = find_list(modefl);
+
+    if (not list) {
+        return res;
+    }
+
+    for (std::size_t i : list_matcher(modefl).match(
+            user.nick(), user.user(), user.host())) {
+        res.push_back(&(*list)[i]);
+    }
+
+    return res;
+}
+
+std::vector<channel_user const*> channel::matching_users(
+    std::string const& mask) const
+{
+    std::vector<channel_user const*> res;
+
+    mask_matcher matcher;
+    matcher.add(mask);
+
+    for (channel_user const& cu : _users) {
+        network_user const& u = cu.network_user();
+
+        if (matcher.matches(0, u.nick(), u.user(), u.host())) {
+            res.push_back(&cu);
+        }
+    }
+
+    return res;
+}
+
+std::size_t channel::query(
+    member_query const& q,
+    std::vector<channel_user const*>& out,
+    std::size_t limit,
+    std::size_t cursor) const
+{
+    channel_user::prefix_set required = 0;
+
+    for (char m : q.modes) {
+        int rank = _env->prefix_rank(m);
+
+        // Nobody can hold a mode that isn't a prefix mode.
+        if (rank < 0) {
+            return 0;
+        }
+
+        required |= channel_user::prefix_set{1} << rank;
+    }
+
+    int at_least = q.at_least ? _env->prefix_rank(q.at_least) : -1;
+
+    if (q.at_least and (at_least < 0)) {
+        return 0;
+    }
+
+    // Globs by the part of the user they apply to, folded once up front so
+    // matching members doesn't have to copy anything.
+    using field = std::string network_user::*;
+    std::vector<std::pair<field, std::string>> globs;
+
+    auto add_glob = [&globs] (field f, std::string const& glob) {
+        if (not glob.empty() and (glob != "*")) {
+            globs.emplace_back(f, rfc1459_lower(glob));
+        }
+    };
+
+    if (not q.mask.empty()) {
+        std::size_t bang = q.mask.find('!');
+        std::size_t at   = q.mask.find('@');
+
+        add_glob(&network_user::_nick, q.mask.substr(0, std::min(bang, at)));
+
+        if (bang != std::string::npos) {
+            add_glob(&network_user::_user, q.mask.substr(bang + 1,
+                (at != std::string::npos) ? at - bang - 1 : std::string::npos));
+        }
+
+        if (at != std::string::npos) {
+            add_glob(&network_user::_host, q.mask.substr(at + 1));
+        }
+    }
+
+    add_glob(&network_user::_nick,    q.nick);
+    add_glob(&network_user::_user,    q.user);
+    add_glob(&network_user::_host,    q.host);
+    add_glob(&network_user::_account, q.account);
+
+    std::time_t now = std::time(nullptr);
+    std::size_t found = 0;
+
+    for (auto iter = _users.from(cursor); iter != std::end(_users); ++iter) {
+        channel_user const& cu = *iter;
+        network_user const& u  = cu.network_user();
+
+        if ((cu.prefixes() & required) != required) {
+            continue;
+        }
+
+        if ((at_least >= 0)
+                and ((cu.highest_prefix() < 0)
+                  or (cu.highest_prefix() > at_least))) {
+            continue;
+        }
+
+        if (not q.account.empty() and u._account.empty()) {
+            continue;
+        }
+
+        // Members we never saw active are idle since forever.
+        std::time_t last = cu.last_active();
+        std::time_t idle = now - last;
+
+        if ((q.idle_less_than >= 0)
+                and ((last == 0) or (idle >= q.idle_less_than))) {
+            continue;
+        }
+
+        if ((q.idle_more_than >= 0)
+                and (last != 0) and (idle <= q.idle_more_than)) {
+            continue;
+        }
+
+        bool matches = std::all_of(std::begin(globs), std::end(globs),
+            [&u] (std::pair<field, std::string> const& g) {
+                return mask_matcher::folded_glob_match(g.second, u.*g.first);
+            });
+
+        if (not matches) {
+            continue;
+        }
+
+        out.push_back(&cu);
+
+        if (++found == limit) {
+            return iter.position() + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+std::string channel::user_modes(channel_user const& user) const
+{
+    std::string modes = _env->prefix_modes();
+    std::string res;
+
+    for (std::size_t i = 0; i < modes.size(); ++i) {
+        if (user.has_prefix(i)) {
+            res += modes[i];
+        }
+    }
+
+    return res;
+}
+
+bool channel::user_has_mode(channel_user const& user, char modefl) const
+{
+    int rank = _env->prefix_rank(modefl);
+
+    return (rank >= 0) and user.has_prefix(rank);
+}
+
+char channel::user_prefix(channel_user const& user) const
+{
+    int rank = user.highest_prefix();
+
+    return (rank >= 0) ? _env->prefix_symbol(rank) : '\0';
 }
 
 
 void channel::set_topic(std::string topic)
 {
     std::get<0>(_topic) = std::move(topic);
+    topic_changed();
+    _env->touch_channel(_name_atom);
+    _env->record(state_delta::kind::topic_changed, _name_atom, 0, '\0',
+        std::get<0>(_topic));
 }
 
 void channel::set_topic_meta(std::string setter, std::time_t settime)
 {
     std::get<1>(_topic) = std::move(setter);
     std::get<2>(_topic) = settime;
+    topic_changed();
+    _env->touch_channel(_name_atom);
 }
 
 
 void channel::set_created(std::time_t created)
 {
     _created = created;
+    _env->touch_channel(_name_atom);
 }
 
 
 void channel::apply_modes(
     std::string const& modes,
     std::vector<std::string> const& args,
-    environment const& env)
+    environment const& env,
+    std::string const& setter)
 {
     auto mode_changes = env.partition_mode_changes(modes, args);
 
+    _env->touch_channel(_name_atom);
+
     for (auto& m : mode_changes) {
         if (std::get<0>(m)) {
-            set_mode(std::get<1>(m), std::get<2>(m), env);
+            set_mode(std::get<1>(m), std::get<2>(m), env, setter);
         } else {
             unset_mode(std::get<1>(m), std::get<2>(m), env);
         }
     }
 }
 
-channel_user& channel::create_user(std::string prefix)
+channel_user& channel::add_user(network_user& user)
 {
-    std::string nick;
-    std::string user;
-    std::string host;
+    std::size_t before = _users.size();
+    channel_user& cu = _users.insert(user);
 
-    std::tie(nick, user, host) = split_prefix(prefix);
+    if (_users.size() != before) {
+        members_changed();
+        member_changed(cu.uid());
+    }
 
-    return create_user(std::move(nick), std::move(user), std::move(host));
+    return cu;
 }
 
-channel_user& channel::create_user(
-    std::string nick,
-    std::string user,
-    std::string host)
+void channel::remove_user(network_user& user)
 {
-    _users[nick] =
-        std::make_unique<channel_user>(
-            *this, _next_uid++, nick, std::move(user), std::move(host));
+    if (not _users.erase(user))  {
+        throw protocol_error{protocol_error_type::no_such_user, user.nick()};
+    }
 
-    return *_users[nick];
+    members_changed();
+    member_changed(user.uid());
 }
 
 
-void channel::rename_user(
-    std::string const& old_nick,
-    std::string const& new_nick)
+void channel::add_list_entry(
+    char modefl,
+    std::string mask,
+    std::string setter,
+    std::time_t set_time)
 {
-    user_list::iterator usr;
+    list_mode& list = _lists[modefl];
 
-    if ((usr = _users.find(old_nick)) == std::end(_users)) {
-        throw protocol_error{protocol_error_type::no_such_user, old_nick};
-    }
-
-    std::unique_ptr<channel_user> u = std::move(usr->second);
-    u->rename(new_nick);
+    // Also when already listed, setter and time may have been filled in.
+    entry_changed(modefl, mask);
 
-    _users.erase(old_nick);
-    _users[new_nick] = std::move(u);
-}
+    if (list.insert(mask, std::move(setter), set_time)) {
+        matcher_added(modefl, list);
+        modes_changed();
 
-
-void channel::remove_user(channel_user& user)
-{
-    if (_users.find(user.nick()) == std::end(_users))  {
-        throw protocol_error{protocol_error_type::no_such_user, user.nick()};
+        _env->record(state_delta::kind::mode_set, _name_atom, 0, modefl,
+            std::move(mask));
     }
 
-    _users.erase(user.nick());
+    _env->touch_channel(_name_atom);
 }
 
 
 void channel::set_mode(
     char modefl,
     std::string const& argument,
-    environment const& env)
+    environment const& env,
+    std::string const& setter)
 {
     switch (env.get_mode_argument_type(modefl)) {
     case channel_mode_argument_type::required_user_list:
-        set_list_mode(modefl, argument);
+        set_list_mode(modefl, argument, setter);
         break;
 
     case channel_mode_argument_type::required_user: {
         channel_user& u = find_user(argument);
-        u.set_mode(modefl);
+        u.set_prefix(env.prefix_rank(modefl));
+        members_changed();
+        member_changed(u.uid());
 
-        break;
+        _env->record(state_delta::kind::prefix_set, _name_atom, u.uid(), modefl);
+        return;
     }
 
     case channel_mode_argument_type::required:
@@ -243,8 +527,13 @@ void channel::set_mode(
 
     default:
         set_simple_mode(modefl, "");;
-        break;
+        modes_changed();
+        _env->record(state_delta::kind::mode_set, _name_atom, 0, modefl);
+        return;
     }
+
+    modes_changed();
+    _env->record(state_delta::kind::mode_set, _name_atom, 0, modefl, argument);
 }
 
 void channel::unset_mode(
@@ -259,31 +548,37 @@ void channel::unset_mode(
 
     case channel_mode_argument_type::required_user: {
         channel_user& u = find_user(argument);
-        u.unset_mode(modefl);
+        u.unset_prefix(env.prefix_rank(modefl));
+        members_changed();
+        member_changed(u.uid());
 
-        break;
+        _env->record(
+            state_delta::kind::prefix_unset, _name_atom, u.uid(), modefl);
+        return;
     }
 
     default:
         unset_simple_mode(modefl);
         break;
     }
+
+    modes_changed();
+    _env->record(state_delta::kind::mode_unset, _name_atom, 0, modefl, argument);
 }
 
 
-void channel::set_list_mode(char modefl, std::string const& argument)
+void channel::set_list_mode(
+    char modefl,
+    std::string const& argument,
+    std::string const& setter)
 {
-    // Try not to set "+<mode> <arg>" if arg is already set for that mode
-    auto iters = _modes.equal_range(modefl);
+    list_mode& list = _lists[modefl];
 
-    for (auto it = iters.first; it != iters.second; ++it) {
-        if (rfc1459_equal(it->second, argument)) {
-            // duplicate found, abort mission
-            return;
-        }
-    }
+    entry_changed(modefl, argument);
 
-    _modes.insert(mode_list::value_type{modefl, argument});
+    if (list.insert(argument, setter, setter.empty() ? 0 : std::time(nullptr))) {
+        matcher_added(modefl, list);
+    }
 }
 
 void channel::set_simple_mode(char modefl, std::string const& argument)
@@ -295,12 +590,18 @@ void channel::set_simple_mode(char modefl, std::string const& argument)
 
 void channel::unset_list_mode(char modefl, std::string const& argument)
 {
-    auto iters = _modes.equal_range(modefl);
+    auto iter = _lists.find(modefl);
+
+    if (iter != std::end(_lists)) {
+        if (iter->second.erase(argument)) {
+            entry_changed(modefl, argument);
 
-    for (auto it = iters.first; it != iters.second; ++it) {
-        if (rfc1459_equal(it->second, argument)) {
-            _modes.erase(it);
-            return;
+            // Entries move around on removal, recompile on next use.
+            _matchers.erase(modefl);
+        }
+
+        if (iter->second.empty()) {
+            _lists.erase(iter);
         }
     }
 }
@@ -310,4 +611,57 @@ void channel::unset_simple_mode(char modefl)
     _modes.erase(modefl);
 }
 
+
+void channel::matcher_added(char modefl, list_mode const& list)
+{
+    auto iter = _matchers.find(modefl);
+
+    // New entries go to the end of the list, so a compiled matcher can just
+    // keep up instead of being recompiled.
+    if (iter != std::end(_matchers)) {
+        iter->second.add(list[list.size() - 1].mask);
+    }
+}
+
+
+void channel::members_changed()
+{
+    _member_gen = next_generation();
+}
+
+void channel::modes_changed()
+{
+    _mode_gen = next_generation();
+}
+
+void channel::topic_changed()
+{
+    _topic_gen = next_generation();
+}
+
+
+void channel::member_changed(uint64_t uid)
+{
+    if (_publish_all) {
+        return;
+    }
+
+    // Past the point where patching the last snapshot beats rebuilding it.
+    if (_changed_members.size() > _users.size()) {
+        _publish_all = true;
+        _changed_members.clear();
+        _changed_entries.clear();
+        return;
+    }
+
+    _changed_members.push_back(uid);
+}
+
+void channel::entry_changed(char modefl, std::string const& mask)
+{
+    if (not _publish_all) {
+        _changed_entries.emplace_back(modefl, mask);
+    }
+}
+
 }
@@ -19,94 +19,92 @@
 
 #include "irc/channel_user.hh"
 
-#include "irc/irc_utils.hh"
+#include "irc/network_user.hh"
 
 #include <cstdint>
 
 #include <string>
-#include <tuple>
 
 namespace irc {
 
-channel_user::channel_user(
-    class channel& channel,
-    uint64_t uid,
-    std::string prefix)
-        : _channel{&channel},
-          _uid{uid}
-{
-    std::tie(_nick, _user, _host) = split_prefix(prefix);
-}
+// Members are stored inline in member_table, their size is what a member
+// costs
+static_assert(
+    sizeof(channel_user) <= sizeof(void*) + 2 * sizeof(uint32_t),
+    "channel_user grew");
 
-channel_user::channel_user(
-    class channel& channel,
-    uint64_t uid,
-    std::string nick,
-    std::string user,
-    std::string host)
-        : _channel{&channel},
-          _uid{uid},
-          _nick{std::move(nick)},
-          _user{std::move(user)},
-          _host{std::move(host)}
+channel_user::channel_user(class network_user& user)
+    : _user{&user}
 {
 }
 
 
-channel& channel_user::channel() const
+network_user& channel_user::network_user() const
 {
-    return *_channel;
+    return *_user;
 }
 
 
 uint64_t channel_user::uid() const
 {
-    return _uid;
+    return _user->uid();
 }
 
 std::string channel_user::nick() const
 {
-    return _nick;
+    return _user->nick();
 }
 
 std::string channel_user::user() const
 {
-    return _user;
+    return _user->user();
 }
 
 std::string channel_user::host() const
 {
-    return _host;
+    return _user->host();
 }
 
-std::string channel_user::modes() const
+
+channel_user::prefix_set channel_user::prefixes() const
 {
-    return _modes;
+    return _prefixes;
 }
 
-bool channel_user::has_mode(char modefl) const
+bool channel_user::has_prefix(unsigned rank) const
 {
-    return _modes.find(modefl) != std::string::npos;
+    return (rank < max_prefixes) and (_prefixes & (prefix_set{1} << rank));
 }
 
-
-void channel_user::rename(std::string new_nick)
+int channel_user::highest_prefix() const
 {
-    _nick = std::move(new_nick);
+    return _prefixes ? __builtin_ctz(_prefixes) : -1;
 }
 
-void channel_user::set_mode(char modefl)
+
+void channel_user::set_prefix(unsigned rank)
 {
-    if (not has_mode(modefl)) {
-        _modes += modefl;
+    if (rank < max_prefixes) {
+        _prefixes |= prefix_set{1} << rank;
     }
 }
 
-void channel_user::unset_mode(char modefl)
+void channel_user::unset_prefix(unsigned rank)
 {
-    if (has_mode(modefl)) {
-        _modes.erase(_modes.find(modefl));
+    if (rank < max_prefixes) {
+        _prefixes &= ~(prefix_set{1} << rank);
     }
 }
 
+
+std::time_t channel_user::last_active() const
+{
+    return static_cast<std::time_t>(_last_active);
+}
+
+void channel_user::set_active(std::time_t when)
+{
+    _last_active = static_cast<uint32_t>(when);
+}
+
 }
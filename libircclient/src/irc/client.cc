@@ -25,8 +25,12 @@
 #include "irc/irc_utils.hh"
 #include "irc/connection.hh"
 #include "irc/environment.hh"
+#include "irc/environment_snapshot.hh"
 #include "irc/channel.hh"
 #include "irc/channel_user.hh"
+#include "irc/network_user.hh"
+#include "irc/netsplit.hh"
+#include "irc/state_journal.hh"
 
 #include <ctime>
 #include <cstddef>
@@ -40,8 +44,10 @@
 #include <functional>
 #include <array>
 #include <future>
+#include <atomic>
 #include <exception>
 #include <chrono>
+#include <thread>
 #include <utility>
 
 
@@ -55,6 +61,16 @@ struct client::details {
     std::unique_ptr<irc::async_connection> irccon;
     std::unique_ptr<irc::environment> ircenv;
 
+    // Only ever accessed through std::atomic_load/store
+    std::shared_ptr<environment_snapshot const> snapshot;
+
+    // Users that left in a netsplit, removed in one go once the burst of
+    // QUITs is over.
+    std::vector<handle<network_user>> split_quits;
+
+    // Outlives the environment of each connection.
+    state_journal journal;
+
     details()
         : idle_timer{io_service}
     {
@@ -99,6 +115,8 @@ void client::run(std::string const& host, uint16_t port, bool ssl)
 
         _impl->irccon.reset(new irc::async_connection{_impl->io_service, flags});
         _impl->ircenv.reset(new irc::environment{});
+        _impl->ircenv->_journal = &_impl->journal;
+        _impl->journal.append(state_delta::kind::reset, atom{}, 0);
 
         _impl->irccon->connect(host, port, [this] (auto ep) {
             _impl->idle_timer.expires_from_now(_impl->idle_interval);
@@ -307,6 +325,21 @@ environment const& client::environment() const
     return *_impl->ircenv;
 }
 
+std::shared_ptr<environment_snapshot const> client::snapshot() const
+{
+    return std::atomic_load(&_impl->snapshot);
+}
+
+state_journal& client::journal()
+{
+    return _impl->journal;
+}
+
+state_journal const& client::journal() const
+{
+    return _impl->journal;
+}
+
 
 
 bool client::is_me(std::string user) const
@@ -398,6 +431,7 @@ void client::handle_message(message const& msg)
 void client::do_disconnect()
 {
     _impl->idle_timer.cancel();
+    _impl->split_quits.clear();
 
     if (_impl->irccon) {
         _impl->irccon->disconnect();
@@ -411,6 +445,11 @@ void client::do_disconnect()
 
 void client::do_idle()
 {
+    flush_split_quits();
+
+    // Publishing once per tick batches up everything that arrived since.
+    std::atomic_store(&_impl->snapshot, _impl->ircenv->publish());
+
     on_idle();
 
     std::chrono::system_clock::time_point now =
@@ -452,6 +491,11 @@ void client::login_handler(message const& msg)
 
 void client::main_handler(message const& msg)
 {
+    // Anything but the next QUIT of a split gets to see its users gone.
+    if (not _impl->split_quits.empty() and not is_split_quit(msg)) {
+        flush_split_quits();
+    }
+
     auto const& res = _core_handlers.find(msg.command);
     if (res != std::end(_core_handlers)) {
         if (std::get<2>(res->second)) {
@@ -467,6 +511,21 @@ void client::main_handler(message const& msg)
 }
 
 
+bool client::is_split_quit(message const& msg) const
+{
+    return rfc1459_equal(msg.command, command::QUIT) and not msg.args.empty()
+        and netsplit_tracker::is_split_reason(msg.args[0]);
+}
+
+void client::flush_split_quits()
+{
+    if (not _impl->split_quits.empty()) {
+        _impl->ircenv->quit_users(_impl->split_quits);
+        _impl->split_quits.clear();
+    }
+}
+
+
 void client::run_core_handler(
     client::handler const& handler,
     message const& msg)
@@ -563,16 +622,26 @@ void client::init_core_handlers()
     _core_handlers[command::RPL_TOPIC] = handler{ 3, false, false,
         // me, channel, topic
         [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[1]);
-            channel.set_topic(msg.args[2]);
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[1]);
+
+            if (not chan) {
+                return;
+            }
+
+            chan->set_topic(msg.args[2]);
         }
     };
 
     _core_handlers[command::RPL_TOPICWHOTIME] = handler{ 4, false, false,
         // me, channel, creator, time
         [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[1]);
-            channel.set_topic_meta(
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[1]);
+
+            if (not chan) {
+                return;
+            }
+
+            chan->set_topic_meta(
                 normalize_nick(msg.args[2]),
                 std::stoll(msg.args[3]));
         }
@@ -581,9 +650,13 @@ void client::init_core_handlers()
     _core_handlers[command::RPL_CHANNELMODEIS] = handler{ 3, false, false,
         // me, channel, mode, _core_handlers[mode_args]
         [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[1]);
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[1]);
+
+            if (not chan) {
+                return;
+            }
 
-            channel.apply_modes(
+            chan->apply_modes(
                 msg.args[2],
                 {std::begin(msg.args) + 3, std::end(msg.args)},
                 *_impl->ircenv);
@@ -593,86 +666,94 @@ void client::init_core_handlers()
     _core_handlers[command::RPL_CREATIONTIME] = handler{ 3, false, false,
         // me, channel, ctime
         [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[1]);
-            channel.set_created(std::stoll(msg.args[2]));
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[1]);
+
+            if (not chan) {
+                return;
+            }
+
+            chan->set_created(std::stoll(msg.args[2]));
         }
     };
 
     _core_handlers[command::RPL_WHOREPLY] = handler{ 7, false, false,
         // me, channel, user, host, server, nick, mode, <...>
         [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[1]);
-
-            channel_user* user = nullptr;
-
-            if (!channel.has_user(msg.args[5])) {
-                user = &channel.create_user(
-                    msg.args[5],
-                    msg.args[2],
-                    msg.args[3]);
+            // Also answers WHO queries for nicks or channels we are not in,
+            // those don't concern the channel state.
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[1]);
 
-            } else {
-                user = &channel.find_user(msg.args[5]);
-
-                user->_user = msg.args[2];
-                user->_host = msg.args[3];
+            if (not chan) {
+                return;
             }
 
-            auto prefixes = _impl->ircenv->prefixes();
+            // Flags are "H" or "G", maybe "*" for opers, then prefixes.
+            channel_user::prefix_set prefixes = 0;
 
             for (char c : msg.args[6]) {
-                if (prefixes.find(c) != std::end(prefixes)) {
-                    channel.apply_modes(
-                        "+" + std::string{prefixes.at(c)},
-                        {user->nick()}, *_impl->ircenv);
+                int rank = _impl->ircenv->symbol_rank(c);
+
+                if (rank >= 0) {
+                    prefixes |= channel_user::prefix_set{1} << rank;
                 }
             }
+
+            _impl->ircenv->join_user(
+                *chan,
+                msg.args[5],
+                msg.args[2],
+                msg.args[3],
+                prefixes);
         }
     };
 
     _core_handlers[command::RPL_NAMREPLY] = handler{ 4, false, false,
         // me, "=", channel, users...
         [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[2]);
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[2]);
 
-            auto const& pref = _impl->ircenv->prefixes();
+            if (not chan) {
+                return;
+            }
 
-            for (auto user : split_noempty(msg.args[3], " ")) {
-                std::string modes;
+            _impl->ircenv->add_names(*chan, msg.args[3]);
+        }
+    };
 
-                for (std::size_t start = 0; start < user.length(); ++start) {
-                    auto c = pref.find(user[start]);
+    // me, channel, entry, [setter, time]
+    auto list_handler = [this](char modefl) {
+        return [this, modefl](message const& msg) {
+            channel* chan = _impl->ircenv->lookup_channel(msg.args[1]);
 
-                    if (c != std::end(pref)) {
-                        modes.push_back(c->second);
-                    } else {
-                        user = user.substr(start);
+            if (not chan) {
+                return;
+            }
 
-                        break;
-                    }
-                }
+            std::string setter;
+            std::time_t set_time = 0;
 
-                if (!channel.has_user(user)) {
-                    channel.create_user(user, "", "");
+            if (msg.args.size() >= 5) {
+                setter = msg.args[3];
 
-                    for (char m : modes) {
-                        channel.apply_modes(
-                            "+" + std::string{m}, {user},
-                            *_impl->ircenv);
-                    }
+                try {
+                    set_time = std::stoll(msg.args[4]);
+                } catch (std::exception const&) {
                 }
             }
-        }
+
+            chan->add_list_entry(
+                modefl, msg.args[2], std::move(setter), set_time);
+        };
     };
 
-    _core_handlers[command::RPL_BANLIST] = handler{ 3, false, false,
-        // me, channel, entry
-        [this](message const& msg) {
-            auto& channel = _impl->ircenv->find_channel(msg.args[1]);
+    _core_handlers[command::RPL_BANLIST] =
+        handler{ 3, false, false, list_handler('b') };
 
-            channel.apply_modes("+b", {msg.args[2]}, *_impl->ircenv);
-        }
-    };
+    _core_handlers[command::RPL_EXCEPTLIST] =
+        handler{ 3, false, false, list_handler('e') };
+
+    _core_handlers[command::RPL_INVITELIST] =
+        handler{ 3, false, false, list_handler('I') };
 
     _core_handlers[command::PING] = handler{ 1, false, false,
         // server
@@ -683,20 +764,36 @@ void client::init_core_handlers()
 
     // Channel user events
     _core_handlers[command::JOIN] = handler{ 1, true, false,
-        // channel
+        // channel, [account, realname] (extended-join)
         [this](message const& msg) {
+            std::string nick;
+            std::string user;
+            std::string host;
+
+            std::tie(nick, user, host) = split_prefix(msg.prefix);
+
             // me? add channel. not me? add user to channel.
+            channel_user* member = nullptr;
+
             if (is_me(msg.prefix)) {
                 auto& channel = _impl->ircenv->create_channel(msg.args[0]);
 
-                channel.create_user(msg.prefix);
+                member = &_impl->ircenv->join_user(channel, nick, user, host);
 
                 send_message(message{"", command::WHO,  {msg.args[0]}});
                 send_message(message{"", command::MODE, {msg.args[0]}});
                 send_message(message{"", command::MODE, {msg.args[0], "+b"}});
             } else {
-                _impl->ircenv->find_channel(msg.args[0]).create_user(msg.prefix);
+                member = &_impl->ircenv->join_user(
+                    _impl->ircenv->find_channel(msg.args[0]), nick, user, host);
             }
+
+            if (msg.args.size() >= 3) {
+                _impl->ircenv->set_account(member->network_user(),
+                    msg.args[1] == "*" ? "" : msg.args[1]);
+            }
+
+            member->set_active(std::time(nullptr));
         }
     };
 
@@ -709,7 +806,8 @@ void client::init_core_handlers()
             if (is_me(msg.prefix)) {
                 _impl->ircenv->remove_channel(channel);
             } else {
-                channel.remove_user(channel.find_user(msg.prefix));
+                _impl->ircenv->part_user(channel,
+                    channel.find_user(msg.prefix).network_user());
             }
         }
     };
@@ -723,7 +821,8 @@ void client::init_core_handlers()
             if (is_me(msg.args[1])) {
                 _impl->ircenv->remove_channel(channel);
             } else {
-                channel.remove_user(channel.find_user(msg.args[1]));
+                _impl->ircenv->part_user(channel,
+                    channel.find_user(msg.args[1]).network_user());
             }
         }
     };
@@ -731,15 +830,18 @@ void client::init_core_handlers()
     _core_handlers[command::QUIT] = handler{ 0, true, true,
         // [reason]
         [this](message const& msg) {
-            // me? unlikely. not me? remove user from all channels.
+            // me? unlikely. not me? remove user from all their channels.
             if (not is_me(msg.prefix)) {
-                auto& channels = _impl->ircenv->channels();
+                network_user* user = _impl->ircenv->lookup_user(msg.prefix);
 
-                for (auto& i : channels) {
-                    if (i.second->has_user(msg.prefix)) {
-                        i.second->remove_user(
-                            i.second->find_user(msg.prefix));
-                    }
+                if (not user) {
+                    return;
+                }
+
+                if (is_split_quit(msg)) {
+                    _impl->split_quits.push_back(user->handle());
+                } else {
+                    _impl->ircenv->quit_user(*user);
                 }
             } else {
                 do_disconnect();
@@ -761,16 +863,57 @@ void client::init_core_handlers()
                 _nick = msg.args[0];
             }
 
-            auto& channels = _impl->ircenv->channels();
+            if (network_user* user = _impl->ircenv->lookup_user(msg.prefix)) {
+                _impl->ircenv->rename_user(*user, msg.args[0]);
+            }
+        }
+    };
 
-            for (auto& i : channels) {
-                if (i.second->has_user(msg.prefix)) {
-                    i.second->rename_user(msg.prefix, msg.args[0]);
-                }
+    _core_handlers[command::CHGHOST] = handler{ 2, true, false,
+        // new user, new host
+        [this](message const& msg) {
+            if (network_user* user = _impl->ircenv->lookup_user(msg.prefix)) {
+                _impl->ircenv->change_host(*user, msg.args[0], msg.args[1]);
             }
         }
     };
 
+    _core_handlers[command::ACCOUNT] = handler{ 1, true, false,
+        // account
+        [this](message const& msg) {
+            if (network_user* user = _impl->ircenv->lookup_user(msg.prefix)) {
+                _impl->ircenv->set_account(
+                    *user, msg.args[0] == "*" ? "" : msg.args[0]);
+            }
+        }
+    };
+
+    // Speaking keeps a member's idle time fresh. Servers send notices too,
+    // so the prefix is checked here rather than by the dispatcher.
+    auto touch_member = [this](message const& msg) {
+        if (not is_user_prefix(msg.prefix)) {
+            return;
+        }
+
+        channel* chan = _impl->ircenv->lookup_channel(msg.args[0]);
+
+        if (not chan) {
+            return;
+        }
+
+        if (channel_user* member = chan->lookup_user(msg.prefix)) {
+            member->set_active(std::time(nullptr));
+        }
+    };
+
+    _core_handlers[command::PRIVMSG] = handler{ 2, false, false,
+        // target, message
+        touch_member };
+
+    _core_handlers[command::NOTICE] = handler{ 2, false, false,
+        // target, message
+        touch_member };
+
     // Channel events
     _core_handlers[command::TOPIC] = handler{ 2, false, false,
         // channel, new topic
@@ -799,7 +942,8 @@ void client::init_core_handlers()
             _impl->ircenv->find_channel(msg.args[0]).apply_modes(
                 msg.args[1],
                 {std::begin(msg.args) + 2, std::end(  msg.args)},
-                *_impl->ircenv);
+                *_impl->ircenv,
+                msg.prefix);
         }
     };
 }
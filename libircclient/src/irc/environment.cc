@@ -18,14 +18,19 @@
  */
 
 #include "irc/environment.hh"
+#include "irc/environment_snapshot.hh"
 
+#include "irc/atom.hh"
 #include "irc/irc_utils.hh"
 #include "irc/irc_except.hh"
 #include "irc/channel.hh"
 #include "irc/channel_user.hh"
+#include "irc/network_user.hh"
 
 #include <algorithm>
 #include <sstream>
+#include <string>
+#include <stdexcept>
 #include <vector>
 #include <memory>
 #include <tuple>
@@ -34,6 +39,7 @@ namespace irc {
 
 environment::environment()
 {
+    init_symbol_ranks();
 }
 
 environment::environment(environment const& rhs)
@@ -41,17 +47,53 @@ environment::environment(environment const& rhs)
       _channel_modes{rhs._channel_modes},
       _channel_prefixes{rhs._channel_prefixes},
       _prefix_modes{rhs._prefix_modes},
-      _channel_types{rhs._channel_types}
+      _prefix_symbols{rhs._prefix_symbols},
+      _symbol_ranks{rhs._symbol_ranks},
+      _channel_types{rhs._channel_types},
+      _max_modes{rhs._max_modes},
+      _next_uid{rhs._next_uid}
 {
+    for (auto& u : rhs._users) {
+        network_user const& src = *u.second;
+
+        auto usr = std::make_unique<network_user>(
+            src._uid, src._nick, src._user, src._host);
+
+        usr->_account = src._account;
+        usr->_handle  = _user_handles.insert(*usr);
+
+        _nicks[usr->_nick_atom] = usr.get();
+        touch_user(usr->_uid);
+        _users[usr->_uid]  = std::move(usr);
+    }
+
     for (auto& c : rhs._channels) {
-        _channels[c.first] = std::make_unique<channel>(*(c.second));
+        channel const& src = *c.second;
+        channel& chan = create_channel(src._name);
+
+        chan._modes   = src._modes;
+        chan._lists   = src._lists;
+        chan._created = src._created;
+        chan._topic   = src._topic;
+
+        for (channel_user const& cu : src._users) {
+            network_user& usr = *_users.at(cu.uid());
+
+            chan.add_user(usr)._prefixes = cu._prefixes;
+            usr._channels.push_back(&chan);
+        }
     }
 }
 
+environment::~environment()
+{
+}
+
 
 void environment::set_capability(std::string const& cap, std::string const& val)
 {
     _capabilities[cap] = val;
+    _dirty_server = true;
 
     if (rfc1459_equal(cap, "CHANMODES")) {
         init_channel_modes(val);
@@ -59,6 +101,13 @@ void environment::set_capability(std::string const& cap, std::string const& val)
         init_channel_prefixes(val);
     } else if (rfc1459_equal(cap, "CHANTYPES")) {
         _channel_types = val;
+    } else if (rfc1459_equal(cap, "MODES")) {
+        // "MODES" without a value means there is no limit.
+        try {
+            _max_modes = val.empty() ? 0 : std::stoul(val);
+        } catch (std::exception const&) {
+            _max_modes = 3;
+        }
     }
 }
 
@@ -81,6 +130,33 @@ environment::channel_prefixes const& environment::prefixes() const
     return _channel_prefixes;
 }
 
+std::string environment::prefix_modes() const
+{
+    return _prefix_modes;
+}
+
+std::string environment::prefix_symbols() const
+{
+    return _prefix_symbols;
+}
+
+int environment::prefix_rank(char mode) const
+{
+    std::size_t pos = _prefix_modes.find(mode);
+
+    return (pos != std::string::npos) ? static_cast<int>(pos) : -1;
+}
+
+char environment::prefix_symbol(unsigned rank) const
+{
+    return (rank < _prefix_symbols.size()) ? _prefix_symbols[rank] : '\0';
+}
+
+int environment::symbol_rank(char symbol) const
+{
+    return _symbol_ranks[static_cast<unsigned char>(symbol)];
+}
+
 environment::channel_mode_types const& environment::chanmodes() const
 {
     return _channel_modes;
@@ -97,6 +173,11 @@ bool environment::is_channel(std::string const& subj) const
     return _channel_types.find(subj.front()) != std::string::npos;
 }
 
+std::size_t environment::max_modes() const
+{
+    return _max_modes;
+}
+
 
 environment::channel_mode_changes environment::partition_mode_changes(
     std::string const& modes,
@@ -151,16 +232,99 @@ environment::channel_list const& environment::channels() const
 
 bool environment::has_channel(std::string const& channel) const
 {
-    return _channels.find(channel) != std::end(_channels);
+    return lookup_channel(channel) != nullptr;
 }
 
+bool environment::has_channel(atom channel) const
+{
+    return lookup_channel(channel) != nullptr;
+}
+
+
 channel& environment::find_channel(std::string const& channel) const
 {
-    if (_channels.find(channel) == std::end(_channels)) {
+    class channel* chan = lookup_channel(channel);
+
+    if (not chan) {
         throw protocol_error{protocol_error_type::no_such_channel, channel};
     }
 
-    return *_channels.find(channel)->second;
+    return *chan;
+}
+
+channel& environment::find_channel(atom channel) const
+{
+    class channel* chan = lookup_channel(channel);
+
+    if (not chan) {
+        throw protocol_error{protocol_error_type::no_such_channel,
+            channel ? atom_table::global().folded(channel) : ""};
+    }
+
+    return *chan;
+}
+
+channel* environment::lookup_channel(std::string const& channel) const
+{
+    return lookup_channel(atom_table::global().find(channel));
+}
+
+channel* environment::lookup_channel(atom channel) const
+{
+    // Names that were never interned can't be channels we know.
+    if (not channel) {
+        return nullptr;
+    }
+
+    auto iter = _channels.find(channel);
+
+    return (iter != std::end(_channels)) ? iter->second.get() : nullptr;
+}
+
+
+environment::user_list const& environment::users() const
+{
+    return _users;
+}
+
+
+bool environment::has_user(std::string const& user) const
+{
+    return lookup_user(user) != nullptr;
+}
+
+network_user& environment::find_user(std::string const& user) const
+{
+    network_user* u = lookup_user(user);
+
+    if (not u) {
+        throw protocol_error{protocol_error_type::no_such_user, user};
+    }
+
+    return *u;
+}
+
+network_user& environment::find_user(uint64_t uid) const
+{
+    network_user* u = lookup_user(uid);
+
+    if (not u) {
+        throw protocol_error{
+            protocol_error_type::no_such_user, std::to_string(uid)};
+    }
+
+    return *u;
+}
+
+
+channel* environment::resolve(handle<channel> h) const
+{
+    return _channel_handles.get(h);
+}
+
+network_user* environment::resolve(handle<network_user> h) const
+{
+    return _user_handles.get(h);
 }
 
 
@@ -182,14 +346,557 @@ channel_mode_argument_type environment::get_mode_argument_type(char mode) const
 
 channel& environment::create_channel(std::string name)
 {
-    _channels[name] = std::make_unique<channel>(name);
+    auto chan = std::make_unique<channel>(*this, std::move(name));
+    atom key  = chan->_name_atom;
+
+    if (channel* old = lookup_channel(key)) {
+        remove_channel(*old);
+    }
 
-    return *_channels[name];
+    chan->_handle = _channel_handles.insert(*chan);
+
+    _channels[key] = std::move(chan);
+    touch_channel(key);
+    record(state_delta::kind::channel_created, key, 0);
+
+    return *_channels[key];
 }
 
 void environment::remove_channel(channel& channel)
 {
-    _channels.erase(channel.name());
+    std::vector<network_user*> members;
+
+    members.reserve(channel._users.size());
+
+    for (channel_user const& cu : channel._users) {
+        members.push_back(cu._user);
+    }
+
+    for (network_user* u : members) {
+        part_user(channel, *u);
+    }
+
+    touch_channel(channel._name_atom);
+    record(state_delta::kind::channel_removed, channel._name_atom, 0);
+
+    _channel_handles.erase(channel._handle);
+    _channels.erase(channel._name_atom);
+}
+
+
+channel_user& environment::join_user(
+    channel& channel,
+    std::string const& nick,
+    std::string const& user,
+    std::string const& host,
+    channel_user::prefix_set prefixes)
+{
+    network_user* u = lookup_user(nick);
+
+    if (not u) {
+        u = &register_user(normalize_nick(nick), user, host);
+    } else if ((not user.empty() and (user != u->_user))
+            or (not host.empty() and (host != u->_host))) {
+        if (not user.empty()) {
+            u->_user = user;
+        }
+
+        if (not host.empty()) {
+            u->_host = host;
+        }
+
+        identity_changed(*u);
+        touch_user(u->_uid);
+    }
+
+    channel_user* cu = channel._users.find(*u);
+
+    if (not cu) {
+        u->_channels.push_back(&channel);
+        cu = &channel.add_user(*u);
+
+        touch_channel(channel._name_atom);
+        touch_user(u->_uid);
+
+        if (_journal) {
+            record(state_delta::kind::user_joined, channel._name_atom,
+                u->_uid, '\0', u->_nick + "!" + u->_user + "@" + u->_host);
+        }
+    }
+
+    if (add_prefixes(channel, *cu, prefixes)) {
+        channel.members_changed();
+        touch_channel(channel._name_atom);
+    }
+
+    return *cu;
+}
+
+void environment::add_names(channel& channel, std::string const& names)
+{
+    std::size_t count = static_cast<std::size_t>(
+        std::count(std::begin(names), std::end(names), ' ')) + 1;
+
+    channel._users.reserve(channel._users.size() + count);
+    _users.reserve(_users.size() + count);
+    _nicks.reserve(_nicks.size() + count);
+
+    char const* pos = names.data();
+    char const* end = pos + names.size();
+
+    bool changed = false;
+
+    while (pos != end) {
+        if (*pos == ' ') {
+            ++pos;
+            continue;
+        }
+
+        channel_user::prefix_set prefixes = 0;
+
+        for (int rank; (pos != end) and ((rank = symbol_rank(*pos)) >= 0);
+                ++pos) {
+            prefixes |= channel_user::prefix_set{1} << rank;
+        }
+
+        char const* nick = pos;
+        pos = std::find(pos, end, ' ');
+
+        // userhost-in-names gives us "nick!user@host"
+        char const* bang = std::find(nick, pos, '!');
+        char const* at   = std::find(bang, pos, '@');
+
+        if (nick == bang) {
+            continue;
+        }
+
+        network_user* u = lookup_nick(nick, bang - nick);
+
+        if (not u) {
+            u = &register_user(
+                std::string{nick, bang},
+                (bang != pos) ? std::string{bang + 1, at} : std::string{},
+                (at   != pos) ? std::string{at + 1, pos}  : std::string{});
+        } else if ((at != pos)
+                and ((u->_user.compare(0, std::string::npos,
+                        bang + 1, at - bang - 1) != 0)
+                  or (u->_host.compare(0, std::string::npos,
+                        at + 1, pos - at - 1) != 0))) {
+            u->_user.assign(bang + 1, at);
+            u->_host.assign(at + 1, pos);
+
+            identity_changed(*u);
+            touch_user(u->_uid);
+        }
+
+        channel_user* cu = channel._users.find(*u);
+
+        if (not cu) {
+            u->_channels.push_back(&channel);
+            cu = &channel.add_user(*u);
+
+            touch_user(u->_uid);
+            changed = true;
+
+            if (_journal) {
+                record(state_delta::kind::user_joined, channel._name_atom,
+                    u->_uid, '\0', u->_nick + "!" + u->_user + "@" + u->_host);
+            }
+        }
+
+        changed |= add_prefixes(channel, *cu, prefixes);
+    }
+
+    // A refresh of members we already know about changes nothing.
+    if (changed) {
+        channel.members_changed();
+        touch_channel(channel._name_atom);
+    }
+}
+
+bool environment::add_prefixes(
+    channel& channel,
+    channel_user& member,
+    channel_user::prefix_set prefixes)
+{
+    channel_user::prefix_set added = prefixes & ~member._prefixes;
+
+    if (not added) {
+        return false;
+    }
+
+    member._prefixes |= added;
+    channel.member_changed(member.uid());
+
+    for (std::size_t rank = 0; _journal and added; ++rank, added >>= 1) {
+        if (added & 1) {
+            record(state_delta::kind::prefix_set, channel._name_atom,
+                member.uid(), _prefix_modes[rank]);
+        }
+    }
+
+    return true;
+}
+
+void environment::part_user(channel& channel, network_user& user)
+{
+    auto& cs = user._channels;
+
+    cs.erase(std::remove(std::begin(cs), std::end(cs), &channel), std::end(cs));
+
+    channel.remove_user(user);
+
+    touch_channel(channel._name_atom);
+    touch_user(user._uid);
+    record(state_delta::kind::user_parted, channel._name_atom, user._uid);
+
+    // Nothing left to keep track of them by.
+    if (cs.empty()) {
+        forget_user(user);
+    }
+}
+
+void environment::quit_user(network_user& user)
+{
+    for (channel* c : user._channels) {
+        c->remove_user(user);
+        touch_channel(c->_name_atom);
+    }
+
+    record(state_delta::kind::user_quit, atom{}, user._uid);
+
+    user._channels.clear();
+    forget_user(user);
+}
+
+void environment::quit_users(std::vector<handle<network_user>> const& users)
+{
+    for (handle<network_user> h : users) {
+        if (network_user* u = resolve(h)) {
+            quit_user(*u);
+        }
+    }
+}
+
+
+void environment::rename_user(network_user& user, std::string new_nick)
+{
+    atom_ref new_atom{new_nick};
+    auto iter = _nicks.find(new_atom);
+
+    // A different user holding the new nick can only be stale state.
+    if ((iter != std::end(_nicks)) and (iter->second != &user)) {
+        quit_user(*iter->second);
+    }
+
+    _nicks.erase(user._nick_atom);
+
+    user._nick      = std::move(new_nick);
+    user._nick_atom = std::move(new_atom);
+
+    _nicks[user._nick_atom] = &user;
+
+    identity_changed(user);
+    touch_user(user._uid);
+    record(state_delta::kind::user_renamed, atom{}, user._uid, '\0', user._nick);
+}
+
+void environment::change_host(
+    network_user& user,
+    std::string new_user,
+    std::string new_host)
+{
+    user._user = std::move(new_user);
+    user._host = std::move(new_host);
+
+    identity_changed(user);
+    touch_user(user._uid);
+    record(state_delta::kind::user_host_changed, atom{}, user._uid, '\0',
+        user._user + "@" + user._host);
+}
+
+void environment::set_account(network_user& user, std::string account)
+{
+    user._account = std::move(account);
+
+    touch_user(user._uid);
+    record(state_delta::kind::user_account, atom{}, user._uid, '\0',
+        user._account);
+}
+
+
+network_user& environment::register_user(
+    std::string nick,
+    std::string user,
+    std::string host)
+{
+    auto usr = std::make_unique<network_user>(
+        _next_uid++, std::move(nick), std::move(user), std::move(host));
+
+    network_user& u = *usr;
+    u._handle = _user_handles.insert(u);
+
+    _nicks[u._nick_atom] = &u;
+    _users[u._uid]  = std::move(usr);
+
+    return u;
+}
+
+network_user* environment::lookup_user(std::string const& user) const
+{
+    // Same as normalize_nick(), but without copying the nick.
+    std::size_t length = is_user_prefix(user)
+        ? std::min(user.find('!'), user.size())
+        : user.size();
+
+    return lookup_nick(user.data(), length);
+}
+
+network_user* environment::lookup_user(uint64_t uid) const
+{
+    auto iter = _users.find(uid);
+
+    return (iter != std::end(_users)) ? iter->second.get() : nullptr;
+}
+
+network_user* environment::lookup_nick(
+    char const* nick,
+    std::size_t length) const
+{
+    atom a = atom_table::global().find(nick, length);
+
+    if (not a) {
+        return nullptr;
+    }
+
+    auto iter = _nicks.find(a);
+
+    return (iter != std::end(_nicks)) ? iter->second : nullptr;
+}
+
+void environment::forget_user(network_user& user)
+{
+    touch_user(user._uid);
+
+    _user_handles.erase(user._handle);
+    _nicks.erase(user._nick_atom);
+    _users.erase(user._uid);
+}
+
+
+std::shared_ptr<environment_snapshot const> environment::publish()
+{
+    if (_published and not _dirty_server
+            and _dirty_channels.empty() and _dirty_users.empty()) {
+        return _published;
+    }
+
+    auto snap = _published
+        ? std::make_shared<environment_snapshot>(*_published)
+        : std::make_shared<environment_snapshot>();
+
+    ++snap->_version;
+
+    std::sort(std::begin(_dirty_channels), std::end(_dirty_channels),
+        [] (atom_ref const& a, atom_ref const& b) {
+            return a.get().id() < b.get().id();
+        });
+
+    _dirty_channels.erase(
+        std::unique(std::begin(_dirty_channels), std::end(_dirty_channels),
+            [] (atom_ref const& a, atom_ref const& b) {
+                return a.get() == b.get();
+            }),
+        std::end(_dirty_channels));
+
+    std::sort(std::begin(_dirty_users), std::end(_dirty_users));
+
+    _dirty_users.erase(
+        std::unique(std::begin(_dirty_users), std::end(_dirty_users)),
+        std::end(_dirty_users));
+
+    if (_dirty_server) {
+        snap->_server = std::make_shared<server_snapshot const>(
+            server_snapshot{
+                _capabilities,
+                _channel_modes,
+                _prefix_modes,
+                _prefix_symbols,
+                _channel_types,
+                _max_modes});
+    }
+
+    for (atom a : _dirty_channels) {
+        std::string const& key = atom_table::global().folded(a);
+        auto iter = _channels.find(a);
+
+        if (iter == std::end(_channels)) {
+            snap->_channels.remove(key);
+            continue;
+        }
+
+        channel& chan = *iter->second;
+        auto old = chan._publish_all ? nullptr : snap->_channels.find(key);
+
+        // Members and lists are shared with the last version, so only what
+        // changed since has to be applied to them.
+        auto cs = old
+            ? std::make_shared<channel_snapshot>(*old)
+            : std::make_shared<channel_snapshot>();
+
+        cs->name    = chan._name;
+        cs->created = chan._created;
+        cs->topic   = chan._topic;
+        cs->modes   = chan._modes;
+
+        if (old) {
+            publish_changes(chan, *cs);
+        } else {
+            for (channel_user const& cu : chan._users) {
+                cs->members.set(cu.uid(),
+                    std::make_shared<channel_snapshot::member const>(
+                        channel_snapshot::member{cu.uid(), cu._prefixes}));
+            }
+
+            for (auto const& l : chan._lists) {
+                auto& entries = cs->lists[l.first];
+
+                for (list_entry const& e : l.second) {
+                    entries.set(rfc1459_lower(e.mask),
+                        std::make_shared<list_entry const>(e));
+                }
+            }
+        }
+
+        chan._changed_members.clear();
+        chan._changed_entries.clear();
+        chan._publish_all = false;
+
+        snap->_channels.set(key, std::move(cs));
+    }
+
+    for (uint64_t uid : _dirty_users) {
+        // Drop the old nick, unless someone else took it over meanwhile.
+        if (auto old = snap->_users.find(uid)) {
+            std::string old_key = rfc1459_lower(old->nick);
+            auto holder = snap->_nicks.find(old_key);
+
+            if (holder and (holder->uid == uid)) {
+                snap->_nicks.remove(old_key);
+            }
+        }
+
+        auto iter = _users.find(uid);
+
+        if (iter == std::end(_users)) {
+            snap->_users.remove(uid);
+            continue;
+        }
+
+        network_user const& usr = *iter->second;
+        auto us = std::make_shared<user_snapshot>();
+
+        us->uid     = usr._uid;
+        us->nick    = usr._nick;
+        us->user    = usr._user;
+        us->host    = usr._host;
+        us->account = usr._account;
+
+        for (channel const* c : usr._channels) {
+            us->channels.push_back(atom_table::global().folded(c->_name_atom));
+        }
+
+        std::shared_ptr<user_snapshot const> value = std::move(us);
+
+        snap->_nicks.set(atom_table::global().folded(usr._nick_atom), value);
+        snap->_users.set(uid, std::move(value));
+    }
+
+    _dirty_server = false;
+    _dirty_channels.clear();
+    _dirty_users.clear();
+
+    _published = std::move(snap);
+
+    return _published;
+}
+
+void environment::publish_changes(channel& chan, channel_snapshot& cs) const
+{
+    auto& members = chan._changed_members;
+
+    std::sort(std::begin(members), std::end(members));
+    members.erase(
+        std::unique(std::begin(members), std::end(members)),
+        std::end(members));
+
+    for (uint64_t uid : members) {
+        network_user const* u = lookup_user(uid);
+        channel_user const* cu = u ? chan._users.find(*u) : nullptr;
+
+        if (cu) {
+            cs.members.set(uid,
+                std::make_shared<channel_snapshot::member const>(
+                    channel_snapshot::member{uid, cu->_prefixes}));
+        } else {
+            cs.members.remove(uid);
+        }
+    }
+
+    for (auto const& change : chan._changed_entries) {
+        list_mode const* list = chan.find_list(change.first);
+        list_entry const* e = list ? list->find(change.second) : nullptr;
+        std::string key = rfc1459_lower(change.second);
+
+        if (e) {
+            cs.lists[change.first].set(key,
+                std::make_shared<list_entry const>(*e));
+            continue;
+        }
+
+        auto iter = cs.lists.find(change.first);
+
+        if (iter != std::end(cs.lists)) {
+            iter->second.remove(key);
+
+            if (iter->second.empty()) {
+                cs.lists.erase(iter);
+            }
+        }
+    }
+}
+
+void environment::touch_channel(atom channel)
+{
+    if (_dirty_channels.empty() or (_dirty_channels.back().get() != channel)) {
+        _dirty_channels.emplace_back(channel);
+    }
+}
+
+void environment::touch_user(uint64_t uid)
+{
+    if (_dirty_users.empty() or (_dirty_users.back() != uid)) {
+        _dirty_users.push_back(uid);
+    }
+}
+
+void environment::identity_changed(network_user const& user)
+{
+    for (channel* c : user._channels) {
+        c->members_changed();
+    }
+}
+
+void environment::record(
+    state_delta::kind type,
+    atom channel,
+    uint64_t uid,
+    char mode,
+    std::string arg)
+{
+    if (_journal) {
+        _journal->append(type, channel, uid, mode, std::move(arg));
+    }
 }
 
 
@@ -212,17 +919,33 @@ void environment::init_channel_prefixes(std::string const& prefix)
 {
     _channel_prefixes.clear();
     _prefix_modes.clear();
+    _prefix_symbols.clear();
 
     auto flag_pos = std::begin(prefix) + 1;
     auto pref_pos = std::begin(prefix) + ((prefix.size() / 2) + 1);
 
     while ((*flag_pos != ')') and (pref_pos != std::end(prefix))) {
         _channel_prefixes[*pref_pos] = *flag_pos;
-        _prefix_modes += *flag_pos;
+        _prefix_modes   += *flag_pos;
+        _prefix_symbols += *pref_pos;
 
         ++flag_pos;
         ++pref_pos;
     }
+
+    init_symbol_ranks();
+}
+
+void environment::init_symbol_ranks()
+{
+    _symbol_ranks.fill(-1);
+
+    for (std::size_t i = 0; i < _prefix_symbols.size(); ++i) {
+        if (i < channel_user::max_prefixes) {
+            _symbol_ranks[static_cast<unsigned char>(_prefix_symbols[i])] =
+                static_cast<int8_t>(i);
+        }
+    }
 }
 
 }
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "irc/environment_snapshot.hh"
+
+#include "irc/irc_utils.hh"
+
+#include <memory>
+#include <string>
+
+namespace irc {
+
+channel_snapshot::member const* channel_snapshot::find_member(
+    uint64_t uid) const
+{
+    // The map keeps the member alive as long as the snapshot.
+    return members.find(uid).get();
+}
+
+
+uint64_t environment_snapshot::version() const
+{
+    return _version;
+}
+
+server_snapshot const& environment_snapshot::server() const
+{
+    return *_server;
+}
+
+environment_snapshot::channel_map const& environment_snapshot::channels() const
+{
+    return _channels;
+}
+
+environment_snapshot::user_map const& environment_snapshot::users() const
+{
+    return _users;
+}
+
+
+std::shared_ptr<channel_snapshot const> environment_snapshot::find_channel(
+    std::string const& name) const
+{
+    return _channels.find(rfc1459_lower(name));
+}
+
+std::shared_ptr<user_snapshot const> environment_snapshot::find_user(
+    std::string const& user) const
+{
+    return _nicks.find(rfc1459_lower(normalize_nick(user)));
+}
+
+std::shared_ptr<user_snapshot const> environment_snapshot::find_user(
+    uint64_t uid) const
+{
+    return _users.find(uid);
+}
+
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "irc/handle_table.hh"
+
+#include <cstdint>
+
+#include <atomic>
+
+namespace irc {
+
+uint32_t next_handle_generation()
+{
+    static std::atomic<uint32_t> generation{0};
+
+    uint32_t res = ++generation;
+
+    // 0 is reserved for invalid handles.
+    return res ? res : ++generation;
+}
+
+}
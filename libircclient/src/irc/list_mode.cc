@@ -0,0 +1,206 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc/list_mode.hh"
+
+#include "irc/atom.hh"
+#include "irc/irc_utils.hh"
+
+#include <ctime>
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace irc {
+
+std::size_t list_mode::size() const
+{
+    return _entries.size();
+}
+
+bool list_mode::empty() const
+{
+    return _entries.empty();
+}
+
+
+list_mode::const_iterator list_mode::begin() const
+{
+    return std::begin(_entries);
+}
+
+list_mode::const_iterator list_mode::end() const
+{
+    return std::end(_entries);
+}
+
+
+list_entry const& list_mode::operator[](std::size_t i) const
+{
+    return _entries[i];
+}
+
+
+list_entry const* list_mode::find(std::string const& mask) const
+{
+    if (_index.empty()) {
+        return nullptr;
+    }
+
+    std::size_t h = atom_table::fold_hash(mask.data(), mask.size());
+    uint32_t slot = _index[probe(mask, h)];
+
+    return slot ? &_entries[slot - 1] : nullptr;
+}
+
+bool list_mode::contains(std::string const& mask) const
+{
+    return find(mask) != nullptr;
+}
+
+
+bool list_mode::insert(
+    std::string mask,
+    std::string setter,
+    std::time_t set_time)
+{
+    if ((_index.empty()) or ((_entries.size() + 1) * 2 > _index.size())) {
+        rehash(_index.empty() ? 8 : _index.size() * 2);
+    }
+
+    std::size_t h = atom_table::fold_hash(mask.data(), mask.size());
+    std::size_t slot = probe(mask, h);
+
+    if (_index[slot]) {
+        list_entry& e = _entries[_index[slot] - 1];
+
+        if (e.setter.empty()) {
+            e.setter = std::move(setter);
+        }
+
+        if (e.set_time == 0) {
+            e.set_time = set_time;
+        }
+
+        return false;
+    }
+
+    _entries.push_back(list_entry{
+        std::move(mask), std::move(setter), set_time});
+
+    _hashes.push_back(h);
+    _index[slot] = static_cast<uint32_t>(_entries.size());
+
+    return true;
+}
+
+bool list_mode::erase(std::string const& mask)
+{
+    if (_index.empty()) {
+        return false;
+    }
+
+    std::size_t mask_bits = _index.size() - 1;
+    std::size_t h = atom_table::fold_hash(mask.data(), mask.size());
+    std::size_t hole = probe(mask, h);
+
+    if (not _index[hole]) {
+        return false;
+    }
+
+    std::size_t pos  = _index[hole] - 1;
+    std::size_t last = _entries.size() - 1;
+
+    // Backward shift deletion, see member_table::erase().
+    for (std::size_t next = (hole + 1) & mask_bits;
+            _index[next];
+            next = (next + 1) & mask_bits) {
+
+        std::size_t home = _hashes[_index[next] - 1] & mask_bits;
+
+        if (((next - home) & mask_bits) >= ((next - hole) & mask_bits)) {
+            _index[hole] = _index[next];
+            hole = next;
+        }
+    }
+
+    _index[hole] = 0;
+
+    // Fill the gap with the last entry and point its slot to the new place.
+    if (pos != last) {
+        std::size_t slot = _hashes[last] & mask_bits;
+
+        while (_index[slot] != last + 1) {
+            slot = (slot + 1) & mask_bits;
+        }
+
+        _index[slot]  = static_cast<uint32_t>(pos + 1);
+        _entries[pos] = std::move(_entries[last]);
+        _hashes[pos]  = _hashes[last];
+    }
+
+    _entries.pop_back();
+    _hashes.pop_back();
+
+    return true;
+}
+
+void list_mode::clear()
+{
+    _entries.clear();
+    _hashes.clear();
+    _index.clear();
+}
+
+
+std::size_t list_mode::probe(std::string const& mask, std::size_t hash) const
+{
+    std::size_t mask_bits = _index.size() - 1;
+
+    for (std::size_t slot = hash & mask_bits;; slot = (slot + 1) & mask_bits) {
+        uint32_t i = _index[slot];
+
+        if (not i or ((_hashes[i - 1] == hash)
+                and rfc1459_equal(_entries[i - 1].mask, mask))) {
+            return slot;
+        }
+    }
+}
+
+void list_mode::rehash(std::size_t capacity)
+{
+    std::size_t mask_bits = capacity - 1;
+
+    _index.assign(capacity, 0);
+
+    for (std::size_t i = 0; i < _entries.size(); ++i) {
+        std::size_t slot = _hashes[i] & mask_bits;
+
+        while (_index[slot]) {
+            slot = (slot + 1) & mask_bits;
+        }
+
+        _index[slot] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "irc/mask_matcher.hh"
+
+#include "irc/list_mode.hh"
+#include "irc/irc_utils.hh"
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace irc {
+
+namespace {
+
+bool is_wildcard(char c)
+{
+    return (c == '*') or (c == '?');
+}
+
+bool is_literal(std::string const& str)
+{
+    return std::none_of(std::begin(str), std::end(str), is_wildcard);
+}
+
+bool is_separator(char c)
+{
+    return (c == '.') or (c == ':');
+}
+
+// Last two labels of a host, or all of it if it has fewer.
+std::string host_suffix(std::string const& host)
+{
+    std::size_t last = host.rfind('.');
+
+    if ((last == std::string::npos) or (last == 0)) {
+        return host;
+    }
+
+    std::size_t prev = host.rfind('.', last - 1);
+
+    return (prev == std::string::npos) ? host : host.substr(prev + 1);
+}
+
+// First two labels of a host including the trailing separator (IPv4 and IPv6
+// ranges), or all of it if it has fewer.
+std::string host_prefix(std::string const& host)
+{
+    int seen = 0;
+
+    for (std::size_t i = 0; i < host.size(); ++i) {
+        if (is_separator(host[i]) and (++seen == 2)) {
+            return host.substr(0, i + 1);
+        }
+    }
+
+    return host;
+}
+
+// The pattern is case-folded already, characters of the string are passed
+// through `fold' as they are compared.
+template <typename Fold>
+bool match_glob(std::string const& pat, std::string const& str, Fold fold)
+{
+    std::size_t p = 0;
+    std::size_t s = 0;
+    std::size_t star = std::string::npos;
+    std::size_t mark = 0;
+
+    while (s < str.size()) {
+        if ((p < pat.size()) and ((pat[p] == '?') or (pat[p] == fold(str[s])))) {
+            ++p;
+            ++s;
+        } else if ((p < pat.size()) and (pat[p] == '*')) {
+            star = p++;
+            mark = s;
+        } else if (star != std::string::npos) {
+            // Let the last star swallow one more character and retry.
+            p = star + 1;
+            s = ++mark;
+        } else {
+            return false;
+        }
+    }
+
+    while ((p < pat.size()) and (pat[p] == '*')) {
+        ++p;
+    }
+
+    return p == pat.size();
+}
+
+// Both pattern and string are case-folded already.
+bool match_folded(std::string const& pat, std::string const& str)
+{
+    return match_glob(pat, str, [] (char c) { return c; });
+}
+
+std::string fold_hostmask(
+    std::string const& nick,
+    std::string const& user,
+    std::string const& host)
+{
+    std::string res;
+
+    res.reserve(nick.size() + user.size() + host.size() + 2);
+    res += nick;
+    res += '!';
+    res += user;
+    res += '@';
+    res += host;
+
+    std::transform(std::begin(res), std::end(res), std::begin(res),
+        [] (char c) { return rfc1459_lower(c); });
+
+    return res;
+}
+
+template <typename Map>
+std::vector<uint32_t> const* bucket(Map const& map, std::string const& key)
+{
+    auto iter = map.find(key);
+
+    return (iter != std::end(map)) ? &iter->second : nullptr;
+}
+
+}
+
+
+mask_matcher::mask_matcher()
+    : _nick_first(256)
+{
+}
+
+mask_matcher::mask_matcher(list_mode const& list)
+    : mask_matcher{}
+{
+    _masks.reserve(list.size());
+    _compiled.reserve(list.size());
+
+    for (list_entry const& e : list) {
+        add(e.mask);
+    }
+}
+
+
+std::size_t mask_matcher::add(std::string const& mask)
+{
+    uint32_t idx = static_cast<uint32_t>(_masks.size());
+
+    _masks.push_back(mask);
+
+    std::string glob = rfc1459_lower(mask);
+    std::size_t literals = static_cast<std::size_t>(
+        std::count_if(std::begin(glob), std::end(glob),
+            [] (char c) { return c != '*'; }));
+
+    _compiled.push_back(compiled{glob, literals});
+
+    if (is_extban(mask)) {
+        _extbans.push_back(idx);
+        return idx;
+    }
+
+    std::size_t bang = glob.find('!');
+    std::size_t at   = (bang != std::string::npos)
+        ? glob.find('@', bang + 1)
+        : std::string::npos;
+
+    if ((at == std::string::npos) or (glob.find('@', at + 1) != std::string::npos)) {
+        _unanchored.push_back(idx);
+        return idx;
+    }
+
+    std::string host = glob.substr(at + 1);
+    std::string suffix = host_suffix(host);
+
+    // The key must not only be literal, it must also start at a label
+    // boundary so that every matching host has the same key.
+    if (is_literal(suffix)) {
+        _host_suffix[suffix].push_back(idx);
+        return idx;
+    }
+
+    std::string prefix = host_prefix(host);
+
+    if (is_literal(prefix)) {
+        _host_prefix[prefix].push_back(idx);
+    } else if ((bang > 0) and not is_wildcard(glob[0])) {
+        _nick_first[static_cast<unsigned char>(glob[0])].push_back(idx);
+    } else {
+        _unanchored.push_back(idx);
+    }
+
+    return idx;
+}
+
+
+std::size_t mask_matcher::size() const
+{
+    return _masks.size();
+}
+
+bool mask_matcher::empty() const
+{
+    return _masks.empty();
+}
+
+std::string const& mask_matcher::mask(std::size_t i) const
+{
+    return _masks[i];
+}
+
+std::vector<std::size_t> const& mask_matcher::extbans() const
+{
+    return _extbans;
+}
+
+
+template <typename F>
+bool mask_matcher::for_candidates(
+    std::string const& nick,
+    std::string const& user,
+    std::string const& host,
+    F&& f) const
+{
+    std::string subject = fold_hostmask(nick, user, host);
+    std::string folded_host = subject.substr(subject.size() - host.size());
+
+    std::vector<uint32_t> const* buckets[] = {
+        bucket(_host_suffix, host_suffix(folded_host)),
+        bucket(_host_prefix, host_prefix(folded_host)),
+        nick.empty() ? nullptr
+            : &_nick_first[static_cast<unsigned char>(subject[0])],
+        &_unanchored
+    };
+
+    for (std::vector<uint32_t> const* b : buckets) {
+        if (not b) {
+            continue;
+        }
+
+        for (uint32_t idx : *b) {
+            compiled const& c = _compiled[idx];
+
+            if ((c.literals <= subject.size()) and match_folded(c.glob, subject)) {
+                if (not f(idx)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+std::vector<std::size_t> mask_matcher::match(
+    std::string const& nick,
+    std::string const& user,
+    std::string const& host) const
+{
+    std::vector<std::size_t> res;
+
+    for_candidates(nick, user, host, [&res] (uint32_t idx) {
+        res.push_back(idx);
+        return true;
+    });
+
+    std::sort(std::begin(res), std::end(res));
+
+    return res;
+}
+
+bool mask_matcher::matches(
+    std::size_t i,
+    std::string const& nick,
+    std::string const& user,
+    std::string const& host) const
+{
+    if (std::binary_search(std::begin(_extbans), std::end(_extbans), i)) {
+        return false;
+    }
+
+    std::string subject = fold_hostmask(nick, user, host);
+    compiled const& c = _compiled[i];
+
+    return (c.literals <= subject.size()) and match_folded(c.glob, subject);
+}
+
+bool mask_matcher::matches_any(
+    std::string const& nick,
+    std::string const& user,
+    std::string const& host) const
+{
+    return not for_candidates(nick, user, host, [] (uint32_t) {
+        return false;
+    });
+}
+
+
+bool mask_matcher::is_extban(std::string const& mask)
+{
+    if (mask.empty()) {
+        return false;
+    }
+
+    if (mask[0] == '$') {
+        return true;
+    }
+
+    // "~q:mask", "R:account" or "account:name". A colon can only appear in
+    // the host part of a real hostmask.
+    std::size_t colon = mask.find_first_of("!@:");
+
+    if ((colon == std::string::npos) or (mask[colon] != ':') or (colon == 0)) {
+        return false;
+    }
+
+    std::size_t start = (mask[0] == '~') ? 1 : 0;
+
+    return std::all_of(
+        std::begin(mask) + start, std::begin(mask) + colon,
+        [] (char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) or (c == '-');
+        });
+}
+
+bool mask_matcher::glob_match(std::string const& glob, std::string const& str)
+{
+    return match_folded(rfc1459_lower(glob), rfc1459_lower(str));
+}
+
+bool mask_matcher::folded_glob_match(
+    std::string const& glob,
+    std::string const& str)
+{
+    return match_glob(glob, str, [] (char c) { return rfc1459_lower(c); });
+}
+
+}
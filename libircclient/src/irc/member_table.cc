@@ -0,0 +1,219 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc/member_table.hh"
+
+#include "irc/channel_user.hh"
+#include "irc/network_user.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace irc {
+
+namespace {
+
+// Keep at most 3/4 of the slots in use, and shrink when below 1/8.
+constexpr std::size_t min_capacity = 4;
+
+bool too_full(std::size_t size, std::size_t capacity)
+{
+    return (size * 4) > (capacity * 3);
+}
+
+bool too_empty(std::size_t size, std::size_t capacity)
+{
+    return (capacity > min_capacity) and ((size * 8) < capacity);
+}
+
+}
+
+std::size_t member_table::size() const
+{
+    return _size;
+}
+
+std::size_t member_table::capacity() const
+{
+    return _slots.size();
+}
+
+bool member_table::empty() const
+{
+    return _size == 0;
+}
+
+
+member_table::iterator member_table::begin()
+{
+    return iterator{&_slots, 0};
+}
+
+member_table::iterator member_table::end()
+{
+    return iterator{&_slots, _slots.size()};
+}
+
+member_table::const_iterator member_table::begin() const
+{
+    return const_iterator{&_slots, 0};
+}
+
+member_table::const_iterator member_table::end() const
+{
+    return const_iterator{&_slots, _slots.size()};
+}
+
+member_table::const_iterator member_table::from(std::size_t pos) const
+{
+    return const_iterator{&_slots, std::min(pos, _slots.size())};
+}
+
+
+channel_user* member_table::find(network_user const& user)
+{
+    if (_slots.empty()) {
+        return nullptr;
+    }
+
+    channel_user& slot = _slots[probe(&user)];
+
+    return slot._user ? &slot : nullptr;
+}
+
+channel_user const* member_table::find(network_user const& user) const
+{
+    return const_cast<member_table*>(this)->find(user);
+}
+
+
+channel_user& member_table::insert(network_user& user)
+{
+    if (channel_user* cu = find(user)) {
+        return *cu;
+    }
+
+    if (_slots.empty() or too_full(_size + 1, _slots.size())) {
+        rehash(_slots.empty() ? min_capacity : _slots.size() * 2);
+    }
+
+    channel_user& slot = _slots[probe(&user)];
+
+    slot = channel_user{user};
+    ++_size;
+
+    return slot;
+}
+
+bool member_table::erase(network_user const& user)
+{
+    if (_slots.empty()) {
+        return false;
+    }
+
+    std::size_t mask = _slots.size() - 1;
+    std::size_t hole = probe(&user);
+
+    if (not _slots[hole]._user) {
+        return false;
+    }
+
+    // Move following entries of the same cluster back into the hole unless
+    // that would put them before their home slot.
+    for (std::size_t next = (hole + 1) & mask;
+            _slots[next]._user;
+            next = (next + 1) & mask) {
+
+        std::size_t h = home(_slots[next]._user);
+
+        if (((next - h) & mask) >= ((next - hole) & mask)) {
+            _slots[hole] = _slots[next];
+            hole = next;
+        }
+    }
+
+    _slots[hole] = channel_user{};
+    --_size;
+
+    if (too_empty(_size, _slots.size())) {
+        rehash(_slots.size() / 2);
+    }
+
+    return true;
+}
+
+void member_table::reserve(std::size_t size)
+{
+    std::size_t capacity = min_capacity;
+
+    while (too_full(size, capacity)) {
+        capacity *= 2;
+    }
+
+    if (capacity > _slots.size()) {
+        rehash(capacity);
+    }
+}
+
+void member_table::clear()
+{
+    _slots.clear();
+    _slots.shrink_to_fit();
+    _size = 0;
+}
+
+
+std::size_t member_table::home(network_user const* user) const
+{
+    // Fibonacci hashing, the low bits of a pointer carry no information.
+    uint64_t h = reinterpret_cast<uintptr_t>(user) * 0x9E3779B97F4A7C15ull;
+
+    return static_cast<std::size_t>(h >> 32) & (_slots.size() - 1);
+}
+
+std::size_t member_table::probe(network_user const* user) const
+{
+    std::size_t mask = _slots.size() - 1;
+    std::size_t slot = home(user);
+
+    while (_slots[slot]._user and (_slots[slot]._user != user)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+void member_table::rehash(std::size_t capacity)
+{
+    std::vector<channel_user> old(capacity);
+
+    std::swap(old, _slots);
+
+    for (channel_user const& cu : old) {
+        if (cu._user) {
+            _slots[probe(cu._user)] = cu;
+        }
+    }
+}
+
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc/mode_batcher.hh"
+
+#include "irc/irc_core.hh"
+#include "irc/irc_except.hh"
+#include "irc/irc_utils.hh"
+#include "irc/environment.hh"
+#include "irc/channel.hh"
+#include "irc/channel_user.hh"
+#include "irc/list_mode.hh"
+
+#include <cstddef>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+#include <utility>
+
+namespace irc {
+
+namespace {
+
+using mode_change = environment::channel_mode_changes::value_type;
+
+bool takes_argument(channel_mode_argument_type type, bool setting)
+{
+    return (type == channel_mode_argument_type::required_user_list)
+        or (type == channel_mode_argument_type::required_user)
+        or (type == channel_mode_argument_type::required)
+        or (setting and
+               (type == channel_mode_argument_type::required_when_setting));
+}
+
+// Modes whose argument identifies what is being changed (a user or a list
+// entry) can be queued once per argument, all others only once per mode.
+bool keyed_by_argument(channel_mode_argument_type type)
+{
+    return (type == channel_mode_argument_type::required_user_list)
+        or (type == channel_mode_argument_type::required_user);
+}
+
+// to_string() ends the argument list at the first argument it has to send as
+// a trailing argument, so only one of those fits in a message (as its last).
+bool needs_trailing(std::string const& argument)
+{
+    return argument.find_first_of(" :") != std::string::npos;
+}
+
+bool is_noop(mode_change const& mc, channel const& chan, environment const& env)
+{
+    bool setting                = std::get<0>(mc);
+    char modefl                 = std::get<1>(mc);
+    std::string const& argument = std::get<2>(mc);
+
+    switch (env.get_mode_argument_type(modefl)) {
+    case channel_mode_argument_type::required_user: {
+        channel_user const* user = chan.lookup_user(argument);
+
+        // Can't change modes of users that aren't there.
+        return not user or (chan.user_has_mode(*user, modefl) == setting);
+    }
+
+    case channel_mode_argument_type::required_user_list: {
+        list_mode const* list = chan.find_list(modefl);
+
+        return (list and list->contains(argument)) == setting;
+    }
+
+    case channel_mode_argument_type::required:
+    case channel_mode_argument_type::required_when_setting:
+        if (setting) {
+            return chan.is_mode_set(modefl)
+               and (chan.get_mode_simple(modefl) == argument);
+        }
+
+        return not chan.is_mode_set(modefl);
+
+    default:
+        return chan.is_mode_set(modefl) == setting;
+    }
+}
+
+message make_mode_message(
+    std::string const& channel,
+    std::vector<mode_change const*> const& batch)
+{
+    message msg{"", command::MODE, {channel, ""}};
+
+    std::string modestr;
+    int sign = -1;
+
+    for (mode_change const* mc : batch) {
+        if (sign != static_cast<int>(std::get<0>(*mc))) {
+            sign = std::get<0>(*mc);
+            modestr.push_back(sign ? '+' : '-');
+        }
+
+        modestr.push_back(std::get<1>(*mc));
+
+        if (not std::get<2>(*mc).empty()) {
+            msg.args.push_back(std::get<2>(*mc));
+        }
+    }
+
+    msg.args[1] = std::move(modestr);
+    return msg;
+}
+
+}
+
+mode_batcher::mode_batcher(std::size_t reserve)
+    : _reserve{reserve}
+{
+}
+
+
+void mode_batcher::queue(
+    std::string const& channel,
+    bool setting,
+    char modefl,
+    std::string argument,
+    environment const& env)
+{
+    if (takes_argument(env.get_mode_argument_type(modefl), setting)) {
+        if (argument.empty()) {
+            throw protocol_error{protocol_error_type::not_enough_arguments,
+                std::string{"mode `"} + (setting ? '+' : '-') + modefl + "'"};
+        }
+    } else {
+        argument.clear();
+    }
+
+    _pending[channel].emplace_back(setting, modefl, std::move(argument));
+}
+
+void mode_batcher::clear()
+{
+    _pending.clear();
+}
+
+void mode_batcher::clear(std::string const& channel)
+{
+    _pending.erase(channel);
+}
+
+
+bool mode_batcher::empty() const
+{
+    return _pending.empty();
+}
+
+std::size_t mode_batcher::pending(std::string const& channel) const
+{
+    auto iter = _pending.find(channel);
+
+    return (iter != std::end(_pending)) ? iter->second.size() : 0;
+}
+
+
+std::vector<message> mode_batcher::flush(environment const& env)
+{
+    std::vector<message> res;
+
+    for (auto const& p : _pending) {
+        compile(p.first, p.second, env, res);
+    }
+
+    _pending.clear();
+    return res;
+}
+
+std::vector<message> mode_batcher::flush(
+    std::string const& channel,
+    environment const& env)
+{
+    std::vector<message> res;
+
+    auto iter = _pending.find(channel);
+
+    if (iter != std::end(_pending)) {
+        compile(iter->first, iter->second, env, res);
+        _pending.erase(iter);
+    }
+
+    return res;
+}
+
+
+void mode_batcher::compile(
+    std::string const& channel,
+    environment::channel_mode_changes const& changes,
+    environment const& env,
+    std::vector<message>& out) const
+{
+    // Walk backwards so the last change queued for any mode (and argument)
+    // wins, e.g. "+o x" followed by "-o x" leaves only "-o x", which is then
+    // dropped below unless x currently is an operator.
+    std::unordered_set<std::string> seen;
+    std::vector<mode_change const*> effective;
+
+    for (auto mc = changes.rbegin(); mc != changes.rend(); ++mc) {
+        char modefl = std::get<1>(*mc);
+
+        std::string key{modefl};
+
+        if (keyed_by_argument(env.get_mode_argument_type(modefl))) {
+            key += rfc1459_lower(std::get<2>(*mc));
+        }
+
+        if (seen.insert(std::move(key)).second) {
+            effective.push_back(&*mc);
+        }
+    }
+
+    std::reverse(std::begin(effective), std::end(effective));
+
+    // Without channel state (not joined), nothing can be known to be a noop.
+    if (irc::channel const* chan = env.lookup_channel(channel)) {
+        effective.erase(
+            std::remove_if(std::begin(effective), std::end(effective),
+                [&] (mode_change const* mc) {
+                    return is_noop(*mc, *chan, env);
+                }),
+            std::end(effective));
+    }
+
+    // "MODE <channel> " plus two sign characters for the mode string.
+    std::size_t const base    = 6 + channel.size() + 2;
+    std::size_t const maxlen  = max_line_length - std::min(
+        _reserve, max_line_length / 2);
+
+    std::size_t const maxargs = env.max_modes();
+
+    std::vector<mode_change const*> sets;
+    std::vector<mode_change const*> unsets;
+    mode_change const* trailing = nullptr;
+
+    std::size_t length = base;
+    std::size_t nargs  = 0;
+
+    auto emit = [&] {
+        if (sets.empty() and unsets.empty() and not trailing) {
+            return;
+        }
+
+        std::vector<mode_change const*> batch;
+
+        batch.reserve(sets.size() + unsets.size() + 1);
+        batch.insert(std::end(batch), std::begin(sets), std::end(sets));
+        batch.insert(std::end(batch), std::begin(unsets), std::end(unsets));
+
+        if (trailing) {
+            batch.push_back(trailing);
+        }
+
+        out.push_back(make_mode_message(channel, batch));
+
+        sets.clear();
+        unsets.clear();
+        trailing = nullptr;
+
+        length = base;
+        nargs  = 0;
+    };
+
+    for (mode_change const* mc : effective) {
+        std::string const& argument = std::get<2>(*mc);
+
+        bool has_arg  = not argument.empty();
+        bool trail    = has_arg and needs_trailing(argument);
+
+        // One character for the mode, a space and an optional ':' for the
+        // argument.
+        std::size_t len = 1 + (has_arg ? argument.size() + 1 : 0) + trail;
+
+        if ((length + len > maxlen)
+                or (has_arg and maxargs and (nargs + 1 > maxargs))
+                or (trail and trailing)) {
+            emit();
+        }
+
+        length += len;
+        nargs  += has_arg;
+
+        if (trail) {
+            trailing = mc;
+        } else if (std::get<0>(*mc)) {
+            sets.push_back(mc);
+        } else {
+            unsets.push_back(mc);
+        }
+    }
+
+    emit();
+}
+
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "irc/netsplit.hh"
+
+#include <cctype>
+
+#include <algorithm>
+
+namespace irc {
+
+namespace {
+
+bool is_server_name(std::string const& reason, std::size_t b, std::size_t e)
+{
+    if ((b == e) or (reason[b] == '.') or (reason[e - 1] == '.')) {
+        return false;
+    }
+
+    bool dotted = false;
+
+    for (std::size_t i = b; i < e; ++i) {
+        unsigned char c = reason[i];
+
+        if (c == '.') {
+            dotted = true;
+        } else if (not std::isalnum(c) and (c != '-') and (c != '_')
+                and (c != '*')) {
+            return false;
+        }
+    }
+
+    return dotted;
+}
+
+std::size_t split_point(std::string const& reason)
+{
+    std::size_t space = reason.find(' ');
+
+    if ((space == std::string::npos)
+            or (reason.find(' ', space + 1) != std::string::npos)
+            or not is_server_name(reason, 0, space)
+            or not is_server_name(reason, space + 1, reason.size())) {
+        return std::string::npos;
+    }
+
+    return space;
+}
+
+}
+
+
+netsplit_tracker::netsplit_tracker(
+    clock::duration settle,
+    clock::duration expiry)
+    : _settle{settle},
+      _expiry{expiry}
+{
+}
+
+
+bool netsplit_tracker::is_split_reason(std::string const& reason)
+{
+    return split_point(reason) != std::string::npos;
+}
+
+
+bool netsplit_tracker::quit(
+    std::string const& prefix,
+    std::string const& reason,
+    std::vector<std::string> channels,
+    clock::time_point now)
+{
+    std::size_t space = split_point(reason);
+
+    if (space == std::string::npos) {
+        return false;
+    }
+
+    split_iterator s = find_split(
+        reason.substr(0, space), reason.substr(space + 1));
+
+    // The servers split again while the users were still coming back.
+    if ((s->burst != netsplit_event::kind::split) and not s->users.empty()) {
+        report(*s, _ready);
+    }
+
+    s->burst = netsplit_event::kind::split;
+    s->users.push_back(netsplit_user{prefix, std::move(channels)});
+    s->last = now;
+
+    _rejoining.erase(prefix);
+
+    auto iter = _missing.find(prefix);
+
+    if (iter != std::end(_missing)) {
+        --iter->second->missing;
+        iter->second = s;
+    } else {
+        _missing.emplace(prefix, s);
+    }
+
+    ++s->missing;
+
+    return true;
+}
+
+
+bool netsplit_tracker::join(
+    std::string const& prefix,
+    std::string const& channel,
+    clock::time_point now)
+{
+    auto rejoining = _rejoining.find(prefix);
+
+    // Users come back to one channel after another.
+    if (rejoining != std::end(_rejoining)) {
+        split& s = *rejoining->second.first;
+
+        s.users[rejoining->second.second].channels.push_back(channel);
+        s.last = now;
+
+        return true;
+    }
+
+    auto missing = _missing.find(prefix);
+
+    if (missing == std::end(_missing)) {
+        return false;
+    }
+
+    split_iterator s = missing->second;
+
+    // The split healed before it was even reported.
+    if ((s->burst != netsplit_event::kind::join) and not s->users.empty()) {
+        report(*s, _ready);
+    }
+
+    s->burst = netsplit_event::kind::join;
+    s->users.push_back(netsplit_user{prefix, {channel}});
+    s->last = now;
+
+    _rejoining.emplace(
+        prefix, std::make_pair(s, s->users.size() - 1));
+
+    _missing.erase(missing);
+    --s->missing;
+
+    return true;
+}
+
+
+bool netsplit_tracker::pending() const
+{
+    return not _ready.empty() or std::any_of(
+        std::begin(_splits), std::end(_splits), [] (split const& s) {
+            return not s.users.empty();
+        });
+}
+
+
+std::vector<netsplit_event> netsplit_tracker::flush(clock::time_point now)
+{
+    std::vector<netsplit_event> res = std::move(_ready);
+    _ready.clear();
+
+    for (auto iter = std::begin(_splits); iter != std::end(_splits); ) {
+        split& s = *iter;
+
+        if (not s.users.empty() and (now - s.last >= _settle)) {
+            report(s, res);
+        }
+
+        bool healed  = s.users.empty() and (s.missing == 0);
+        bool expired = s.users.empty() and (now - s.last >= _expiry);
+
+        if (not healed and not expired) {
+            ++iter;
+            continue;
+        }
+
+        // Whoever did not come back by now quit for real or came back
+        // through another server.
+        if (expired) {
+            for (auto m = std::begin(_missing); m != std::end(_missing); ) {
+                if (m->second == iter) {
+                    m = _missing.erase(m);
+                } else {
+                    ++m;
+                }
+            }
+        }
+
+        iter = _splits.erase(iter);
+    }
+
+    return res;
+}
+
+
+void netsplit_tracker::clear()
+{
+    _splits.clear();
+    _missing.clear();
+    _rejoining.clear();
+    _ready.clear();
+}
+
+
+netsplit_tracker::split_iterator netsplit_tracker::find_split(
+    std::string const& server1,
+    std::string const& server2)
+{
+    // Rarely more than one split going on at a time.
+    auto iter = std::find_if(std::begin(_splits), std::end(_splits),
+        [&] (split const& s) {
+            return rfc1459_equal(s.server1, server1)
+               and rfc1459_equal(s.server2, server2);
+        });
+
+    if (iter != std::end(_splits)) {
+        return iter;
+    }
+
+    _splits.push_back(split{
+        server1, server2, netsplit_event::kind::split, {}, {}, 0});
+
+    return std::prev(std::end(_splits));
+}
+
+
+void netsplit_tracker::report(split& s, std::vector<netsplit_event>& out)
+{
+    if (s.burst == netsplit_event::kind::join) {
+        for (netsplit_user const& u : s.users) {
+            _rejoining.erase(u.prefix);
+        }
+    }
+
+    out.push_back(netsplit_event{
+        s.burst, s.server1, s.server2, std::move(s.users)});
+
+    s.users.clear();
+}
+
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc/network_user.hh"
+
+#include "irc/atom.hh"
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+namespace irc {
+
+network_user::network_user(
+    uint64_t uid,
+    std::string nick,
+    std::string user,
+    std::string host)
+        : _uid{uid},
+          _nick{std::move(nick)},
+          _nick_atom{_nick},
+          _user{std::move(user)},
+          _host{std::move(host)}
+{
+}
+
+
+uint64_t network_user::uid() const
+{
+    return _uid;
+}
+
+std::string network_user::nick() const
+{
+    return _nick;
+}
+
+atom network_user::nick_atom() const
+{
+    return _nick_atom;
+}
+
+std::string network_user::user() const
+{
+    return _user;
+}
+
+std::string network_user::host() const
+{
+    return _host;
+}
+
+std::string network_user::account() const
+{
+    return _account;
+}
+
+
+handle<network_user> network_user::handle() const
+{
+    return _handle;
+}
+
+std::vector<channel*> const& network_user::channels() const
+{
+    return _channels;
+}
+
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libircclient.
+ *
+ * libircclient is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libircclient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libircclient.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "irc/state_journal.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace irc {
+
+namespace {
+
+void put_varint(uint64_t v, std::string& out)
+{
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+
+    out += static_cast<char>(v);
+}
+
+void put_string(std::string const& s, std::string& out)
+{
+    put_varint(s.size(), out);
+    out += s;
+}
+
+}
+
+
+state_journal::state_journal(std::size_t capacity)
+    : _capacity{std::max<std::size_t>(capacity, 1)}
+{
+    _ring.reserve(_capacity);
+}
+
+
+std::size_t state_journal::capacity() const
+{
+    return _capacity;
+}
+
+uint64_t state_journal::first_seq() const
+{
+    return _next_seq - _ring.size();
+}
+
+uint64_t state_journal::next_seq() const
+{
+    return _next_seq;
+}
+
+
+uint64_t state_journal::append(
+    state_delta::kind type,
+    atom channel,
+    uint64_t uid,
+    char mode,
+    std::string arg)
+{
+    state_delta d{
+        _next_seq++, type, atom_ref{channel}, uid, mode, std::move(arg)};
+    std::size_t slot = (d.seq - 1) % _capacity;
+
+    // Fill up first, then keep overwriting the oldest one.
+    if (_ring.size() < _capacity) {
+        _ring.push_back(std::move(d));
+    } else {
+        _ring[slot] = std::move(d);
+    }
+
+    state_delta const& added = _ring[slot];
+
+    for (std::size_t i = 0; i < _listeners.size(); ++i) {
+        _listeners[i].second(added);
+    }
+
+    return added.seq;
+}
+
+
+bool state_journal::read(uint64_t from, std::vector<state_delta>& out) const
+{
+    from = std::max<uint64_t>(from, 1);
+
+    if (from < first_seq()) {
+        return false;
+    }
+
+    for (uint64_t seq = from; seq < _next_seq; ++seq) {
+        out.push_back(_ring[(seq - 1) % _capacity]);
+    }
+
+    return true;
+}
+
+
+std::size_t state_journal::subscribe(uint64_t from, listener fn)
+{
+    from = std::max<uint64_t>(from, 1);
+
+    if (from < first_seq()) {
+        throw std::out_of_range{
+            "journal starts at " + std::to_string(first_seq())
+            + ", requested " + std::to_string(from)};
+    }
+
+    for (uint64_t seq = from; seq < _next_seq; ++seq) {
+        fn(_ring[(seq - 1) % _capacity]);
+    }
+
+    _listeners.emplace_back(_next_listener, std::move(fn));
+
+    return _next_listener++;
+}
+
+void state_journal::unsubscribe(std::size_t id)
+{
+    _listeners.erase(
+        std::remove_if(std::begin(_listeners), std::end(_listeners),
+            [id] (auto const& l) { return l.first == id; }),
+        std::end(_listeners));
+}
+
+
+void state_journal::encode(state_delta const& delta, std::string& out)
+{
+    put_varint(delta.seq, out);
+    out += static_cast<char>(delta.type);
+    put_string(
+        delta.channel ? atom_table::global().folded(delta.channel) : "", out);
+    put_varint(delta.uid, out);
+    out += delta.mode;
+    put_string(delta.arg, out);
+}
+
+}
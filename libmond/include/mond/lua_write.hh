@@ -34,6 +34,9 @@
 #include <functional>
 
 namespace mond {
+
+class reference;
+
 namespace impl {
 
 // Write helpers
@@ -100,6 +103,9 @@ inline int _write(lua_State* l, table)
     return 1;
 }
 
+// Defined along with mond::reference
+inline int _write(lua_State* l, reference const& ref);
+
 template <typename T>
 int _write(lua_State* l, std::vector<T> const& vec)
 {
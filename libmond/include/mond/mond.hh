@@ -22,6 +22,7 @@
 //#define LIBMOND_MOND_HH_INCLUDED
 
 #include "mond/state.hh"
+#include "mond/reference.hh"
 #include "mond/iterator.hh"
 #include "mond/metatable.hh"
 #include "mond/lua_types.hh"
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of libmond.
+ *
+ * libmond is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * libmond is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libmond.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef LIBMOND_REFERENCE_HH_INCLUDED
+#define LIBMOND_REFERENCE_HH_INCLUDED
+
+#include "mond/macros.h"
+#include "mond/lua_types.hh"
+#include "mond/lua_write.hh"
+#include "mond/lua_read.hh"
+
+#include <lua.hpp>
+
+#include <string>
+#include <sstream>
+
+namespace mond {
+
+/*! \brief A Lua value pinned in the registry.
+ *
+ * Pushing a reference is a single lua_rawgeti, however the value was found
+ * in the first place. Useful for functions that are called over and over.
+ *
+ * References unpin their value when destroyed, so they must not outlive
+ * their state.
+ */
+class DLL_PUBLIC reference {
+public:
+    reference() = default;
+
+    // Pins the value on top of the stack, popping it.
+    explicit reference(lua_State* l);
+
+    ~reference();
+
+    reference(reference const&) = delete;
+    reference(reference&& other);
+
+    reference& operator=(reference const&) = delete;
+    reference& operator=(reference&& other);
+
+    bool valid() const;
+    void push() const;
+
+    // Pushes onto another thread (coroutine) of the same state.
+    void push(lua_State* l) const;
+
+    template <typename... Ret, typename... Args>
+    auto call(Args const&... args) const;
+
+private:
+    lua_State* _l = nullptr;
+    int _ref      = LUA_NOREF;
+};
+
+
+namespace impl {
+
+template <>
+struct mapped_type<reference> {
+    using type = reference;
+};
+
+inline int _write(lua_State* l, reference const& ref)
+{
+    ref.push();
+    return 1;
+}
+
+} // namespace impl
+
+
+/*
+ * reference implementation
+ */
+inline reference::reference(lua_State* l)
+    : _l{l},
+      _ref{luaL_ref(l, LUA_REGISTRYINDEX)}
+{
+}
+
+inline reference::~reference()
+{
+    if (_l) {
+        luaL_unref(_l, LUA_REGISTRYINDEX, _ref);
+    }
+}
+
+inline reference::reference(reference&& other)
+    : _l{other._l},
+      _ref{other._ref}
+{
+    other._l   = nullptr;
+    other._ref = LUA_NOREF;
+}
+
+inline reference& reference::operator=(reference&& other)
+{
+    if (this != &other) {
+        if (_l) {
+            luaL_unref(_l, LUA_REGISTRYINDEX, _ref);
+        }
+
+        _l   = other._l;
+        _ref = other._ref;
+
+        other._l   = nullptr;
+        other._ref = LUA_NOREF;
+    }
+
+    return *this;
+}
+
+inline bool reference::valid() const
+{
+    return _l and (_ref != LUA_NOREF) and (_ref != LUA_REFNIL);
+}
+
+inline void reference::push() const
+{
+    push(_l);
+}
+
+inline void reference::push(lua_State* l) const
+{
+    if (not _l) {
+        throw mond::error{"push of an empty reference"};
+    }
+
+    lua_rawgeti(l, LUA_REGISTRYINDEX, _ref);
+}
+
+template <typename... Ret, typename... Args>
+inline auto reference::call(Args const&... args) const
+{
+    int top = lua_gettop(_l);
+
+    push();
+
+    if (lua_type(_l, -1) != LUA_TFUNCTION) {
+        std::ostringstream err;
+        err << "error calling function: "
+            << lua_typename(_l, LUA_TFUNCTION) << " expected, got "
+            << luaL_typename(_l, -1);
+
+        lua_settop(_l, top);
+
+        throw type_mismatch_error{err.str()};
+    }
+
+    write(_l, args...);
+
+    if (lua_pcall(_l, sizeof...(args), sizeof...(Ret), 0) != LUA_OK) {
+        char const* msg = lua_tostring(_l, -1);
+        std::string err = msg ? msg : "(error object is not a string)";
+
+        lua_settop(_l, top);
+
+        throw runtime_error{err};
+    }
+
+    auto res = read<Ret...>(_l);
+
+    lua_settop(_l, top);
+
+    return res;
+}
+
+} // namespace mond
+
+#endif // defined LIBMOND_REFERENCE_HH_INCLUDED
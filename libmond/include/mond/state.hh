@@ -35,6 +35,7 @@
 #include <functional>
 #include <memory>
 #include <sstream>
+#include <cstdio>
 
 namespace mond {
 
@@ -50,6 +51,14 @@ class metatable;
 class DLL_PUBLIC state {
 public:
     state();
+
+    /*! \brief A state allocating through \p alloc.
+     *
+     * \p alloc has to outlive the state. Throws mond::error if the state
+     * can't even be created.
+     */
+    state(lua_Alloc alloc, void* ud);
+
     ~state();
 
     // There isn't really a valid state after moving from a state.
@@ -70,6 +79,9 @@ public:
 
     focus operator[](std::string const& idx);
 
+private:
+    static int panic(lua_State* l);
+
 private:
     lua_State *_l;
 
@@ -156,6 +168,19 @@ inline state::state()
     luaL_openlibs(_l);
 }
 
+inline state::state(lua_Alloc alloc, void* ud)
+    : _l{lua_newstate(alloc, ud)}
+{
+    if (not _l) {
+        throw mond::error{"could not create Lua state"};
+    }
+
+    // What luaL_newstate() would have set
+    lua_atpanic(_l, &state::panic);
+
+    luaL_openlibs(_l);
+}
+
 inline state::~state()
 {
     if (_l) {
@@ -171,6 +196,15 @@ inline bool state::valid() const
     return _l;
 }
 
+inline int state::panic(lua_State* l)
+{
+    std::fprintf(stderr,
+        "PANIC: unprotected error in call to Lua API (%s)\n",
+        lua_tostring(l, -1));
+
+    return 0;
+}
+
 inline void state::load_file(std::string const& name)
 {
     if (luaL_dofile(_l, name.c_str())) {
@@ -57,6 +57,20 @@ function base.script_load()
                 tout, uo)
         }
 
+        local reserved, peak = 0, 0
+
+        for _, ext in pairs(luna.extensions.list()) do
+            local _, r, p = ext:memory_info()
+            reserved, peak = reserved + (r or 0), peak + (p or 0)
+        end
+
+        local mr, ur = hrnums.humanize_binary(reserved, "B")
+        local mp, up = hrnums.humanize_binary(peak, "B")
+
+        table.insert(msgs,
+            ("; Scripts: %.2f %s reserved (%.2f %s peak)"):format(
+                mr, ur, mp, up))
+
         who:respond(table.concat(msgs))
     end)
 
@@ -1,5 +1,3 @@
-local base64 = require "base64"
-
 --[[
 -- Trigger helpers
 --]]
@@ -64,34 +62,21 @@ end
 --[[
 -- Filter helpers
 --]]
-local function filter_in_key(channel)
-    return string.format("luna.channel.%s.filter_in", channel:lower())
-end
-
-local function filter_out_key(channel)
-    return string.format("luna.channel.%s.filter_out", channel:lower())
-end
-
-
 function luna.set_channel_incoming_filter(channel, fun)
-    luna.shared[filter_in_key(channel)] =
-        fun and base64.encode(string.dump(fun)) or nil
+    luna.filters.set(channel, "in", fun)
 end
 
 function luna.channel_incoming_filter(channel)
-    return luna.shared[filter_in_key(channel)]
-       and loadstring(base64.decode(luna.shared[filter_in_key(channel)]))
+    return luna.filters.get(channel, "in")
 end
 
 
 function luna.set_channel_outgoing_filter(channel, fun)
-    luna.shared[filter_out_key(channel)] =
-        fun and base64.encode(string.dump(fun)) or nil
+    luna.filters.set(channel, "out", fun)
 end
 
 function luna.channel_outgoing_filter(channel)
-    return luna.shared[filter_out_key(channel)]
-       and loadstring(base64.decode(luna.shared[filter_out_key(channel)]))
+    return luna.filters.get(channel, "out")
 end
 
 --[[
@@ -130,6 +115,22 @@ function channel_meta_aux:respond_ctcp(ctcp, arg, lvl)
 end
 
 
+function channel_meta_aux:queue_mode(mode, arg)
+    return luna.modes.queue(self:name(), mode, arg)
+end
+
+function channel_meta_aux:flush_modes()
+    return luna.modes.flush(self:name())
+end
+
+function channel_meta_aux:op(nick)      return self:queue_mode("+o", nick) end
+function channel_meta_aux:deop(nick)    return self:queue_mode("-o", nick) end
+function channel_meta_aux:voice(nick)   return self:queue_mode("+v", nick) end
+function channel_meta_aux:devoice(nick) return self:queue_mode("-v", nick) end
+function channel_meta_aux:ban(mask)     return self:queue_mode("+b", mask) end
+function channel_meta_aux:unban(mask)   return self:queue_mode("-b", mask) end
+
+
 function channel_meta_aux:set_trigger(trigger)
     return luna.set_channel_trigger(self:name(), trigger)
 end
@@ -169,3 +170,97 @@ function channel_meta_aux:outgoing_filter(fun)
     return luna.channel_outgoing_filter(self:name())
 end
 
+
+function channel_meta_aux:each_user()
+    local cursor = 0
+
+    return function()
+        local user
+        cursor, user = self:next_user(cursor)
+
+        return user
+    end
+end
+
+
+-- Views by lower case channel name, each remembering the generation it was
+-- built from. Those of channels we left are dropped once another channel
+-- gets views, so there are never more than of the channels we are in and
+-- those left since.
+local cached_views = {}
+
+local function drop_left_views()
+    for key in pairs(cached_views) do
+        if not luna.channels.find(key) then
+            cached_views[key] = nil
+        end
+    end
+end
+
+local function cached_view(chan, kind, generation, build)
+    local key = chan:name():lower()
+    local views = cached_views[key]
+
+    if not views then
+        drop_left_views()
+
+        views = {}
+        cached_views[key] = views
+    end
+
+    local view = views[kind]
+
+    if not view or view.generation ~= generation then
+        view = { generation = generation, data = build(chan) }
+        views[kind] = view
+    end
+
+    return view.data
+end
+
+function channel_meta_aux:users_view()
+    local members = self:generations()
+
+    return cached_view(self, "users", members, self.users)
+end
+
+function channel_meta_aux:modes_view()
+    local _, modes = self:generations()
+
+    return cached_view(self, "modes", modes, self.modes)
+end
+
+function channel_meta_aux:query(filter, page_size)
+    local page, cursor = self:query_page(filter, 0, page_size)
+    local i = 0
+
+    return function()
+        i = i + 1
+
+        if page[i] == nil and cursor then
+            page, cursor = self:query_page(filter, cursor, page_size)
+            i = 1
+        end
+
+        return page[i]
+    end
+end
+
+--[[
+-- Augmented channel list class
+--]]
+local channel_list_aux = {}
+
+setmetatable(luna.channel_list_meta.__index, {
+        __index = channel_list_aux
+    })
+
+
+function channel_list_aux:entries()
+    local i = 0
+
+    return function()
+        i = i + 1
+        return self:get(i)
+    end
+end
@@ -28,11 +28,6 @@ require("luna.signals")
 -- Entry functions from C++
 --]]
 
--- Event handler
-function luna.handle_signal(signal, ...)
-    return luna.dispatch_signal(signal, ...)
-end
-
 -- Script init
 function luna.init_script()
     -- Then initialize script
@@ -3,98 +3,102 @@
 --]]
 local d = require("dumplib")
 
-local __callbacks = {}
-local __current_handler = nil
 local __nextid = 0
 
-local function dupkeys(t)
-    local keys = {}
+local __command_handler = nil
+local __current_command = nil
+local __commands = {}
+local command_handler
 
-    for k, v in pairs(t) do
-        table.insert(keys, k)
-    end
+local __watcher_handler = nil
+local __current_watcher = nil
+local __watchers = {}
+local watcher_handler
 
-    return keys
-end
+-- Handlers live in luna, which calls them in the order they were added and
+-- only tells the script about events it has handlers for.
+local function add_handler(signal, channels, id, fn)
+    luna.handlers.add(signal, id, fn, channels)
 
-function luna.dispatch_signal(signal, ...)
-    local args = {...}
-
-    -- Make a copy of all keys here so we can add and remove signal handlers
-    -- while handling signals.
-    local __callbacks_keys = dupkeys(__callbacks)
-
-    for _, id in ipairs(__callbacks_keys) do
-        local handler = __callbacks[id]
-        __current_handler = handler
-
-        if handler and handler.signal == signal then
-            status, err = xpcall(handler.callback, function(err)
-                log.warn("[CORE]",
-                    debug.traceback(
-                        string.format(
-                            "handler for \"%s\" error: %s", signal, err),
-                        2))
-            end, table.unpack(args))
-        end
+    -- channel_command is only ever raised by the command handler
+    if signal == "channel_command" and not __command_handler then
+        __command_handler =
+            luna.add_signal_handler("channel_message", command_handler)
     end
+
+    return id
 end
 
-function luna.add_signal_handler(signal, id, fn)
-    if not fn then
-        fn = id
+local function unique_id()
+    local id = string.format("__unique_%s_%s",
+            tostring(__nextid),
+            tostring(math.random(999)))
 
-        id = string.format("__unique_%s_%s",
-                tostring(__nextid),
-                tostring(math.random(999)))
+    __nextid = __nextid + 1
 
-        __nextid = __nextid + 1
-    end
+    return id
+end
 
+local function wrap_handler(signal, fn)
     if signal == "channel_message" then
         local wrapped = fn
 
         fn = function(who, where, what, lvl)
-            local ru = who:match_reguser()
-            local ai = luna.shared["luna.auto_ignore"] or false
-
-            if ru and ru:flags():find("i") and ai then
-                return
-            end
-
             local filter = where:incoming_filter()
 
             wrapped(who, where, filter and filter(where, what) or what, lvl)
         end
     end
 
+    return fn
+end
 
-    __callbacks[id] = {
-            signal = signal,
-            callback = fn,
-            id = id
-        }
+function luna.add_signal_handler(signal, id, fn)
+    if not fn then
+        fn = id
+        id = unique_id()
+    end
 
-    return id
+    return add_handler(signal, nil, id, wrap_handler(signal, fn))
+end
+
+function luna.add_channel_signal_handler(signal, channels, id, fn)
+    if not signal:find("^channel_") then
+        error(string.format("%q is not a channel signal", signal), 2)
+    end
+
+    if not fn then
+        fn = id
+        id = unique_id()
+    end
+
+    if type(channels) ~= "table" then
+        channels = { channels }
+    end
+
+    return add_handler(signal, channels, id, wrap_handler(signal, fn))
 end
 
 function luna.current_signal_handler()
-    if __current_handler.id == __command_handler then
+    local id = luna.handlers.current()
+
+    if id ~= nil and id == __command_handler then
         return __current_command
+    elseif id ~= nil and id == __watcher_handler then
+        return __current_watcher
     else
-        return __current_handler.id
+        return id
     end
 end
 
-function luna.remove_signal_handler(tid)
-    for id, _ in pairs(__callbacks) do
-        if id == tid then
-            __callbacks[id] = nil
-            return
-        end
+function luna.remove_signal_handler(id)
+    if __watchers[id] then
+        return luna.remove_message_watcher(id)
     end
 
-    error(string.format("no signal handler with id %q found", tid), 2)
+    if not luna.handlers.remove(id) then
+        error(string.format("no signal handler with id %q found", id), 2)
+    end
 end
 
 
@@ -103,69 +107,31 @@ end
 --
 -- TODO: private command?
 --]]
-local __command_handler = nil
-local __current_command = nil
-local __commands = {}
-
-local function command_handler(who, where, what)
-    local triggers = {
-        where:trigger(),                               -- !command
-        luna.own_nick():literalpattern() .. "[:,]?%s*" -- mynick: command
-    }
-
-    local disabled = where:disabled_contexts()
-
-    for _, ctx in ipairs(luna.command_contexts()) do
-        for i, dis in ipairs(disabled) do
-            if dis:lower() == ctx.name:lower() then
-                goto continue
-            end
-        end
-
-        local trigger = ctx.trigger:template{
-            trigger = where:trigger(),
-            own_nick = luna.own_nick():literalpattern():icasepattern()
-        }
-
-        -- To allow per-channel or global disabling of non-highlight trigger
-        if not (#trigger > 0) then
-            goto continue
-        end
-
-        local a, b, rcmd, args = what:find("^" .. trigger .. "([^%s]+)%s*(.*)")
-
-        if a then
-            -- TODO: not this
-            luna.__response_template = ctx.response
-
-            luna.dispatch_signal("channel_command", who, where, rcmd, args)
-
-            for _, cmd in ipairs(dupkeys(__commands)) do
-                __current_command = cmd
+function command_handler(who, where, what)
+    -- Contexts are kept compiled natively until a shared variable changes
+    if luna.commands.stale() then
+        luna.commands.set_contexts(luna.command_contexts())
+    end
 
-                local cmdopts = __commands[cmd]
+    local response, rcmd, args, cmd, cmdargs =
+        luna.commands.route(where:name(), what)
 
-                if cmdopts and cmd:lower() == rcmd:lower() then
-                    if cmdopts.argtype == "*w" then
-                        args = args:split(" ")
-                    elseif cmdopts.argtype == "*s" then
-                        args = args:shlex()
-                    end
+    if not response then
+        return
+    end
 
-                    cmdopts.func(who, where, cmd, args)
-                end
-            end
+    -- TODO: not this
+    luna.__response_template = response
 
-            break
+    luna.dispatch_signal("channel_command", who, where, rcmd, args)
 
-        end
+    if cmd and __commands[cmd] then
+        __current_command = cmd
 
-        ::continue::
+        __commands[cmd](who, where, cmd, cmdargs)
     end
 end
 
-__command_handler = luna.add_signal_handler("channel_message", command_handler)
-
 function luna.add_command_context(name, trigger, response)
     local cur = luna.command_contexts()
 
@@ -223,10 +189,14 @@ function luna.add_command(command, argtype, fn)
         argtype = "*s"
     end
 
-    __commands[command] = {
-            argtype = argtype,
-            func    = fn
-        }
+    -- Commands are looked up case insensitively, so this might replace one
+    local replaced = luna.commands.add(command, argtype)
+
+    if replaced then
+        __commands[replaced] = nil
+    end
+
+    __commands[command] = fn
 
     if not __command_handler then
         __command_handler =
@@ -235,6 +205,7 @@ function luna.add_command(command, argtype, fn)
 end
 
 function luna.remove_command(command)
+    luna.commands.remove(command)
     __commands[command] = nil
 end
 
@@ -282,14 +253,80 @@ end
 --[[
 -- Message and IRC command watchers
 --]]
-function luna.add_message_watcher(pattern, fn)
-    return luna.add_signal_handler("channel_message", function(who, where, what)
-        local matches = {what:find(pattern)}
 
-        if matches[1] and matches[2] then
-            fn(who, where, what, table.unpack(matches))
+-- Set once for every watcher, the failing one is __current_watcher
+local function watcher_error(err)
+    log.warn("[CORE]",
+        debug.traceback(
+            string.format(
+                "message watcher %q error: %s", __current_watcher, err),
+            2))
+end
+
+-- Hands what string.find() returned on to the watcher if it matched,
+-- without collecting it into a table first
+local function run_watcher(id, watcher, who, where, what, first, last, ...)
+    if first and last then
+        luna.watchers.hit(id)
+        __current_watcher = id
+
+        xpcall(watcher.fn, watcher_error, who, where, what, first, last, ...)
+
+        __current_watcher = nil
+    end
+end
+
+-- Luna scans each message once for all watchers, only the ones that may
+-- match are tried here.
+function watcher_handler(who, where, what)
+    for _, id in ipairs(luna.watchers.candidates(what)) do
+        local watcher = __watchers[id]
+
+        -- Might have been removed by a previous one
+        if watcher then
+            run_watcher(id, watcher, who, where, what,
+                what:find(watcher.pattern, 1, watcher.plain))
         end
-    end)
+    end
+end
+
+function luna.add_message_watcher(pattern, fn, plain)
+    local id = unique_id()
+
+    __watchers[id] = {
+        pattern = pattern,
+        plain   = plain or false,
+        fn      = fn
+    }
+
+    luna.watchers.add(id, pattern, plain or false)
+
+    if not __watcher_handler then
+        __watcher_handler =
+            luna.add_signal_handler("channel_message", watcher_handler)
+    end
+
+    return id
+end
+
+function luna.remove_message_watcher(id)
+    if not __watchers[id] then
+        error(string.format("no message watcher with id %q found", id), 2)
+    end
+
+    __watchers[id] = nil
+    luna.watchers.remove(id)
+
+    -- Without watchers, messages need not reach this script for them
+    if next(__watchers) == nil and __watcher_handler then
+        luna.handlers.remove(__watcher_handler)
+        __watcher_handler = nil
+    end
+end
+
+-- Candidates, confirmed matches and patterns by watcher id
+function luna.message_watcher_stats()
+    return luna.watchers.list()
 end
 
 function luna.add_command_watcher(cmd, fn)
@@ -302,9 +339,13 @@ end
 
 
 function luna.remove_current_handler()
-    if __current_handler.id == __command_handler then
+    local id = luna.handlers.current()
+
+    if id ~= nil and id == __command_handler then
         luna.remove_command(__current_command)
+    elseif id ~= nil and id == __watcher_handler then
+        luna.remove_message_watcher(__current_watcher)
     else
-        luna.remove_signal_handler(__current_handler.id)
+        luna.remove_signal_handler(id)
     end
 end
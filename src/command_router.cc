@@ -0,0 +1,608 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "command_router.hh"
+
+#include "luna_extension.hh"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <cctype>
+#include <cstdlib>
+
+
+namespace {
+
+using charset = std::bitset<256>;
+
+bool is_space(char c)
+{
+    return std::isspace(static_cast<unsigned char>(c));
+}
+
+// Characters of the class `%c', like Lua's match_class
+charset class_chars(char c)
+{
+    int (*pred)(int) = nullptr;
+
+    switch (std::tolower(static_cast<unsigned char>(c))) {
+    case 'a': pred = std::isalpha;  break;
+    case 'c': pred = std::iscntrl;  break;
+    case 'd': pred = std::isdigit;  break;
+    case 'g': pred = std::isgraph;  break;
+    case 'l': pred = std::islower;  break;
+    case 'p': pred = std::ispunct;  break;
+    case 's': pred = std::isspace;  break;
+    case 'u': pred = std::isupper;  break;
+    case 'w': pred = std::isalnum;  break;
+    case 'x': pred = std::isxdigit; break;
+    }
+
+    charset chars;
+
+    if (not pred) {
+        if (std::isalnum(static_cast<unsigned char>(c))) {
+            // %b, %f and back references
+            throw std::invalid_argument{
+                std::string{"unsupported pattern item `%"} + c + "'"};
+        }
+
+        chars.set(static_cast<unsigned char>(c));
+        return chars;
+    }
+
+    for (int i = 0; i < 256; ++i) {
+        chars[i] = pred(i) != 0;
+    }
+
+    return std::isupper(static_cast<unsigned char>(c)) ? ~chars : chars;
+}
+
+// `[...]' starting at `p', leaving `p' past the closing bracket
+charset set_chars(std::string const& pat, std::size_t& p)
+{
+    charset chars;
+    bool negate = false;
+
+    if ((++p < pat.size()) and (pat[p] == '^')) {
+        negate = true;
+        ++p;
+    }
+
+    // A `]' right at the start is part of the set
+    bool first = true;
+
+    while (p < pat.size() and (first or pat[p] != ']')) {
+        first = false;
+
+        if (pat[p] == '%') {
+            if (++p == pat.size()) {
+                break;
+            }
+
+            chars |= class_chars(pat[p++]);
+        } else if ((p + 2 < pat.size())
+                   and (pat[p + 1] == '-') and (pat[p + 2] != ']')) {
+            for (int c = static_cast<unsigned char>(pat[p]);
+                     c <= static_cast<unsigned char>(pat[p + 2]);
+                   ++c) {
+                chars.set(c);
+            }
+
+            p += 3;
+        } else {
+            chars.set(static_cast<unsigned char>(pat[p++]));
+        }
+    }
+
+    if (p >= pat.size()) {
+        throw std::invalid_argument{"malformed pattern (missing `]')"};
+    }
+
+    ++p;
+
+    return negate ? ~chars : chars;
+}
+
+// What string:literalpattern():icasepattern() makes of a nick
+std::string icase_literal(std::string const& s)
+{
+    std::string pat;
+
+    for (char c : s) {
+        unsigned char uc = static_cast<unsigned char>(c);
+
+        if (std::isalnum(uc)) {
+            pat += '[';
+            pat += static_cast<char>(std::tolower(uc));
+            pat += static_cast<char>(std::toupper(uc));
+            pat += ']';
+        } else if (std::isspace(uc)) {
+            pat += c;
+        } else {
+            pat += '%';
+            pat += c;
+        }
+    }
+
+    return pat;
+}
+
+std::string trim(std::string const& s)
+{
+    std::size_t a = 0, b = s.size();
+
+    while ((a < b) and is_space(s[a])) {
+        ++a;
+    }
+
+    while ((b > a) and is_space(s[b - 1])) {
+        --b;
+    }
+
+    return s.substr(a, b - a);
+}
+
+std::string const* shared_var(std::string const& key)
+{
+    auto it = luna_extension::shared_vars.find(key);
+
+    return it != std::end(luna_extension::shared_vars)
+        ? &it->second
+        : nullptr;
+}
+
+// string:template for the keys contexts can use, see util.lua
+std::string expand_trigger(
+    std::string const& tmpl,
+    std::string const* trigger,
+    std::string const& own_nick)
+{
+    std::string out;
+
+    auto replacement = [&] (std::string key) {
+        std::string const* rep = nullptr;
+        std::string fallback = "(?)";
+
+        std::size_t slash = key.find('/');
+
+        if (slash != std::string::npos) {
+            fallback = key.substr(slash + 1);
+            key.erase(slash);
+        }
+
+        if (key.compare(0, 4, "env:") == 0) {
+            if (char const* env = std::getenv(trim(key.substr(4)).c_str())) {
+                return std::string{env};
+            }
+        } else if (key.compare(0, 4, "var:") == 0) {
+            rep = shared_var(trim(key.substr(4)));
+        } else if (key == "trigger") {
+            rep = trigger;
+        } else if (key == "own_nick") {
+            return icase_literal(own_nick);
+        } else {
+            throw std::invalid_argument{
+                "unsupported replacement `${" + key + "}'"};
+        }
+
+        return rep ? *rep : fallback;
+    };
+
+    // Where `${...}' at `i' ends, or npos
+    auto closing = [&] (std::size_t i) {
+        if ((i + 1 >= tmpl.size()) or tmpl[i] != '$' or tmpl[i + 1] != '{') {
+            return std::string::npos;
+        }
+
+        int depth = 0;
+
+        for (std::size_t j = i + 1; j < tmpl.size(); ++j) {
+            if (tmpl[j] == '{') {
+                ++depth;
+            } else if ((tmpl[j] == '}') and (--depth == 0)) {
+                return j;
+            }
+        }
+
+        return std::string::npos;
+    };
+
+    std::size_t i = 0;
+
+    while (i < tmpl.size()) {
+        std::size_t m = i + 1, end = closing(m);
+
+        if (end == std::string::npos) {
+            m = i;
+            end = closing(m);
+        }
+
+        if (end == std::string::npos) {
+            out += tmpl[i++];
+            continue;
+        }
+
+        std::string prefix = tmpl.substr(i, m - i);
+
+        if (prefix == "$") {
+            // Escaped as $${...}
+            out += tmpl.substr(m, end + 1 - m);
+        } else {
+            out += prefix;
+            out += replacement(tmpl.substr(m + 2, end - m - 2));
+        }
+
+        i = end + 1;
+    }
+
+    return out;
+}
+
+} // namespace
+
+
+trigger_pattern::trigger_pattern(std::string const& pat)
+{
+    std::size_t p = 0;
+
+    while (p < pat.size()) {
+        item it;
+
+        switch (pat[p]) {
+        case '(':
+        case ')':
+            throw std::invalid_argument{"captures are not supported"};
+
+        case '.':
+            it.chars.set();
+            ++p;
+            break;
+
+        case '%':
+            if (++p == pat.size()) {
+                throw std::invalid_argument{
+                    "malformed pattern (ends with `%')"};
+            }
+
+            it.chars = class_chars(pat[p++]);
+            break;
+
+        case '[':
+            it.chars = set_chars(pat, p);
+            break;
+
+        default:
+            it.chars.set(static_cast<unsigned char>(pat[p++]));
+        }
+
+        it.quantifier = 0;
+
+        if ((p < pat.size()) and (pat[p] == '*' or pat[p] == '+'
+                                  or pat[p] == '-' or pat[p] == '?')) {
+            it.quantifier = pat[p++];
+        }
+
+        _items.push_back(it);
+    }
+}
+
+std::size_t trigger_pattern::match(std::string const& s) const
+{
+    return match(s, 0, 0);
+}
+
+// Backtracks in the same order as Lua's matcher, so the same trigger ends in
+// the same place.
+std::size_t trigger_pattern::match(
+    std::string const& s,
+    std::size_t pos,
+    std::size_t it) const
+{
+    auto accepts = [&] (item const& i, std::size_t at) {
+        return (at < s.size()) and i.chars[static_cast<unsigned char>(s[at])];
+    };
+
+    for (; it < _items.size(); ++it) {
+        item const& i = _items[it];
+
+        switch (i.quantifier) {
+        case '?':
+            if (accepts(i, pos)) {
+                std::size_t end = match(s, pos + 1, it + 1);
+
+                if (end != std::string::npos) {
+                    return end;
+                }
+            }
+
+            continue;
+
+        case '*':
+        case '+': {
+            std::size_t n = 0;
+
+            while (accepts(i, pos + n)) {
+                ++n;
+            }
+
+            std::size_t min = (i.quantifier == '+') ? 1 : 0;
+
+            for (std::size_t k = n + 1; k-- > min;) {
+                std::size_t end = match(s, pos + k, it + 1);
+
+                if (end != std::string::npos) {
+                    return end;
+                }
+            }
+
+            return std::string::npos;
+        }
+
+        case '-':
+            for (std::size_t k = pos;; ++k) {
+                std::size_t end = match(s, k, it + 1);
+
+                if (end != std::string::npos) {
+                    return end;
+                }
+
+                if (not accepts(i, k)) {
+                    return std::string::npos;
+                }
+            }
+
+        default:
+            if (not accepts(i, pos)) {
+                return std::string::npos;
+            }
+
+            ++pos;
+        }
+    }
+
+    // "([^%s]+)" has to follow
+    if ((pos < s.size()) and not is_space(s[pos])) {
+        return pos;
+    }
+
+    return std::string::npos;
+}
+
+
+bool command_router::stale() const
+{
+    return _contexts_version != luna_extension::shared_vars_version;
+}
+
+std::vector<std::string> command_router::set_contexts(
+    std::vector<context> contexts)
+{
+    std::vector<std::string> errors;
+
+    for (context const& ctx : contexts) {
+        try {
+            std::string trigger = "!";
+
+            trigger_pattern{expand_trigger(ctx.trigger, &trigger, "luna")};
+        } catch (std::invalid_argument const& e) {
+            errors.push_back("context `" + ctx.name + "': " + e.what());
+        }
+    }
+
+    _contexts = std::move(contexts);
+    _contexts_version = luna_extension::shared_vars_version;
+
+    _channels.clear();
+
+    return errors;
+}
+
+std::string command_router::add_command(std::string const& name, argtype type)
+{
+    command& cmd = _commands[name];
+    std::string replaced = std::move(cmd.name);
+
+    cmd.name = name;
+    cmd.type = type;
+
+    return replaced;
+}
+
+bool command_router::remove_command(std::string const& name)
+{
+    return _commands.erase(name) != 0;
+}
+
+command_router::channel_triggers const& command_router::triggers_of(
+    std::string const& channel,
+    std::string const& own_nick)
+{
+    channel_triggers& ct = _channels[channel];
+
+    if ((ct.version == luna_extension::shared_vars_version)
+            and (ct.own_nick == own_nick)) {
+        return ct;
+    }
+
+    ct.version = luna_extension::shared_vars_version;
+    ct.own_nick = own_nick;
+    ct.triggers.clear();
+
+    std::string prefix = "luna.channel." + irc::rfc1459_lower(channel);
+
+    std::string const* trigger = shared_var(prefix + ".trigger");
+
+    if (not trigger) {
+        trigger = shared_var("luna.trigger");
+    }
+
+    std::vector<std::string> disabled;
+
+    // Separated by `;'
+    if (std::string const* dis = shared_var(prefix + ".disabled_ctx")) {
+        std::size_t start = 0;
+
+        while (start < dis->size()) {
+            std::size_t end = dis->find(';', start);
+
+            if (end == std::string::npos) {
+                end = dis->size();
+            }
+
+            if (end > start) {
+                disabled.push_back(
+                    irc::rfc1459_lower(dis->substr(start, end - start)));
+            }
+
+            start = end + 1;
+        }
+    }
+
+    for (std::size_t i = 0; i < _contexts.size(); ++i) {
+        if (std::find(std::begin(disabled), std::end(disabled),
+                irc::rfc1459_lower(_contexts[i].name)) != std::end(disabled)) {
+            continue;
+        }
+
+        try {
+            std::string pat = expand_trigger(
+                _contexts[i].trigger, trigger, own_nick);
+
+            // Allows disabling the non-highlight trigger per channel
+            if (not pat.empty()) {
+                ct.triggers.emplace_back(i, trigger_pattern{pat});
+            }
+        } catch (std::invalid_argument const&) {
+            ;
+        }
+    }
+
+    return ct;
+}
+
+bool command_router::route(
+    std::string const& channel,
+    std::string const& own_nick,
+    std::string const& message,
+    match& result)
+{
+    for (auto const& trigger : triggers_of(channel, own_nick).triggers) {
+        std::size_t start = trigger.second.match(message);
+
+        if (start == std::string::npos) {
+            continue;
+        }
+
+        std::size_t end = start;
+
+        while ((end < message.size()) and not is_space(message[end])) {
+            ++end;
+        }
+
+        std::size_t args = end;
+
+        while ((args < message.size()) and is_space(message[args])) {
+            ++args;
+        }
+
+        result.ctx  = &_contexts[trigger.first];
+        result.name = message.substr(start, end - start);
+        result.args = message.substr(args);
+
+        auto cmd = _commands.find(result.name);
+
+        result.cmd = (cmd != std::end(_commands)) ? &cmd->second : nullptr;
+
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<std::string> command_router::split_words(std::string const& args)
+{
+    std::vector<std::string> words;
+    std::size_t start = 0;
+
+    while (start < args.size()) {
+        std::size_t end = args.find(' ', start);
+
+        if (end == std::string::npos) {
+            end = args.size();
+        }
+
+        if (end > start) {
+            words.push_back(args.substr(start, end - start));
+        }
+
+        start = end + 1;
+    }
+
+    return words;
+}
+
+// Same as string:shlex in util.lua, quirks included
+std::vector<std::string> command_router::split_shell(std::string const& args)
+{
+    std::vector<std::string> res;
+    std::string buf;
+    bool in_string = false;
+
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        char c = args[i];
+        bool next_space = (i + 1 < args.size()) and is_space(args[i + 1]);
+
+        if (c == '"' and not in_string) {
+            in_string = true;
+        } else if (c == '"') {
+            // "hello"" world" -> "hello world"
+            if (next_space) {
+                in_string = false;
+
+                res.push_back(std::move(buf));
+                buf.clear();
+            } else {
+                ++i;
+            }
+        } else if (c == '\\') {
+            if (next_space or ((i + 1 < args.size()) and args[i + 1] == '"')) {
+                buf += args[i + 1];
+            }
+
+            ++i;
+        } else if (is_space(c) and not in_string) {
+            if (not buf.empty()) {
+                res.push_back(std::move(buf));
+                buf.clear();
+            }
+        } else {
+            buf += c;
+        }
+    }
+
+    if (not buf.empty()) {
+        res.push_back(std::move(buf));
+    }
+
+    return res;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_COMMAND_ROUTER_HH_INCLUDED
+#define LUNA_COMMAND_ROUTER_HH_INCLUDED
+
+#include <irc/irc_utils.hh>
+
+#include <bitset>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*! \brief A Lua pattern compiled for matching command triggers.
+ *
+ * Only what triggers need is supported: single characters, `.`, `%`
+ * classes, sets and the `*`, `+`, `-` and `?` quantifiers. Like the trigger
+ * in `"^" .. trigger`, the pattern is anchored at the start and `^` and `$`
+ * are plain characters.
+ */
+class trigger_pattern {
+public:
+    trigger_pattern() = default;
+
+    //! Throws std::invalid_argument for captures and other unsupported items.
+    explicit trigger_pattern(std::string const& pattern);
+
+    /*! \brief Matches the start of \p s, followed by a command.
+     *
+     * \return Where the match ends, i.e. the start of the command (the next
+     *         non-space character), or std::string::npos.
+     */
+    std::size_t match(std::string const& s) const;
+
+private:
+    struct item {
+        std::bitset<256> chars;
+        char quantifier;
+    };
+
+    std::size_t match(
+        std::string const& s,
+        std::size_t pos,
+        std::size_t it) const;
+
+private:
+    std::vector<item> _items;
+};
+
+
+/*! \brief Finds commands in channel messages.
+ *
+ * Command contexts ("simple", "hilight_simple", ...) put a trigger in front
+ * of commands, as a Lua pattern template that refers to `${trigger}` and
+ * `${own_nick}`. The router expands and compiles the contexts of a channel
+ * when it first sees a message there, and only does so again when a shared
+ * variable or the own nick changed.
+ */
+class command_router {
+public:
+    enum class argtype {
+        line,  //!< `*l`: the arguments as they were
+        words, //!< `*w`: split at spaces
+        shell  //!< `*s`: split like a shell would, honoring quotes
+    };
+
+    struct context {
+        std::string name;
+        std::string trigger;
+        std::string response;
+    };
+
+    struct command {
+        std::string name;
+        argtype type;
+    };
+
+    struct match {
+        context const* ctx;
+
+        // As written in the message
+        std::string name;
+        std::string args;
+
+        // nullptr if no command by that name was added
+        command const* cmd;
+    };
+
+    //! Whether the contexts have to be set again, see set_contexts().
+    bool stale() const;
+
+    /*! \brief Replaces the command contexts.
+     *
+     * \return Why contexts can not be used, if any. Contexts that only fail
+     *         to compile with a channel's trigger are skipped in the channel.
+     */
+    std::vector<std::string> set_contexts(std::vector<context> contexts);
+
+    /*! \brief Adds a command, replacing one with the same (case folded) name.
+     *
+     * \return The name of the replaced command, or an empty string.
+     */
+    std::string add_command(std::string const& name, argtype type);
+
+    bool remove_command(std::string const& name);
+
+    /*! \brief Looks for a command in a message to \p channel.
+     *
+     * The first context not disabled in the channel whose trigger matches the
+     * start of the message wins.
+     */
+    bool route(
+        std::string const& channel,
+        std::string const& own_nick,
+        std::string const& message,
+        match& result);
+
+    static std::vector<std::string> split_words(std::string const& args);
+    static std::vector<std::string> split_shell(std::string const& args);
+
+private:
+    struct channel_triggers {
+        std::uint64_t version = UINT64_MAX;
+        std::string own_nick;
+
+        // By index into _contexts
+        std::vector<std::pair<std::size_t, trigger_pattern>> triggers;
+    };
+
+    channel_triggers const& triggers_of(
+        std::string const& channel,
+        std::string const& own_nick);
+
+private:
+    std::vector<context> _contexts;
+    std::uint64_t _contexts_version = UINT64_MAX;
+
+    irc::unordered_rfc1459_map<std::string, command> _commands;
+    irc::unordered_rfc1459_map<std::string, channel_triggers> _channels;
+};
+
+#endif // defined LUNA_COMMAND_ROUTER_HH_INCLUDED
@@ -26,6 +26,14 @@ static constexpr char luna_version[] = "6.2831853";
 
 static constexpr int idle_interval = 125; // milliseconds
 
+static constexpr char const* userdb = "users.db";
+static constexpr char const* varlog = "shared_vars.log";
+static constexpr char const* varsnapshot = "shared_vars.snap";
+
+// How long changed users may wait before they are written
+static constexpr int users_save_delay = 2000; // milliseconds
+
+// Written by older versions, imported if there is nothing else
 static constexpr char const* userfile = "users.txt";
 static constexpr char const* varfile = "shared_vars.txt";
 
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_io.hh"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+
+namespace {
+
+std::array<std::uint32_t, 256> make_crc_table()
+{
+    std::array<std::uint32_t, 256> table;
+
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t c = i;
+
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        }
+
+        table[i] = c;
+    }
+
+    return table;
+}
+
+void close_keeping_errno(int fd)
+{
+    int err = errno;
+    ::close(fd);
+    errno = err;
+}
+
+}
+
+
+std::uint32_t crc32(char const* data, std::size_t size)
+{
+    static std::array<std::uint32_t, 256> const table = make_crc_table();
+
+    std::uint32_t crc = 0xFFFFFFFF;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF]
+            ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+std::runtime_error file_error(std::string const& what, std::string const& path)
+{
+    return std::runtime_error{
+        what + " `" + path + "': " + std::strerror(errno)};
+}
+
+bool write_all(int fd, char const* data, std::size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+void replace_file(std::string const& path, std::string const& data)
+{
+    std::string tmp_path = path + ".tmp";
+
+    int fd = ::open(tmp_path.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        throw file_error("could not create", tmp_path);
+    }
+
+    if (not write_all(fd, data.data(), data.size())
+            or ::fdatasync(fd) < 0) {
+        close_keeping_errno(fd);
+        throw file_error("could not write", tmp_path);
+    }
+
+    ::close(fd);
+
+    if (::rename(tmp_path.c_str(), path.c_str()) < 0) {
+        throw file_error("could not replace", path);
+    }
+
+    std::size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos)
+        ? "." : path.substr(0, slash + 1);
+
+    int dirfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dirfd >= 0) {
+        ::fsync(dirfd);
+        ::close(dirfd);
+    }
+}
+
+
+mapped_file::mapped_file(std::string const& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return;
+        }
+
+        throw file_error("could not open", path);
+    }
+
+    struct stat st;
+
+    if (::fstat(fd, &st) < 0) {
+        close_keeping_errno(fd);
+        throw file_error("could not stat", path);
+    }
+
+    if (st.st_size > 0) {
+        void* p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (p == MAP_FAILED) {
+            close_keeping_errno(fd);
+            throw file_error("could not map", path);
+        }
+
+        _data = static_cast<char const*>(p);
+        _size = st.st_size;
+    }
+
+    ::close(fd);
+    _exists = true;
+}
+
+mapped_file::~mapped_file()
+{
+    if (_data) {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+}
+
+bool mapped_file::exists() const
+{
+    return _exists;
+}
+
+char const* mapped_file::data() const
+{
+    return _data;
+}
+
+std::size_t mapped_file::size() const
+{
+    return _size;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_FILE_IO_HH_INCLUDED
+#define LUNA_FILE_IO_HH_INCLUDED
+
+#include <stdexcept>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Helpers for the binary files state is kept in.
+
+//! CRC-32 (IEEE 802.3) of \p size bytes at \p data.
+std::uint32_t crc32(char const* data, std::size_t size);
+
+// Numbers are stored in host byte order, the files are not meant to travel.
+template <typename T>
+void put_raw(std::string& out, T value)
+{
+    out.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+template <typename T>
+T get_raw(char const* in)
+{
+    T value;
+    std::memcpy(&value, in, sizeof(value));
+
+    return value;
+}
+
+//! What went wrong with \p path, along with strerror(errno).
+std::runtime_error file_error(std::string const& what, std::string const& path);
+
+//! Retries after short writes. Returns false on errors, leaving errno set.
+bool write_all(int fd, char const* data, std::size_t size);
+
+/*! \brief Replaces \p path with \p data, all or nothing.
+ *
+ * The data goes to a temporary file next to \p path first, which is synced,
+ * renamed over \p path, and the rename synced as well. Throws
+ * std::runtime_error on errors.
+ */
+void replace_file(std::string const& path, std::string const& data);
+
+//! A whole file mapped for reading, if it exists.
+class mapped_file {
+public:
+    //! Throws std::runtime_error for errors other than a missing file.
+    explicit mapped_file(std::string const& path);
+    ~mapped_file();
+
+    mapped_file(mapped_file const&)            = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    bool exists() const;
+    char const* data() const;
+    std::size_t size() const;
+
+private:
+    bool _exists = false;
+    char const* _data = nullptr;
+    std::size_t _size = 0;
+};
+
+#endif // defined LUNA_FILE_IO_HH_INCLUDED
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ingress_filter.hh"
+
+#include "luna_user.hh"
+#include "user_index.hh"
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <utility>
+
+
+ingress_filter::ingress_filter(user_index& users)
+    : _users{&users}
+{
+}
+
+ingress_filter::verdict ingress_filter::check(
+    std::string const& prefix,
+    bool honor_ignores)
+{
+    // Nicks are cheap to change, hosts are not
+    std::string host = prefix.substr(prefix.find('@') + 1);
+    clock::time_point now = clock::now();
+
+    if (is_offender(host, now)) {
+        ++_stats.flooding;
+        return verdict::flooding;
+    }
+
+    auto it = _by_host.find(host);
+
+    if (it != std::end(_by_host)) {
+        _sources.splice(std::begin(_sources), _sources, it->second);
+    } else {
+        _sources.emplace_front(host,
+            tokenbucket{_limits.burst, _limits.rate});
+        _by_host.emplace(host, std::begin(_sources));
+
+        if (_sources.size() > _limits.sources) {
+            _by_host.erase(_sources.back().first);
+            _sources.pop_back();
+        }
+    }
+
+    // Matching the registered users is what is expensive here, so it is
+    // left to traffic the buckets let through, plus the one message that
+    // decides whether a host becomes an offender.
+    bool limited = not _sources.front().second.consume(1);
+    luna_user const* u = _users->match(prefix);
+
+    bool exempt = u and (u->flags() & (luna_user::flag_friend
+                                     | luna_user::flag_oper
+                                     | luna_user::flag_owner));
+
+    if (limited and not exempt) {
+        add_offender(host, now);
+
+        ++_stats.offenders;
+        ++_stats.flooding;
+        return verdict::flooding;
+    }
+
+    if (honor_ignores and u and (u->flags() & luna_user::flag_ignore)) {
+        ++_stats.ignored;
+        return verdict::ignored;
+    }
+
+    return verdict::pass;
+}
+
+bool ingress_filter::allow_ctcp_reply()
+{
+    if (_ctcp_replies.consume(1)) {
+        return true;
+    }
+
+    ++_stats.ctcp_suppressed;
+    return false;
+}
+
+ingress_filter::counters const& ingress_filter::stats() const
+{
+    return _stats;
+}
+
+ingress_filter::limits const& ingress_filter::get_limits() const
+{
+    return _limits;
+}
+
+void ingress_filter::set_limits(limits const& lim)
+{
+    _limits = lim;
+}
+
+void ingress_filter::clear()
+{
+    _sources.clear();
+    _by_host.clear();
+    _offenders.clear();
+    _offender_hosts.clear();
+}
+
+bool ingress_filter::is_offender(
+    std::string const& host,
+    clock::time_point now)
+{
+    auto it = _offender_hosts.find(host);
+
+    if (it == std::end(_offender_hosts)) {
+        return false;
+    }
+
+    if (it->second->second <= now) {
+        _offenders.erase(it->second);
+        _offender_hosts.erase(it);
+
+        return false;
+    }
+
+    return true;
+}
+
+void ingress_filter::add_offender(
+    std::string const& host,
+    clock::time_point now)
+{
+    _offenders.emplace_front(host, now + _limits.penalty);
+    _offender_hosts[host] = std::begin(_offenders);
+
+    if (_offenders.size() > _limits.offenders) {
+        _offender_hosts.erase(_offenders.back().first);
+        _offenders.pop_back();
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_INGRESS_FILTER_HH_INCLUDED
+#define LUNA_INGRESS_FILTER_HH_INCLUDED
+
+#include "tokenbucket.hh"
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+class user_index;
+
+/*! \brief Decides which messages from users are worth dispatching at all.
+ *
+ * Messages from ignored users are dropped, as are those of sources that send
+ * faster than a token bucket per host allows. A host that runs its bucket dry
+ * is an offender for a while and dropped entirely, so a flood costs a lookup
+ * per line instead of a trip through every script, or even through the
+ * registered users.
+ *
+ * Buckets are only kept for the most recently seen hosts, and offenders only
+ * for the most recent ones of those, so neither grows with the network.
+ */
+class ingress_filter {
+public:
+    enum class verdict {
+        pass,
+        ignored,
+        flooding
+    };
+
+    struct limits {
+        tokenbucket::num_type burst = 8;  //!< Messages a host may send at once
+        tokenbucket::num_type rate = 1;   //!< Messages per second after that
+        std::chrono::seconds penalty{30}; //!< How long offenders are dropped
+
+        std::size_t sources = 256;   //!< How many hosts to keep buckets for
+        std::size_t offenders = 64;  //!< How many offending hosts to remember
+    };
+
+    struct counters {
+        std::uint64_t ignored = 0;         //!< Messages from ignored users
+        std::uint64_t flooding = 0;        //!< Messages over the rate limit
+        std::uint64_t ctcp_suppressed = 0; //!< CTCP replies not sent
+        std::uint64_t offenders = 0;       //!< Times a host became one
+    };
+
+    explicit ingress_filter(user_index& users);
+
+    /*! \brief Checks a message from \p prefix, a user prefix.
+     *
+     * Friends, operators and owners never make their host an offender, but
+     * are dropped along with everyone else on a host that already is one.
+     *
+     * \param honor_ignores Whether users flagged as ignored are dropped.
+     */
+    verdict check(std::string const& prefix, bool honor_ignores);
+
+    //! Whether another reply to a core CTCP may be sent.
+    bool allow_ctcp_reply();
+
+    counters const& stats() const;
+
+    limits const& get_limits() const;
+
+    //! Takes effect for new hosts, so best set before any message is checked.
+    void set_limits(limits const& lim);
+
+    //! Forgets all hosts, e.g. after a disconnect.
+    void clear();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    bool is_offender(std::string const& host, clock::time_point now);
+    void add_offender(std::string const& host, clock::time_point now);
+
+private:
+    user_index* _users;
+
+    // Most recently used first
+    std::list<std::pair<std::string, tokenbucket>> _sources;
+    std::unordered_map<
+        std::string,
+        std::list<std::pair<std::string, tokenbucket>>::iterator> _by_host;
+
+    std::list<std::pair<std::string, clock::time_point>> _offenders;
+    std::unordered_map<
+        std::string,
+        std::list<std::pair<std::string, clock::time_point>>::iterator>
+            _offender_hosts;
+
+    limits _limits;
+
+    // Replies to VERSION, PING and TIME, shared by everyone asking
+    tokenbucket _ctcp_replies{4, 1};
+
+    counters _stats;
+};
+
+#endif // defined LUNA_INGRESS_FILTER_HH_INCLUDED
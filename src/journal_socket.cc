@@ -0,0 +1,157 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "journal_socket.hh"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace {
+
+std::runtime_error socket_error(std::string const& what, std::string const& path)
+{
+    return std::runtime_error{
+        what + " `" + path + "': " + std::strerror(errno)};
+}
+
+}
+
+
+journal_socket::journal_socket(std::string path)
+    : _path{std::move(path)}
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+
+    if (_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error{"journal socket path too long: " + _path};
+    }
+
+    std::strncpy(addr.sun_path, _path.c_str(), sizeof(addr.sun_path) - 1);
+
+    _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (_fd < 0) {
+        throw socket_error("could not create journal socket", _path);
+    }
+
+    // A leftover socket from a previous run would make bind() fail.
+    ::unlink(_path.c_str());
+
+    if ((::bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+            or (::listen(_fd, 8) < 0)) {
+        auto err = socket_error("could not listen on journal socket", _path);
+        ::close(_fd);
+
+        throw err;
+    }
+}
+
+journal_socket::~journal_socket()
+{
+    for (consumer& c : _consumers) {
+        ::close(c.fd);
+    }
+
+    ::close(_fd);
+    ::unlink(_path.c_str());
+}
+
+
+std::string const& journal_socket::path() const
+{
+    return _path;
+}
+
+std::size_t journal_socket::consumers() const
+{
+    return _consumers.size();
+}
+
+
+void journal_socket::pump(irc::state_journal const& journal)
+{
+    int fd;
+
+    while ((fd = ::accept4(_fd, nullptr, nullptr,
+                SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        _consumers.push_back(consumer{fd, journal.first_seq(), {}});
+    }
+
+    for (consumer& c : _consumers) {
+        _deltas.clear();
+
+        // Gaps can't be made up for, close and let them start over.
+        if (not journal.read(c.next_seq, _deltas)) {
+            ::close(c.fd);
+            c.fd = -1;
+            continue;
+        }
+
+        for (irc::state_delta const& d : _deltas) {
+            irc::state_journal::encode(d, c.backlog);
+        }
+
+        c.next_seq = journal.next_seq();
+
+        if (not flush(c) or (c.backlog.size() > max_backlog)) {
+            ::close(c.fd);
+            c.fd = -1;
+        }
+    }
+
+    _consumers.erase(
+        std::remove_if(std::begin(_consumers), std::end(_consumers),
+            [] (consumer const& c) { return c.fd < 0; }),
+        std::end(_consumers));
+}
+
+
+bool journal_socket::flush(consumer& c)
+{
+    std::size_t sent = 0;
+
+    while (sent < c.backlog.size()) {
+        ssize_t n = ::send(c.fd, c.backlog.data() + sent,
+            c.backlog.size() - sent, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if ((errno == EAGAIN) or (errno == EWOULDBLOCK)) {
+                break;
+            }
+
+            return false;
+        }
+
+        sent += static_cast<std::size_t>(n);
+    }
+
+    c.backlog.erase(0, sent);
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_JOURNAL_SOCKET_HH_INCLUDED
+#define LUNA_JOURNAL_SOCKET_HH_INCLUDED
+
+#include <irc/state_journal.hh>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+/*! \brief Streams the state journal to local consumers over a Unix socket.
+ *
+ * Consumers just connect and read, they get every delta still kept in the
+ * journal followed by new ones as they come in, in the journal's wire format
+ * (see irc::state_journal::encode()). Consumers that fall too far behind to
+ * be caught up from the journal are disconnected, they have to reconnect and
+ * start over.
+ *
+ * Everything is non-blocking and driven by calling pump() regularly.
+ */
+class journal_socket {
+public:
+    //! Maximum number of bytes buffered for a consumer that doesn't keep up
+    static constexpr std::size_t max_backlog = 1 << 20;
+
+    /*! Listens on `path`, replacing whatever socket was there.
+     *
+     * Throws std::runtime_error if that does not work out.
+     */
+    journal_socket(std::string path);
+    ~journal_socket();
+
+    journal_socket(journal_socket const&)            = delete;
+    journal_socket& operator=(journal_socket const&) = delete;
+
+    std::string const& path() const;
+    std::size_t consumers() const;
+
+    //! Accept new consumers and send out whatever is new in the journal.
+    void pump(irc::state_journal const& journal);
+
+private:
+    struct consumer {
+        int fd;
+        uint64_t next_seq;
+        std::string backlog;
+    };
+
+    // Returns false if the consumer is gone.
+    bool flush(consumer& c);
+
+private:
+    std::string _path;
+    int _fd = -1;
+
+    std::vector<consumer> _consumers;
+    std::vector<irc::state_delta> _deltas;
+};
+
+#endif // defined LUNA_JOURNAL_SOCKET_HH_INCLUDED
@@ -32,20 +32,104 @@
 
 #include <mond/mond.hh>
 
+#include <irc/channel.hh>
 #include <irc/irc_core.hh>
 #include <irc/irc_except.hh>
+#include <irc/member_query.hh>
+#include <irc/mode_batcher.hh>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <chrono>
 #include <stdexcept>
 #include <regex>
 
 #include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Names of the signals by luna_script::signal_id, and the events feeding
+// them (see the on_* handlers below).
+struct signal_info {
+    char const* name;
+    std::vector<luna_extension::event> events;
+};
+
+using ev = luna_extension::event;
+
+signal_info const signals[] = {
+    {"connect",               {ev::connect}},
+    {"disconnect",            {ev::disconnect}},
+    {"tick",                  {ev::idle}},
+    {"message_send",          {ev::message_send}},
+    {"raw",                   {ev::message}},
+    {"invite",                {ev::invite}},
+    {"channel_user_sync",     {ev::channel_sync}},
+    {"channel_ban_sync",      {ev::channel_sync}},
+    {"user_join",             {ev::join, ev::message}},
+    {"channel_user_join",     {ev::join, ev::message}},
+    {"user_part",             {ev::part}},
+    {"channel_user_part",     {ev::part}},
+    {"user_quit",             {ev::quit}},
+    {"nick_change",           {ev::nick}},
+    {"channel_user_kick",     {ev::kick}},
+    {"topic_change",          {ev::topic}},
+    {"channel_topic_change",  {ev::topic}},
+    {"message",               {ev::privmsg}},
+    {"channel_message",       {ev::privmsg}},
+    {"notice",                {ev::notice}},
+    {"channel_notice",        {ev::notice}},
+    {"action",                {ev::ctcp_request}},
+    {"channel_action",        {ev::ctcp_request}},
+    {"ctcp_request",          {ev::ctcp_request}},
+    {"channel_ctcp_request",  {ev::ctcp_request}},
+    {"ctcp_response",         {ev::ctcp_response}},
+    {"channel_ctcp_response", {ev::ctcp_response}},
+    {"mode",                  {ev::mode}},
+    {"channel_mode",          {ev::mode}},
+    {"netsplit",              {ev::netsplit}},
+    {"netjoin",               {ev::netjoin}}
+};
+
+static_assert(
+    sizeof(signals) / sizeof(signals[0]) == luna_script::signal_count,
+    "every signal needs a name");
+
+std::vector<luna_extension::event> const& signal_events(
+    std::string const& signal)
+{
+    static std::vector<luna_extension::event> const none;
+
+    for (signal_info const& info : signals) {
+        if (signal == info.name) {
+            return info.events;
+        }
+    }
+
+    return none;
+}
+
+// Message handler for handlers: adds a traceback to their errors
+int signal_traceback(lua_State* l)
+{
+    char const* msg = lua_tostring(l, 1);
+
+    luaL_traceback(l, l, msg ? msg : "(error object is not a string)", 1);
+
+    return 1;
+}
+
+}
+
 
 luna_script::luna_script(luna& context, std::string file)
     : luna_extension{context},
-      _file{std::move(file)}
+      _file{std::move(file)},
+      _alloc{context._script_memory_limit},
+      _lua{&script_allocator::alloc, &_alloc}
 {
     constexpr char const* extra_paths =
         "./scripts/?.lua;"
@@ -76,6 +160,18 @@ luna_script::luna_script(luna& context, std::string file)
         context._logger.level(),
         logging_flags::ANSI};
 
+    for (std::size_t i = 0; i < signal_count; ++i) {
+        _signals[i].signal = signals[i].name;
+    }
+
+    _signals[static_cast<std::size_t>(
+        signal_id::channel_user_sync)].channel_arg = 1;
+    _signals[static_cast<std::size_t>(
+        signal_id::channel_ban_sync)].channel_arg = 1;
+
+    lua_pushcfunction(_lua, signal_traceback);
+    _traceback = mond::reference{_lua};
+
     setup_api();
     _lua.load_library("luna", "luna");
 }
@@ -328,6 +424,11 @@ void luna_script::setup_api()
     register_self();
     register_script();
     register_user();
+
+    register_signals();
+    register_commands();
+    register_watchers();
+    register_filters();
 }
 
 
@@ -351,14 +452,12 @@ void luna_script::register_environment()
 
     _lua[api]["shared"]["save"] = std::function<void ()>{
         [this] {
-            context().save_shared_vars(varfile);
+            context().save_shared_vars();
         }};
 
     _lua[api]["shared"]["reload"] = std::function<void ()>{
         [this] {
-            luna_script::shared_vars.clear();
-
-            context().read_shared_vars(varfile);
+            context().reload_shared_vars();
         }};
 
     _lua[api]["shared"]["get"] = std::function<int (lua_State*)>{
@@ -379,7 +478,7 @@ void luna_script::register_environment()
             std::size_t n;
             char const* val = luaL_checklstring(s, 2, &n);
 
-            shared_vars[key] = std::string{val, n};
+            context().set_shared_var(key, std::string{val, n});
 
             return 0;
         }};
@@ -388,8 +487,7 @@ void luna_script::register_environment()
         [this] (lua_State* s) {
             std::string key = luaL_checkstring(s, 1);
 
-            shared_vars.erase(key);
-            context().save_shared_vars(varfile);
+            context().clear_shared_var(key);
 
             return 0;
         }};
@@ -435,6 +533,52 @@ void luna_script::register_self()
             return 0;
         }};
 
+    _lua[api]["modes"] = mond::table{};
+
+    _lua[api]["modes"]["queue"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            std::string channel = luaL_checkstring(s, 1);
+            std::string mode    = luaL_checkstring(s, 2);
+            std::string arg     = luaL_optstring(s, 3, "");
+
+            if ((mode.size() != 2) or (mode[0] != '+' and mode[0] != '-')) {
+                throw mond::runtime_error{"invalid mode change: " + mode};
+            }
+
+            try {
+                context()._mode_batch.queue(
+                    channel, mode[0] == '+', mode[1], arg,
+                    context().environment());
+            } catch (irc::protocol_error const& pe) {
+                throw mond::runtime_error{pe.what()};
+            }
+
+            return 0;
+        }};
+
+    _lua[api]["modes"]["flush"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            std::vector<irc::message> msgs;
+
+            if (lua_isnoneornil(s, 1)) {
+                msgs = context()._mode_batch.flush(context().environment());
+            } else {
+                msgs = context()._mode_batch.flush(
+                    luaL_checkstring(s, 1), context().environment());
+            }
+
+            for (irc::message const& msg : msgs) {
+                context().send_message(msg);
+            }
+
+            return mond::write(s, msgs.size());
+        }};
+
+    _lua[api]["modes"]["pending"] = std::function<std::size_t (std::string)>{
+        [this] (std::string channel) {
+            return context()._mode_batch.pending(channel);
+        }};
+
     _lua[api]["runtime_info"] =
         std::function<std::tuple<std::time_t, std::time_t> ()>{[this] {
             return std::make_tuple(context()._started, context()._connected);
@@ -468,6 +612,20 @@ void luna_script::register_self()
                     context()._bytes_recvd,
                     context()._bytes_recvd_sess);
             }};
+
+    _lua[api]["ingress_info"] =
+        std::function<
+            std::tuple<
+                std::uint64_t,
+                std::uint64_t,
+                std::uint64_t,
+                std::uint64_t> ()>{
+            [this] {
+                ingress_filter::counters const& c = context()._ingress.stats();
+
+                return std::make_tuple(
+                    c.ignored, c.flooding, c.ctcp_suppressed, c.offenders);
+            }};
 }
 
 namespace {
@@ -498,7 +656,8 @@ void luna_script::register_script()
         << mond::method("name",        &luna_extension_proxy::name)
         << mond::method("description", &luna_extension_proxy::description)
         << mond::method("version",     &luna_extension_proxy::version)
-        << mond::method("is_self",     &luna_extension_proxy::is_self);
+        << mond::method("is_self",     &luna_extension_proxy::is_self)
+        << mond::method("memory_info", &luna_extension_proxy::memory_info);
 
     _lua[api]["extensions"] = mond::table{};
     _lua[api]["extensions"]["self"] = mond::object<luna_extension_proxy>(
@@ -539,6 +698,7 @@ void luna_script::register_script()
 
             context()._exts.push_back(std::move(script));
             context()._exts.back()->init();
+            context().interests_changed();
 
             return mond::write(s,
                 mond::object<luna_extension_proxy>(context(), scr));
@@ -558,6 +718,9 @@ void luna_script::register_script()
                 if (*it and strcaseequal(scr, (*it)->id())) {
                     it->reset();
 
+                    context()._exts_unloaded = true;
+                    context().interests_changed();
+
                     return 0;
                 }
             }
@@ -589,8 +752,7 @@ void luna_script::register_user()
             lua_newtable(s);
 
             for (auto const& u : context().users()) {
-                mond::write(s,
-                    mond::object<luna_user_proxy>(context(), u.id()));
+                mond::write(s, mond::object<luna_user_proxy>(context(), u));
 
                 lua_setfield(s, -2, u.id().c_str());
             }
@@ -600,13 +762,26 @@ void luna_script::register_user()
 
     _lua[api]["users"]["save"] = std::function<void ()>{
         [this] {
-            context().save_users(userfile);
+            context().save_users();
         }};
 
     _lua[api]["users"]["reload"] = std::function<void ()>{
         [this] {
-            context()._users.clear();
-            context().read_users(userfile);
+            // Let a save still being written land before reading it back
+            context()._user_store.flush();
+
+            context().clear_users();
+            context().read_users();
+        }};
+
+    _lua[api]["users"]["import"] = std::function<void (std::string)>{
+        [this] (std::string filename) {
+            context().import_users(filename);
+        }};
+
+    _lua[api]["users"]["export"] = std::function<void (std::string)>{
+        [this] (std::string filename) {
+            context().export_users(filename);
         }};
 
     _lua[api]["users"]["create"] = std::function<int (lua_State*)>{
@@ -616,20 +791,15 @@ void luna_script::register_user()
             std::string flags = luaL_checkstring(s, 3);
             std::string title = luaL_checkstring(s, 4);
 
-            auto i = std::find_if(
-                std::begin(context().users()), std::end(context().users()),
-                [&] (luna_user& u2) {
-                    return irc::rfc1459_equal(u2.id(), id);
-                });
-
-            if (i != std::end(context().users())) {
+            if (context().find_user(id)) {
                 throw mond::runtime_error{"user `" + id + "' already exists"};
             }
 
-            context().users().emplace_back(
-                id, mask, title, flags_from_string(flags));
+            luna_user& user = context().add_user(
+                luna_user{id, mask, title, flags_from_string(flags)});
 
-            return mond::write(s, mond::object<luna_user_proxy>(context(), id));
+            return mond::write(s,
+                mond::object<luna_user_proxy>(context(), user));
         }};
 
 
@@ -637,19 +807,13 @@ void luna_script::register_user()
         [this] (lua_State* s) {
             std::string id = luaL_checkstring(s, 1);
 
-            auto i = std::find_if(
-                std::begin(context().users()),
-                std::end(context().users()),
-                [&] (luna_user& u2) {
-                    return irc::rfc1459_equal(u2.id(), id);
-                });
+            luna_user* user = context().find_user(id);
 
-            if (i == std::end(context().users())) {
+            if (not user) {
                 throw mond::runtime_error{"user `" + id + "' does not exist"};
             }
 
-            context().users().erase(i);
-            context().save_users(userfile);
+            context().remove_user(*user);
 
             return 0;
         }};
@@ -665,23 +829,36 @@ void luna_script::register_channel()
         << mond::method("name",              &luna_channel_proxy::name)
         << mond::method("created",           &luna_channel_proxy::created)
         << mond::method("topic",             &luna_channel_proxy::topic)
+        << mond::method("generations",       &luna_channel_proxy::generations)
         << mond::method("users",             &luna_channel_proxy::users)
+        << mond::method("next_user",         &luna_channel_proxy::next_user)
         << mond::method("find_user",         &luna_channel_proxy::find_user)
-        << mond::method("modes",             &luna_channel_proxy::modes);
+        << mond::method("modes",             &luna_channel_proxy::modes)
+        << mond::method("list",              &luna_channel_proxy::list)
+        << mond::method("match_users",       &luna_channel_proxy::match_users)
+        << mond::method("query_page",        &luna_channel_proxy::query_page);
+
+    _lua[api].new_metatable<luna_channel_list_proxy>()
+        << mond::method("mode",     &luna_channel_list_proxy::mode)
+        << mond::method("size",     &luna_channel_list_proxy::size)
+        << mond::method("get",      &luna_channel_list_proxy::get)
+        << mond::method("find",     &luna_channel_list_proxy::find)
+        << mond::method("matching", &luna_channel_list_proxy::matching)
+        << mond::method("channel",  &luna_channel_list_proxy::channel);
 
 
     _lua[api]["channels"] = mond::table{};
     _lua[api]["channels"]["find"] = std::function<int (lua_State*)>{
         [this] (lua_State* s) {
-            try {
-                return mond::write(s, mond::object<luna_channel_proxy>(
-                    context(),
-                    context().environment()
-                        .find_channel(luaL_checkstring(s, 1)).name()));
+            irc::channel const* chan = context().environment()
+                .lookup_channel(luaL_checkstring(s, 1));
 
-            } catch (irc::protocol_error& pe) {
+            if (not chan) {
                 return mond::write(s, mond::nil{});
             }
+
+            return mond::write(s,
+                mond::object<luna_channel_proxy>(context(), *chan));
         }};
 
     _lua[api]["channels"]["list"] = std::function<int (lua_State*)>{
@@ -690,7 +867,7 @@ void luna_script::register_channel()
 
             for (auto const& entry : context().environment().channels()) {
                 mond::write(s, mond::object<luna_channel_proxy>(
-                    context(), entry.second->name()));
+                    context(), *entry.second));
 
                 lua_setfield(s, -2, entry.second->name().c_str());
             }
@@ -698,7 +875,45 @@ void luna_script::register_channel()
             return 1;
         }};
 
+    _lua[api]["channels"]["query"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            irc::member_query q = check_member_query(s, 1);
+            lua_Integer limit = luaL_optinteger(s, 2, 0);
+
+            std::size_t left = (limit > 0)
+                ? static_cast<std::size_t>(limit)
+                : std::size_t(-1);
+
+            lua_newtable(s);
+
+            int n = 0;
+            std::vector<irc::channel_user const*> users;
+
+            for (auto const& entry : context().environment().channels()) {
+                irc::channel const& chan = *entry.second;
+
+                users.clear();
+                chan.query(q, users, left);
+
+                for (irc::channel_user const* cu : users) {
+                    mond::write(s, mond::object<luna_channel_user_proxy>(
+                        context(), chan, *cu));
+
+                    lua_rawseti(s, -2, ++n);
+                }
+
+                left -= users.size();
+
+                if (left == 0) {
+                    break;
+                }
+            }
+
+            return 1;
+        }};
+
     _lua[api]["channel_meta"].export_metatable<luna_channel_proxy>();
+    _lua[api]["channel_list_meta"].export_metatable<luna_channel_list_proxy>();
 }
 
 void luna_script::register_channel_user()
@@ -716,8 +931,10 @@ void luna_script::register_channel_user()
             &luna_channel_user_proxy::repr)
 
         << mond::method("user_info",     &luna_channel_user_proxy::user_info)
+        << mond::method("account",       &luna_channel_user_proxy::account)
         << mond::method("match_reguser", &luna_channel_user_proxy::match)
         << mond::method("modes",         &luna_channel_user_proxy::modes)
+        << mond::method("prefix",        &luna_channel_user_proxy::prefix)
         << mond::method("channel",       &luna_channel_user_proxy::channel);
 
     _lua[api]["unknown_user_meta"].export_metatable<luna_unknown_user_proxy>();
@@ -725,6 +942,433 @@ void luna_script::register_channel_user()
 }
 
 
+void luna_script::register_signals()
+{
+    _lua[api]["handlers"] = mond::table{};
+
+    _lua[api]["handlers"]["add"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            std::string signal = luaL_checkstring(s, 1);
+            std::string id     = luaL_checkstring(s, 2);
+
+            luaL_checktype(s, 3, LUA_TFUNCTION);
+
+            std::vector<std::string> channels;
+
+            if (not lua_isnoneornil(s, 4)) {
+                luaL_checktype(s, 4, LUA_TTABLE);
+
+                std::size_t n = lua_rawlen(s, 4);
+
+                for (std::size_t i = 1; i <= n; ++i) {
+                    lua_rawgeti(s, 4, i);
+                    channels.push_back(luaL_checkstring(s, -1));
+                    lua_pop(s, 1);
+                }
+
+                if (channels.empty()) {
+                    return luaL_argerror(s, 4, "no channels given");
+                }
+            }
+
+            // Handlers are pinned in the main state, a coroutine adding one
+            // may be long gone when it is called.
+            lua_pushvalue(s, 3);
+
+            if (s != static_cast<lua_State*>(_lua)) {
+                lua_xmove(s, _lua, 1);
+            }
+
+            add_handler(signal, id, mond::reference{_lua}, channels);
+
+            return 0;
+        }};
+
+    _lua[api]["handlers"]["remove"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            return mond::write(s, remove_handler(luaL_checkstring(s, 1)));
+        }};
+
+    _lua[api]["handlers"]["current"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            if (not _current_list) {
+                return mond::write(s, mond::nil{});
+            }
+
+            return mond::write(s,
+                _current_list->handlers[_current_handler].id);
+        }};
+
+    _lua[api]["dispatch_signal"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            handler_list* list = find_handlers(luaL_checkstring(s, 1));
+
+            if (list and not list->handlers.empty()) {
+                dispatch_signal(s, *list, lua_gettop(s) - 1);
+            }
+
+            return 0;
+        }};
+}
+
+
+void luna_script::register_commands()
+{
+    _lua[api]["commands"] = mond::table{};
+
+    _lua[api]["commands"]["stale"] = std::function<bool ()>{
+        [this] {
+            return _router.stale();
+        }};
+
+    _lua[api]["commands"]["set_contexts"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            luaL_checktype(s, 1, LUA_TTABLE);
+
+            std::vector<command_router::context> contexts;
+            std::size_t n = lua_rawlen(s, 1);
+
+            for (std::size_t i = 1; i <= n; ++i) {
+                lua_rawgeti(s, 1, i);
+
+                if (not lua_istable(s, -1)) {
+                    return luaL_argerror(s, 1, "contexts must be tables");
+                }
+
+                command_router::context ctx;
+
+                lua_getfield(s, -1, "name");
+                ctx.name = luaL_optstring(s, -1, "");
+                lua_getfield(s, -2, "trigger");
+                ctx.trigger = luaL_optstring(s, -1, "");
+                lua_getfield(s, -3, "response");
+                ctx.response = luaL_optstring(s, -1, "");
+
+                lua_pop(s, 4);
+
+                contexts.push_back(std::move(ctx));
+            }
+
+            for (std::string const& err :
+                    _router.set_contexts(std::move(contexts))) {
+                _logger.warn() << "Ignoring command " << err;
+            }
+
+            return 0;
+        }};
+
+    _lua[api]["commands"]["add"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            std::string name = luaL_checkstring(s, 1);
+            std::string type = luaL_optstring(s, 2, "*l");
+
+            command_router::argtype argtype = command_router::argtype::line;
+
+            if (type == "*w") {
+                argtype = command_router::argtype::words;
+            } else if (type == "*s") {
+                argtype = command_router::argtype::shell;
+            }
+
+            std::string replaced = _router.add_command(name, argtype);
+
+            if (replaced.empty()) {
+                return mond::write(s, mond::nil{});
+            }
+
+            return mond::write(s, replaced);
+        }};
+
+    _lua[api]["commands"]["remove"] = std::function<bool (std::string)>{
+        [this] (std::string name) {
+            return _router.remove_command(name);
+        }};
+
+    _lua[api]["commands"]["route"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            command_router::match m;
+
+            if (not _router.route(
+                    luaL_checkstring(s, 1), context().nick(),
+                    luaL_checkstring(s, 2), m)) {
+                return mond::write(s, mond::nil{});
+            }
+
+            if (not m.cmd) {
+                return mond::write(s, m.ctx->response, m.name, m.args);
+            }
+
+            switch (m.cmd->type) {
+            case command_router::argtype::words:
+                return mond::write(s, m.ctx->response, m.name, m.args,
+                    m.cmd->name, command_router::split_words(m.args));
+
+            case command_router::argtype::shell:
+                return mond::write(s, m.ctx->response, m.name, m.args,
+                    m.cmd->name, command_router::split_shell(m.args));
+
+            default:
+                return mond::write(s, m.ctx->response, m.name, m.args,
+                    m.cmd->name, m.args);
+            }
+        }};
+}
+
+
+void luna_script::register_watchers()
+{
+    _lua[api]["watchers"] = mond::table{};
+
+    _lua[api]["watchers"]["add"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            _watchers.add(
+                luaL_checkstring(s, 1),
+                luaL_checkstring(s, 2),
+                lua_toboolean(s, 3));
+
+            return 0;
+        }};
+
+    _lua[api]["watchers"]["remove"] = std::function<bool (std::string)>{
+        [this] (std::string id) {
+            return _watchers.remove(id);
+        }};
+
+    _lua[api]["watchers"]["hit"] = std::function<void (std::string)>{
+        [this] (std::string id) {
+            _watchers.record_hit(id);
+        }};
+
+    _lua[api]["watchers"]["candidates"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            std::vector<std::string const*> ids;
+            _watchers.candidates(luaL_checkstring(s, 1), ids);
+
+            lua_createtable(s, static_cast<int>(ids.size()), 0);
+
+            for (std::size_t i = 0; i < ids.size(); ++i) {
+                mond::write(s, *ids[i]);
+                lua_rawseti(s, -2, static_cast<int>(i + 1));
+            }
+
+            return 1;
+        }};
+
+    _lua[api]["watchers"]["list"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            lua_newtable(s);
+
+            for (message_watchers::watcher const& w : _watchers.list()) {
+                lua_newtable(s);
+
+                mond::write(s, w.pattern);
+                lua_setfield(s, -2, "pattern");
+                mond::write(s, w.plain);
+                lua_setfield(s, -2, "plain");
+                mond::write(s, w.literal);
+                lua_setfield(s, -2, "literal");
+                mond::write(s, w.candidates);
+                lua_setfield(s, -2, "candidates");
+                mond::write(s, w.hits);
+                lua_setfield(s, -2, "hits");
+
+                lua_setfield(s, -2, w.id.c_str());
+            }
+
+            return 1;
+        }};
+}
+
+namespace {
+
+std::string filter_key(std::string const& channel, std::string const& dir)
+{
+    std::string key = "luna.channel." + channel + ".filter_" + dir;
+
+    // Lower cased like Lua's string.lower() would, as it used to be
+    for (std::size_t i = 13; i < 13 + channel.size(); ++i) {
+        key[i] = static_cast<char>(
+            ::tolower(static_cast<unsigned char>(key[i])));
+    }
+
+    return key;
+}
+
+int dump_writer(lua_State*, void const* p, std::size_t size, void* out)
+{
+    static_cast<std::string*>(out)->append(static_cast<char const*>(p), size);
+    return 0;
+}
+
+constexpr char base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64_encode(std::string const& data)
+{
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+
+    for (std::size_t i = 0; i < data.size(); i += 3) {
+        std::size_t n = std::min<std::size_t>(3, data.size() - i);
+        std::uint32_t v = 0;
+
+        for (std::size_t k = 0; k < 3; ++k) {
+            v <<= 8;
+
+            if (k < n) {
+                v |= static_cast<unsigned char>(data[i + k]);
+            }
+        }
+
+        for (std::size_t k = 0; k < 4; ++k) {
+            out.push_back((k <= n) ? base64_chars[(v >> (18 - 6 * k)) & 0x3F]
+                                   : '=');
+        }
+    }
+
+    return out;
+}
+
+// Skips anything not in the alphabet, like scripts/lib/base64.lua
+std::string base64_decode(std::string const& data)
+{
+    std::string out;
+    out.reserve(data.size() / 4 * 3);
+
+    std::uint32_t v = 0;
+    int bits = 0;
+
+    for (char c : data) {
+        char const* p = std::strchr(base64_chars, c);
+
+        if (not p or c == '\0') {
+            continue;
+        }
+
+        v = (v << 6) | static_cast<std::uint32_t>(p - base64_chars);
+        bits += 6;
+
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((v >> bits) & 0xFF));
+        }
+    }
+
+    return out;
+}
+
+} // namespace
+
+void luna_script::register_filters()
+{
+    _lua[api]["filters"] = mond::table{};
+
+    _lua[api]["filters"]["get"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            static char const* const dirs[] = {"in", "out", nullptr};
+
+            std::string channel = luaL_checkstring(s, 1);
+            std::string dir = dirs[luaL_checkoption(s, 2, nullptr, dirs)];
+
+            push_filter(s, filter_key(channel, dir));
+
+            return 1;
+        }};
+
+    _lua[api]["filters"]["set"] = std::function<int (lua_State*)>{
+        [this] (lua_State* s) {
+            static char const* const dirs[] = {"in", "out", nullptr};
+
+            std::string channel = luaL_checkstring(s, 1);
+            std::string dir = dirs[luaL_checkoption(s, 2, nullptr, dirs)];
+            std::string key = filter_key(channel, dir);
+
+            if (lua_isnoneornil(s, 3)) {
+                _filters.erase(key);
+                context().clear_shared_var(key);
+
+                return 0;
+            }
+
+            luaL_checktype(s, 3, LUA_TFUNCTION);
+
+            std::string bytecode;
+
+            lua_pushvalue(s, 3);
+
+            if (lua_dump(s, dump_writer, &bytecode) != 0) {
+                throw mond::runtime_error{"unable to dump given function"};
+            }
+
+            // The function itself is kept, with its upvalues. Other scripts,
+            // and this one after a restart, get the bytecode.
+            if (s != static_cast<lua_State*>(_lua)) {
+                lua_xmove(s, _lua, 1);
+            }
+
+            compiled_filter& f = _filters[key];
+
+            f.fn = mond::reference{_lua};
+            f.source = base64_encode(bytecode);
+
+            context().set_shared_var(key, f.source);
+            f.version = shared_vars_version;
+
+            return 0;
+        }};
+}
+
+void luna_script::push_filter(lua_State* l, std::string const& key)
+{
+    auto it = _filters.find(key);
+
+    if ((it == std::end(_filters))
+            or (it->second.version != shared_vars_version)) {
+        auto var = shared_vars.find(key);
+
+        // Only filters that exist are kept, not every channel asked about
+        if (var == std::end(shared_vars)) {
+            if (it != std::end(_filters)) {
+                _filters.erase(it);
+            }
+
+            lua_pushnil(l);
+            return;
+        }
+
+        if (it == std::end(_filters)) {
+            it = _filters.emplace(key, compiled_filter{}).first;
+        }
+
+        compiled_filter& f = it->second;
+        f.version = shared_vars_version;
+
+        if (var->second != f.source or not f.fn.valid()) {
+            f.source = var->second;
+            f.fn = mond::reference{};
+
+            std::string bytecode = base64_decode(f.source);
+            lua_State* main = _lua;
+
+            if (luaL_loadbuffer(main, bytecode.data(), bytecode.size(),
+                    ("=" + key).c_str()) == LUA_OK) {
+                f.fn = mond::reference{main};
+            } else {
+                _logger.warn() << "Could not load channel filter `" << key
+                               << "': " << lua_tostring(main, -1);
+                lua_pop(main, 1);
+            }
+        }
+    }
+
+    if (it->second.fn.valid()) {
+        it->second.fn.push(l);
+    } else {
+        lua_pushnil(l);
+    }
+}
+
+
 void luna_script::init()
 {
     luna_extension::init();
@@ -746,32 +1390,243 @@ void luna_script::destroy()
 }
 
 
+bool luna_script::interested_in(event ev) const
+{
+    interest const& in = _interests[static_cast<std::size_t>(ev)];
+
+    return in.anywhere or not in.channels.empty();
+}
+
+bool luna_script::interested_in(event ev, std::string const& channel) const
+{
+    interest const& in = _interests[static_cast<std::size_t>(ev)];
+
+    if (in.anywhere) {
+        return true;
+    }
+
+    if (in.channels.empty()) {
+        return false;
+    }
+
+    // Messages to "@#channel" are still messages in #channel
+    std::string target = channel, level;
+
+    return split_message_level(target, level)
+        and (in.channels.find(target) != std::end(in.channels));
+}
+
+void luna_script::watch_signal(
+    std::string const& signal,
+    std::string const& channel,
+    int delta)
+{
+    for (event ev : signal_events(signal)) {
+        interest& in = _interests[static_cast<std::size_t>(ev)];
+        std::size_t& count = channel.empty()
+            ? in.anywhere
+            : in.channels[channel];
+
+        if ((delta > 0) or (count > 0)) {
+            count += delta;
+        }
+
+        if (not channel.empty() and (count == 0)) {
+            in.channels.erase(channel);
+        }
+    }
+
+    context().interests_changed();
+}
+
+
+luna_script::handler_list* luna_script::find_handlers(
+    std::string const& signal)
+{
+    for (handler_list& list : _signals) {
+        if (list.signal == signal) {
+            return &list;
+        }
+    }
+
+    auto it = _custom_signals.find(signal);
+
+    return it != std::end(_custom_signals) ? &it->second : nullptr;
+}
+
+void luna_script::add_handler(
+    std::string const& signal,
+    std::string const& id,
+    mond::reference callback,
+    std::vector<std::string> const& channels)
+{
+    remove_handler(id);
+
+    handler_list* list = find_handlers(signal);
+
+    // Lists of custom signals stay once made, dispatch_signal or
+    // _handler_ids might be holding on to them.
+    if (not list) {
+        list = &_custom_signals[signal];
+        list->signal = signal;
+    }
+
+    signal_handler handler;
+    handler.id       = id;
+    handler.callback = std::move(callback);
+
+    for (std::string const& channel : channels) {
+        // Possibly not joined yet, so the name has to be kept
+        handler.channels.emplace_back(channel);
+        watch_signal(signal, channel, 1);
+    }
+
+    if (channels.empty()) {
+        watch_signal(signal, "", 1);
+    }
+
+    list->handlers.push_back(std::move(handler));
+    _handler_ids[id] = list;
+}
+
+bool luna_script::remove_handler(std::string const& id)
+{
+    auto it = _handler_ids.find(id);
+
+    if (it == std::end(_handler_ids)) {
+        return false;
+    }
+
+    handler_list& list = *it->second;
+    _handler_ids.erase(it);
+
+    for (signal_handler& handler : list.handlers) {
+        if (handler.removed or (handler.id != id)) {
+            continue;
+        }
+
+        handler.removed = true;
+
+        for (irc::atom channel : handler.channels) {
+            watch_signal(list.signal,
+                irc::atom_table::global().folded(channel), -1);
+        }
+
+        if (handler.channels.empty()) {
+            watch_signal(list.signal, "", -1);
+        }
+
+        break;
+    }
+
+    if (not list.dispatching) {
+        compact_handlers(list);
+    }
+
+    return true;
+}
+
+void luna_script::compact_handlers(handler_list& list)
+{
+    list.handlers.erase(
+        std::remove_if(
+            std::begin(list.handlers), std::end(list.handlers),
+            [] (signal_handler const& h) { return h.removed; }),
+        std::end(list.handlers));
+}
+
+void luna_script::dispatch_signal(
+    lua_State* l,
+    handler_list& list,
+    int nargs)
+{
+    int base = lua_gettop(l) - nargs;
+
+    _traceback.push(l);
+    int msgh = lua_gettop(l);
+
+    luna_channel_proxy const* channel = nullptr;
+
+    if (list.channel_arg <= nargs) {
+        channel = static_cast<luna_channel_proxy const*>(luaL_testudata(
+            l, base + list.channel_arg, luna_channel_proxy::metatable));
+    }
+
+    handler_list* outer_list = _current_list;
+    std::size_t outer_handler = _current_handler;
+
+    ++list.dispatching;
+
+    // Handlers added from now on wait for the next signal.
+    std::size_t count = list.handlers.size();
+
+    for (std::size_t i = 0; i < count; ++i) {
+        signal_handler const& handler = list.handlers[i];
+
+        if (handler.removed) {
+            continue;
+        }
+
+        if (not handler.channels.empty() and not (channel and std::count(
+                std::begin(handler.channels), std::end(handler.channels),
+                channel->name_atom()))) {
+            continue;
+        }
+
+        handler.callback.push(l);
+
+        for (int arg = 1; arg <= nargs; ++arg) {
+            lua_pushvalue(l, base + arg);
+        }
+
+        _current_list = &list;
+        _current_handler = i;
+
+        // The handler may add more handlers, don't touch it past this.
+        if (lua_pcall(l, nargs, 0, msgh) != LUA_OK) {
+            _logger.warn() << "Handler for `" << list.signal << "' failed: "
+                           << lua_tostring(l, -1);
+
+            lua_pop(l, 1);
+        }
+    }
+
+    _current_list = outer_list;
+    _current_handler = outer_handler;
+
+    lua_settop(l, base);
+
+    if (--list.dispatching == 0) {
+        compact_handlers(list);
+    }
+}
+
 void luna_script::on_connect()
 {
     luna_extension::on_connect();
 
-    emit_signal("connect");
+    emit_signal(signal_id::connect);
 }
 
 void luna_script::on_disconnect()
 {
     luna_extension::on_disconnect();
 
-    emit_signal("disconnect");
+    emit_signal(signal_id::disconnect);
 }
 
 void luna_script::on_idle()
 {
     luna_extension::on_idle();
 
-    emit_signal("tick");
+    emit_signal(signal_id::tick);
 }
 
 void luna_script::on_message_send(irc::message const& msg)
 {
     luna_extension::on_message_send(msg);
 
-    emit_signal("message_send", msg.command, msg.args);
+    emit_signal(signal_id::message_send, msg.command, msg.args);
 }
 
 void luna_script::on_message(irc::message const& msg)
@@ -779,10 +1634,10 @@ void luna_script::on_message(irc::message const& msg)
     luna_extension::on_message(msg);
 
     if (msg.command == irc::command::RPL_ENDOFWHO) {
-        emit_signal_helper("user_join", msg.args[0], msg.args[1]);
+        emit_signal_helper(signal_id::user_join, msg.args[0], msg.args[1]);
     }
 
-    emit_signal("raw", msg.prefix, msg.command, msg.args);
+    emit_signal(signal_id::raw, msg.prefix, msg.command, msg.args);
 }
 
 void luna_script::on_invite(
@@ -791,7 +1646,7 @@ void luna_script::on_invite(
 {
     luna_extension::on_invite(source, channel);
 
-    emit_signal("invite", get_unknown_user_proxy(source), channel);
+    emit_signal(signal_id::invite, get_unknown_user_proxy(source), channel);
 }
 
 void luna_script::on_channel_sync(
@@ -800,10 +1655,16 @@ void luna_script::on_channel_sync(
 {
     luna_extension::on_channel_sync(channel, type);
 
+    irc::channel const* chan = context().environment().lookup_channel(channel);
+
+    if (not chan) {
+        return;
+    }
+
     if (type == sync_type::users) {
-        emit_signal("channel_user_sync", get_channel_proxy(channel));
+        emit_signal(signal_id::channel_user_sync, get_channel_proxy(*chan));
     } else if (type == sync_type::bans) {
-        emit_signal("channel_ban_sync", get_channel_proxy(channel));
+        emit_signal(signal_id::channel_ban_sync, get_channel_proxy(*chan));
     }
 }
 
@@ -814,7 +1675,7 @@ void luna_script::on_join(
     luna_extension::on_join(source, channel);
 
     if (not context().is_me(source)) {
-        emit_signal_helper("user_join", source, channel);
+        emit_signal_helper(signal_id::user_join, source, channel);
     }
 }
 
@@ -825,7 +1686,7 @@ void luna_script::on_part(
 {
     luna_extension::on_part(source, channel, reason);
 
-    emit_signal_helper("user_part", source, channel, reason);
+    emit_signal_helper(signal_id::user_part, source, channel, reason);
 }
 
 void luna_script::on_quit(
@@ -834,7 +1695,7 @@ void luna_script::on_quit(
 {
     luna_extension::on_quit(source, reason);
 
-    emit_signal("user_quit", get_unknown_user_proxy(source), reason);
+    emit_signal(signal_id::user_quit, get_unknown_user_proxy(source), reason);
 }
 
 void luna_script::on_nick(
@@ -843,7 +1704,8 @@ void luna_script::on_nick(
 {
     luna_extension::on_nick(source, new_nick);
 
-    emit_signal("nick_change", get_unknown_user_proxy(source), new_nick);
+    emit_signal(signal_id::nick_change,
+        get_unknown_user_proxy(source), new_nick);
 }
 
 void luna_script::on_kick(
@@ -854,20 +1716,31 @@ void luna_script::on_kick(
 {
     luna_extension::on_kick(source, channel, kicked, reason);
 
-    irc::channel const& chan = context().environment().find_channel(channel);
+    irc::channel const* chan = context().environment().lookup_channel(channel);
+
+    if (not chan) {
+        return;
+    }
+
+    irc::channel_user const* kicker = chan->lookup_user(source);
+    irc::channel_user const* victim = chan->lookup_user(kicked);
+
+    if (not victim) {
+        return;
+    }
 
     // Could be chanserv kicking
-    if (chan.has_user(source)) {
-        emit_signal("channel_user_kick",
-            get_channel_user_proxy(chan.find_user(source), chan),
-            get_channel_proxy(chan),
-            get_channel_user_proxy(chan.find_user(kicked), chan),
+    if (kicker) {
+        emit_signal(signal_id::channel_user_kick,
+            get_channel_user_proxy(*kicker, *chan),
+            get_channel_proxy(*chan),
+            get_channel_user_proxy(*victim, *chan),
             reason);
     } else {
-        emit_signal("channel_user_kick",
+        emit_signal(signal_id::channel_user_kick,
             get_unknown_user_proxy(source),
-            get_channel_proxy(chan),
-            get_channel_user_proxy(chan.find_user(kicked), chan),
+            get_channel_proxy(*chan),
+            get_channel_user_proxy(*victim, *chan),
             reason);
     }
 }
@@ -879,10 +1752,30 @@ void luna_script::on_topic(
 {
     luna_extension::on_topic(source, channel, new_topic);
 
-    emit_signal_helper("topic_change", source, channel, new_topic);
+    emit_signal_helper(signal_id::topic_change, source, channel, new_topic);
 }
 
-bool luna_script::split_message_level(std::string& target, std::string& level)
+void luna_script::emit_netsplit_signal(
+    signal_id signal,
+    irc::netsplit_event const& ev)
+{
+    std::vector<decltype(get_unknown_user_proxy(""))> users;
+    std::vector<std::vector<std::string>> channels;
+
+    users.reserve(ev.users.size());
+    channels.reserve(ev.users.size());
+
+    for (irc::netsplit_user const& u : ev.users) {
+        users.push_back(get_unknown_user_proxy(u.prefix));
+        channels.push_back(u.channels);
+    }
+
+    emit_signal(signal, ev.server1, ev.server2, users, channels);
+}
+
+bool luna_script::split_message_level(
+    std::string& target,
+    std::string& level) const
 {
     std::size_t chanstart = target.find_first_of(
         context().environment().channel_types());
@@ -910,9 +1803,9 @@ void luna_script::on_privmsg(
     std::string rtarget = target, rlevel;
 
     if (split_message_level(rtarget, rlevel)) {
-        emit_signal_helper("message", source, rtarget, msg, rlevel);
+        emit_signal_helper(signal_id::message, source, rtarget, msg, rlevel);
     } else {
-        emit_signal_helper("message", source, target, msg);
+        emit_signal_helper(signal_id::message, source, target, msg);
     }
 }
 
@@ -926,9 +1819,9 @@ void luna_script::on_notice(
     std::string rtarget = target, rlevel;
 
     if (split_message_level(rtarget, rlevel)) {
-        emit_signal_helper("notice", source, rtarget, msg, rlevel);
+        emit_signal_helper(signal_id::notice, source, rtarget, msg, rlevel);
     } else {
-        emit_signal_helper("notice", source, target, msg);
+        emit_signal_helper(signal_id::notice, source, target, msg);
     }
 }
 
@@ -944,16 +1837,18 @@ void luna_script::on_ctcp_request(
 
     if (irc::rfc1459_equal(ctcp, "ACTION")) {
         if (split_message_level(rtarget, rlevel)) {
-            emit_signal_helper("action", source, rtarget, args, rlevel);
+            emit_signal_helper(signal_id::action,
+                source, rtarget, args, rlevel);
         } else {
-            emit_signal_helper("action", source, target, args);
+            emit_signal_helper(signal_id::action, source, target, args);
         }
     } else {
         if (split_message_level(rtarget, rlevel)) {
-            emit_signal_helper("ctcp_request",
+            emit_signal_helper(signal_id::ctcp_request,
                 source, rtarget, ctcp, args, rlevel);
         } else {
-            emit_signal_helper("ctcp_request", source, target, ctcp, args);
+            emit_signal_helper(signal_id::ctcp_request,
+                source, target, ctcp, args);
         }
     }
 }
@@ -969,10 +1864,11 @@ void luna_script::on_ctcp_response(
     std::string rtarget = target, rlevel;
 
     if (split_message_level(rtarget, rlevel)) {
-        emit_signal_helper("ctcp_response",
+        emit_signal_helper(signal_id::ctcp_response,
              source, rtarget, ctcp, args, rlevel);
     } else {
-        emit_signal_helper("ctcp_response", source, target, ctcp, args);
+        emit_signal_helper(signal_id::ctcp_response,
+            source, target, ctcp, args);
     }
 }
 
@@ -984,5 +1880,19 @@ void luna_script::on_mode(
 {
     luna_extension::on_mode(source, target, mode, arg);
 
-    emit_signal_helper("mode", source, target, mode, arg);
+    emit_signal_helper(signal_id::mode, source, target, mode, arg);
+}
+
+void luna_script::on_netsplit(irc::netsplit_event const& split)
+{
+    luna_extension::on_netsplit(split);
+
+    emit_netsplit_signal(signal_id::netsplit, split);
+}
+
+void luna_script::on_netjoin(irc::netsplit_event const& join)
+{
+    luna_extension::on_netjoin(join);
+
+    emit_netsplit_signal(signal_id::netjoin, join);
 }
@@ -24,19 +24,27 @@
 #include "luna.hh"
 #include "logging.hh"
 #include "luna_extension.hh"
+#include "command_router.hh"
+#include "message_watchers.hh"
 
+#include "lua/script_allocator.hh"
 #include "lua/proxies/luna_channel_proxy.hh"
 #include "lua/proxies/luna_user_proxy.hh"
 #include "lua/proxies/luna_extension_proxy.hh"
 
+#include <irc/atom.hh>
 #include <irc/irc_utils.hh>
 #include <irc/channel.hh>
 #include <irc/channel_user.hh>
 #include <irc/environment.hh>
+#include <irc/netsplit.hh>
 
 #include <mond/mond.hh>
 
+#include <array>
 #include <string>
+#include <vector>
+#include <unordered_map>
 
 class luna;
 
@@ -44,6 +52,45 @@ class luna_script : public luna_extension {
 public:
     static constexpr char const* api = "__luna";
 
+    // Signals raised in scripts. Signals that have a channel_ variant raised
+    // for events in channels (see emit_signal_helper()) are followed by it.
+    enum class signal_id {
+        connect,
+        disconnect,
+        tick,
+        message_send,
+        raw,
+        invite,
+        channel_user_sync,
+        channel_ban_sync,
+        user_join,
+        channel_user_join,
+        user_part,
+        channel_user_part,
+        user_quit,
+        nick_change,
+        channel_user_kick,
+        topic_change,
+        channel_topic_change,
+        message,
+        channel_message,
+        notice,
+        channel_notice,
+        action,
+        channel_action,
+        ctcp_request,
+        channel_ctcp_request,
+        ctcp_response,
+        channel_ctcp_response,
+        mode,
+        channel_mode,
+        netsplit,
+        netjoin
+    };
+
+    static constexpr std::size_t signal_count =
+        static_cast<std::size_t>(signal_id::netjoin) + 1;
+
     luna_script(luna& context, std::string file);
     virtual ~luna_script();
 
@@ -59,6 +106,12 @@ public:
     virtual void init() override;
     virtual void destroy() override;
 
+    // Only events feeding signals the script has handlers for
+    virtual bool interested_in(event ev) const override;
+    virtual bool interested_in(
+        event ev,
+        std::string const& channel) const override;
+
     virtual void on_connect() override;
     virtual void on_disconnect() override;
     virtual void on_idle() override;
@@ -131,6 +184,9 @@ public:
         std::string const& mode,
         std::string const& arg) override;
 
+    virtual void on_netsplit(irc::netsplit_event const& split) override;
+    virtual void on_netjoin(irc::netsplit_event const& join) override;
+
 private:
     void setup_api();
 
@@ -140,11 +196,14 @@ private:
     void register_user();
     void register_channel();
     void register_channel_user();
+    void register_signals();
+    void register_commands();
+    void register_watchers();
+    void register_filters();
 
     auto get_channel_proxy(irc::channel const& channel)
     {
-        return mond::object<luna_channel_proxy>(
-            this->context(), channel.name());
+        return mond::object<luna_channel_proxy>(this->context(), channel);
     }
 
     auto get_unknown_user_proxy(std::string prefix)
@@ -158,40 +217,52 @@ private:
         irc::channel const& channel)
     {
         return mond::object<luna_channel_user_proxy>(
-            this->context(), channel.name(), user.uid());
+            this->context(), channel, user);
     }
 
     template <typename... Args>
-    void emit_signal(std::string const& signal, Args&&... args)
+    void emit_signal(signal_id signal, Args&&... args)
     {
-        try {
-            _lua["luna"]["handle_signal"].call(
-                signal, std::forward<Args>(args)...);
-        } catch (mond::error const& e) {
-            _logger.warn() << "Signal handler failed: " << e.what();
+        handler_list& list = _signals[static_cast<std::size_t>(signal)];
+
+        // Interests keep most events away already, but handlers can go away
+        // in the middle of dispatching one.
+        if (list.handlers.empty()) {
+            return;
         }
+
+        dispatch_signal(
+            _lua, list, mond::write(_lua, std::forward<Args>(args)...));
     }
 
     template <typename... Args>
     auto emit_signal_helper(
-        std::string const& signal,
+        signal_id signal,
         std::string const& user,
         std::string const& target,
         Args&&... args)
     {
         if (context().environment().is_channel(target)) {
-            irc::channel const& chan =
-                context().environment().find_channel(target);
+            signal_id in_channel =
+                static_cast<signal_id>(static_cast<int>(signal) + 1);
+
+            irc::channel const* chan =
+                context().environment().lookup_channel(target);
 
-            if (chan.has_user(user)) {
-                emit_signal("channel_" + signal,
-                    get_channel_user_proxy(chan.find_user(user), chan),
-                    get_channel_proxy(chan),
+            // Not a channel we are in, nothing to tell the script about it.
+            if (not chan) {
+                return;
+            }
+
+            if (irc::channel_user const* cu = chan->lookup_user(user)) {
+                emit_signal(in_channel,
+                    get_channel_user_proxy(*cu, *chan),
+                    get_channel_proxy(*chan),
                     std::forward<Args>(args)...);
             } else {
-                emit_signal("channel_" + signal,
+                emit_signal(in_channel,
                     get_unknown_user_proxy(user),
-                    get_channel_proxy(chan),
+                    get_channel_proxy(*chan),
                     std::forward<Args>(args)...);
             }
         } else {
@@ -200,7 +271,41 @@ private:
         }
     }
 
-    bool split_message_level(std::string& target, std::string& level);
+    // Users as luna.unknown_user, their channels in a list of the same order
+    void emit_netsplit_signal(
+        signal_id signal,
+        irc::netsplit_event const& ev);
+
+    bool split_message_level(std::string& target, std::string& level) const;
+
+    // Handler counts of a signal (or in a channel) changed by `delta'
+    void watch_signal(
+        std::string const& signal,
+        std::string const& channel,
+        int delta);
+
+    struct handler_list;
+
+    // Replaces any handler with the same id.
+    void add_handler(
+        std::string const& signal,
+        std::string const& id,
+        mond::reference callback,
+        std::vector<std::string> const& channels);
+
+    bool remove_handler(std::string const& id);
+
+    // nullptr if nothing was ever registered for the signal
+    handler_list* find_handlers(std::string const& signal);
+
+    // Calls the handlers with the `nargs' values on top of the stack as
+    // arguments, popping them. `l' is the main state or one of its threads.
+    void dispatch_signal(lua_State* l, handler_list& list, int nargs);
+
+    void compact_handlers(handler_list& list);
+
+    // Pushes the channel filter kept in shared variable `key', or nil.
+    void push_filter(lua_State* l, std::string const& key);
 
 private:
     friend class luna_extension_proxy;
@@ -208,11 +313,74 @@ private:
     logger _logger;
 
     std::string _file;
+
+    // Declared before the state, which frees its memory through it
+    script_allocator _alloc;
     mond::state _lua;
 
+    struct signal_handler {
+        std::string id;
+        mond::reference callback;
+
+        // Only called for signals in these channels, unless empty
+        std::vector<irc::atom_ref> channels;
+
+        bool removed = false;
+    };
+
+    // Handlers of a signal in the order they were added. Handlers removed
+    // while the signal is dispatched are only marked, and dropped once the
+    // dispatch is done.
+    struct handler_list {
+        std::string signal;
+        std::vector<signal_handler> handlers;
+
+        // Argument holding the channel, for handlers limited to channels
+        int channel_arg = 2;
+
+        std::size_t dispatching = 0;
+    };
+
+    // Signals raised by luna by signal_id, anything else scripts raise
+    // themselves by name.
+    std::array<handler_list, signal_count> _signals;
+    std::unordered_map<std::string, handler_list> _custom_signals;
+
+    std::unordered_map<std::string, handler_list*> _handler_ids;
+
+    // The handler running right now, if any
+    handler_list* _current_list = nullptr;
+    std::size_t _current_handler = 0;
+
+    // Adds a traceback to errors in handlers
+    mond::reference _traceback;
+
+    command_router _router;
+    message_watchers _watchers;
+
+    // Channel filters are kept in shared variables as dumped bytecode, to
+    // survive restarts and reach every script. Compiled ones are kept by
+    // variable and only looked at again once shared variables changed.
+    struct compiled_filter {
+        std::uint64_t version = UINT64_MAX;
+        std::string source;
+        mond::reference fn;
+    };
+
+    std::unordered_map<std::string, compiled_filter> _filters;
+
     std::string _script_name;
     std::string _script_descr;
     std::string _script_version;
+
+    // Signal handlers of the script by the event feeding them, either for
+    // any channel or only for some.
+    struct interest {
+        std::size_t anywhere = 0;
+        irc::unordered_rfc1459_map<std::string, std::size_t> channels;
+    };
+
+    std::array<interest, event_count> _interests;
 };
 
 #endif // defined LUNA_LUA_LUNA_SCRIPT_HH_INCLUDED
@@ -24,9 +24,15 @@
 #include "luna.hh"
 #include "luna_user.hh"
 
+#include <irc/atom.hh>
 #include <irc/channel.hh>
 #include <irc/channel_user.hh>
+#include <irc/list_mode.hh>
+#include <irc/mask_matcher.hh>
+#include <irc/member_query.hh>
+#include <irc/network_user.hh>
 #include <irc/irc_utils.hh>
+#include <irc/irc_except.hh>
 #include <irc/environment.hh>
 
 #include <mond/mond.hh>
@@ -34,10 +40,98 @@
 #include <lua.hpp>
 
 #include <ctime>
+#include <cstring>
 #include <string>
+#include <tuple>
+#include <vector>
 #include <sstream>
 
 
+namespace {
+
+// Resolves the handle, falling back to looking the channel up by name if it
+// has been replaced (or there was no channel yet when the handle was taken).
+irc::channel& resolve_channel(
+    luna& ref,
+    irc::atom name,
+    irc::handle<irc::channel>& handle)
+{
+    irc::environment const& env = ref.environment();
+
+    if (irc::channel* chan = env.resolve(handle)) {
+        return *chan;
+    }
+
+    irc::channel* chan = env.lookup_channel(name);
+
+    if (not chan) {
+        throw mond::error{
+            "no such channel: " + irc::atom_table::global().folded(name)};
+    }
+
+    handle = chan->handle();
+
+    return *chan;
+}
+
+}
+
+
+irc::member_query check_member_query(lua_State* s, int arg)
+{
+    luaL_checktype(s, arg, LUA_TTABLE);
+    arg = lua_absindex(s, arg);
+
+    irc::member_query q;
+
+    auto string_field = [s] (std::string& dst) {
+        dst = luaL_checkstring(s, -1);
+    };
+
+    lua_pushnil(s);
+
+    while (lua_next(s, arg)) {
+        if (lua_type(s, -2) != LUA_TSTRING) {
+            luaL_error(s, "member query keys must be strings");
+        }
+
+        char const* key = lua_tostring(s, -2);
+
+        if (not std::strcmp(key, "prefix")) {
+            string_field(q.modes);
+        } else if (not std::strcmp(key, "at_least")) {
+            char const* mode = luaL_checkstring(s, -1);
+
+            if ((mode[0] == '\0') or (mode[1] != '\0')) {
+                luaL_error(s, "at_least expects a single mode character");
+            }
+
+            q.at_least = mode[0];
+        } else if (not std::strcmp(key, "mask")) {
+            string_field(q.mask);
+        } else if (not std::strcmp(key, "nick")) {
+            string_field(q.nick);
+        } else if (not std::strcmp(key, "user")) {
+            string_field(q.user);
+        } else if (not std::strcmp(key, "host")) {
+            string_field(q.host);
+        } else if (not std::strcmp(key, "account")) {
+            string_field(q.account);
+        } else if (not std::strcmp(key, "idle_lt")) {
+            q.idle_less_than = luaL_checkinteger(s, -1);
+        } else if (not std::strcmp(key, "idle_gt")) {
+            q.idle_more_than = luaL_checkinteger(s, -1);
+        } else {
+            luaL_error(s, "unknown member query key `%s'", key);
+        }
+
+        lua_pop(s, 1);
+    }
+
+    return q;
+}
+
+
 ///
 // Unknown users
 luna_unknown_user_proxy::luna_unknown_user_proxy(luna& ref, std::string prefix)
@@ -62,13 +156,8 @@ std::tuple<std::string,
 
 int luna_unknown_user_proxy::match(lua_State* s) const
 {
-    auto i = std::find_if(std::begin(_ref->users()), std::end(_ref->users()),
-        [this] (luna_user& u) {
-            return u.matches(_prefix);
-        });
-
-    if (i != std::end(_ref->users())) {
-        return mond::write(s, mond::object<luna_user_proxy>(*_ref, i->id()));
+    if (luna_user const* u = _ref->match_user(_prefix)) {
+        return mond::write(s, mond::object<luna_user_proxy>(*_ref, *u));
     }
 
     return mond::write(s, mond::nil{});
@@ -77,9 +166,10 @@ int luna_unknown_user_proxy::match(lua_State* s) const
 
 ///
 // Channels
-luna_channel_proxy::luna_channel_proxy(luna& ref, std::string name)
+luna_channel_proxy::luna_channel_proxy(luna& ref, irc::channel const& channel)
     : _ref{&ref},
-      _name{std::move(name)}
+      _name{channel.name_atom()},
+      _handle{channel.handle()}
 {
 }
 
@@ -89,6 +179,11 @@ std::string luna_channel_proxy::name() const
     return lookup().name();
 }
 
+irc::atom luna_channel_proxy::name_atom() const
+{
+    return _name;
+}
+
 std::time_t luna_channel_proxy::created() const
 {
     return lookup().created();
@@ -102,22 +197,33 @@ std::tuple<
     return lookup().topic();
 }
 
+std::tuple<
+    std::uint64_t,
+    std::uint64_t,
+    std::uint64_t> luna_channel_proxy::generations() const
+{
+    irc::channel const& chan = lookup();
+
+    return std::make_tuple(
+        chan.member_generation(),
+        chan.mode_generation(),
+        chan.topic_generation());
+}
+
 
 int luna_channel_proxy::users(lua_State* s) const
 {
     lua_newtable(s);
     int table = lua_gettop(s);
 
-    for (auto const& u : lookup().users()) {
+    irc::channel const& chan = lookup();
+
+    for (auto const& u : chan.users()) {
         std::ostringstream prefix;
 
-        prefix << u.second->nick() << '!'
-            << u.second->user() << '@'
-            << u.second->host();
+        prefix << u.nick() << '!' << u.user() << '@' << u.host();
 
-        mond::write(s,
-            mond::object<luna_channel_user_proxy>(
-                *_ref, _name, u.second->uid()));
+        mond::write(s, mond::object<luna_channel_user_proxy>(*_ref, chan, u));
 
         lua_setfield(s, table, prefix.str().c_str());
     }
@@ -125,24 +231,39 @@ int luna_channel_proxy::users(lua_State* s) const
     return 1;
 }
 
+int luna_channel_proxy::next_user(lua_State* s) const
+{
+    lua_Integer cursor = luaL_optinteger(s, 2, 0);
+
+    if (cursor < 0) {
+        return luaL_argerror(s, 2, "cursor must not be negative");
+    }
+
+    irc::channel const& chan = lookup();
+    auto iter = chan.users().from(cursor);
+
+    if (iter == std::end(chan.users())) {
+        lua_pushnil(s);
+        return 1;
+    }
+
+    lua_pushinteger(s, iter.position() + 1);
+    mond::write(s, mond::object<luna_channel_user_proxy>(*_ref, chan, *iter));
+
+    return 2;
+}
+
 int luna_channel_proxy::find_user(lua_State* s) const
 {
     char const* qry = luaL_checkstring(s, 2);
 
-    auto u = std::find_if(
-        std::begin(lookup().users()),
-        std::end(lookup().users()),
-            [this, qry] (auto const& u2) {
-                return irc::rfc1459_equal(
-                    irc::normalize_nick(qry), u2.second->nick());
-            });
+    irc::channel const& chan = lookup();
 
-    if (u == std::end(lookup().users())) {
-        lua_pushnil(s);
-    } else {
+    if (irc::channel_user const* cu = chan.lookup_user(qry)) {
         mond::write(s,
-            mond::object<luna_channel_user_proxy>(
-                *_ref, _name, u->second->uid()));
+            mond::object<luna_channel_user_proxy>(*_ref, chan, *cu));
+    } else {
+        lua_pushnil(s);
     }
 
     return 1;
@@ -151,57 +272,232 @@ int luna_channel_proxy::find_user(lua_State* s) const
 
 int luna_channel_proxy::modes(lua_State* s) const
 {
-    /* mode_set['a'] ..., let's waste some space for the sake of simplicity */
-    bool mode_set[128] = {false};
+    irc::channel const& chan = lookup();
 
     lua_newtable(s);
     int table = lua_gettop(s);
 
-    for (auto& i : lookup().modes()) {
-        char mode              = i.first;
-        std::string const& arg = i.second;
+    for (auto& i : chan.modes()) {
+        std::string modestr{i.first};
 
-        std::string modestr{mode};
+        lua_pushstring(s, i.second.c_str());
+        lua_setfield(s, table, modestr.c_str());
+    }
 
-        irc::channel_mode_argument_type type =
-            _ref->environment().get_mode_argument_type(mode);
+    for (auto& i : chan.lists()) {
+        std::string modestr{i.first};
 
-        if (type == irc::channel_mode_argument_type::required_user_list) {
-            // Add to or create list
-            if (not mode_set[static_cast<int>(mode)]) {
-                mode_set[static_cast<int>(mode)] = true;
+        lua_createtable(s, i.second.size(), 0);
 
-                lua_newtable(s);
-                lua_pushvalue(s, -1);
-                lua_setfield(s, table, modestr.c_str());
-            } else {
-                lua_getfield(s, table, modestr.c_str());
-            }
+        int n = 0;
 
-            lua_pushstring(s, arg.c_str());
-            lua_rawseti(s, -2, lua_rawlen(s, -2) + 1);
-
-            lua_pop(s, 1);
-        } else {
-            // Set
-            lua_pushstring(s, arg.c_str());
-            lua_setfield(s, table, modestr.c_str());
+        for (irc::list_entry const& e : i.second) {
+            lua_pushstring(s, e.mask.c_str());
+            lua_rawseti(s, -2, ++n);
         }
+
+        lua_setfield(s, table, modestr.c_str());
+    }
+
+    return 1;
+}
+
+int luna_channel_proxy::list(lua_State* s) const
+{
+    char const* mode = luaL_checkstring(s, 2);
+
+    if ((mode[0] == '\0') or (mode[1] != '\0')) {
+        return luaL_argerror(s, 2, "expected a single mode character");
+    }
+
+    return mond::write(s,
+        mond::object<luna_channel_list_proxy>(*_ref, lookup(), mode[0]));
+}
+
+
+int luna_channel_proxy::match_users(lua_State* s) const
+{
+    char const* mask = luaL_checkstring(s, 2);
+
+    irc::channel const& chan = lookup();
+    auto users = chan.matching_users(mask);
+
+    lua_createtable(s, users.size(), 0);
+
+    int n = 0;
+
+    for (irc::channel_user const* cu : users) {
+        mond::write(s, mond::object<luna_channel_user_proxy>(*_ref, chan, *cu));
+
+        lua_rawseti(s, -2, ++n);
     }
 
     return 1;
 }
 
 
+int luna_channel_proxy::query_page(lua_State* s) const
+{
+    irc::member_query q = check_member_query(s, 2);
+
+    lua_Integer cursor = luaL_optinteger(s, 3, 0);
+    lua_Integer limit  = luaL_optinteger(s, 4, 64);
+
+    if (cursor < 0) {
+        return luaL_argerror(s, 3, "cursor must not be negative");
+    }
+
+    if (limit < 1) {
+        return luaL_argerror(s, 4, "limit must be positive");
+    }
+
+    irc::channel const& chan = lookup();
+
+    std::vector<irc::channel_user const*> users;
+    std::size_t next = chan.query(q, users, limit, cursor);
+
+    lua_createtable(s, users.size(), 0);
+
+    int n = 0;
+
+    for (irc::channel_user const* cu : users) {
+        mond::write(s, mond::object<luna_channel_user_proxy>(*_ref, chan, *cu));
+
+        lua_rawseti(s, -2, ++n);
+    }
+
+    if (next) {
+        lua_pushinteger(s, next);
+    } else {
+        lua_pushnil(s);
+    }
+
+    return 2;
+}
+
+
 irc::channel& luna_channel_proxy::lookup() const
 {
-    auto& channels = _ref->environment().channels();
+    return resolve_channel(*_ref, _name, _handle);
+}
+
+
+///
+// Channel list modes
+luna_channel_list_proxy::luna_channel_list_proxy(
+    luna& ref,
+    irc::channel const& channel,
+    char mode)
+
+    : _ref{&ref},
+      _channel{channel.name_atom()},
+      _handle{channel.handle()},
+      _mode{mode}
+{
+}
+
+
+std::string luna_channel_list_proxy::mode() const
+{
+    return std::string{_mode};
+}
+
+std::size_t luna_channel_list_proxy::size() const
+{
+    irc::list_mode const* list = lookup();
+
+    return list ? list->size() : 0;
+}
+
+
+int luna_channel_list_proxy::get(lua_State* s) const
+{
+    lua_Integer i = luaL_checkinteger(s, 2);
+    irc::list_mode const* list = lookup();
+
+    if (not list or (i < 1) or (static_cast<std::size_t>(i) > list->size())) {
+        lua_pushnil(s);
+        return 1;
+    }
+
+    return push_entry(s, (*list)[i - 1]);
+}
+
+int luna_channel_list_proxy::find(lua_State* s) const
+{
+    char const* mask = luaL_checkstring(s, 2);
+    irc::list_mode const* list = lookup();
+
+    irc::list_entry const* e = list ? list->find(mask) : nullptr;
+
+    if (not e) {
+        lua_pushnil(s);
+        return 1;
+    }
+
+    return push_entry(s, *e);
+}
+
+int luna_channel_list_proxy::matching(lua_State* s) const
+{
+    std::string who = luaL_checkstring(s, 2);
+    std::tuple<std::string, std::string, std::string> info;
+
+    // Either a full prefix, or the nick of a user we know the host of.
+    if (irc::is_user_prefix(who)) {
+        info = irc::split_prefix(who);
+    } else if (irc::network_user const* u =
+            _ref->environment().lookup_user(who)) {
+        info = std::make_tuple(u->nick(), u->user(), u->host());
+    } else {
+        return luaL_argerror(s, 2, "unknown user");
+    }
+
+    irc::list_mode const* list = lookup();
+
+    if (not list) {
+        lua_newtable(s);
+        return 1;
+    }
 
-    if (channels.find(_name) == std::end(channels)) {
-        throw mond::error{"no such channel: " + _name};
+    std::vector<std::size_t> matches =
+        resolve_channel(*_ref, _channel, _handle).list_matcher(_mode).match(
+            std::get<0>(info), std::get<1>(info), std::get<2>(info));
+
+    lua_createtable(s, matches.size(), 0);
+
+    int n = 0;
+
+    for (std::size_t i : matches) {
+        lua_pushstring(s, (*list)[i].mask.c_str());
+        lua_rawseti(s, -2, ++n);
     }
 
-    return *channels.at(_name);
+    return 1;
+}
+
+
+int luna_channel_list_proxy::channel(lua_State* s) const
+{
+    return mond::write(s, mond::object<luna_channel_proxy>(
+        *_ref, resolve_channel(*_ref, _channel, _handle)));
+}
+
+
+int luna_channel_list_proxy::push_entry(
+    lua_State* s,
+    irc::list_entry const& e) const
+{
+    lua_pushstring(s, e.mask.c_str());
+    lua_pushstring(s, e.setter.c_str());
+    lua_pushinteger(s, e.set_time);
+
+    return 3;
+}
+
+irc::list_mode const* luna_channel_list_proxy::lookup() const
+{
+    return resolve_channel(*_ref, _channel, _handle).find_list(_mode);
 }
 
 
@@ -209,12 +505,13 @@ irc::channel& luna_channel_proxy::lookup() const
 // Known channel users
 luna_channel_user_proxy::luna_channel_user_proxy(
     luna& ref,
-    std::string channel,
-    uint64_t uid)
+    irc::channel const& channel,
+    irc::channel_user const& user)
 
     : _ref{&ref},
-      _channel{std::move(channel)},
-      _uid{uid}
+      _channel{channel.name_atom()},
+      _handle{channel.handle()},
+      _user{user.network_user().handle()}
 {
 }
 
@@ -236,33 +533,44 @@ std::tuple<
 }
 
 
+std::string luna_channel_user_proxy::account() const
+{
+    return lookup().network_user().account();
+}
+
+
 std::string luna_channel_user_proxy::modes() const
 {
-    return lookup().modes();
+    return lookup_channel().user_modes(lookup());
+}
+
+std::string luna_channel_user_proxy::prefix() const
+{
+    char pref = lookup_channel().user_prefix(lookup());
+
+    return pref ? std::string{pref} : std::string{};
 }
 
 
 int luna_channel_user_proxy::channel(lua_State* s) const
 {
-    return mond::write(s, mond::object<luna_channel_proxy>(*_ref, _channel));
+    return mond::write(s, mond::object<luna_channel_proxy>(
+        *_ref, lookup_channel()));
 }
 
 
 int luna_channel_user_proxy::match(lua_State* s) const
 {
-    std::ostringstream pref;
-
     irc::channel_user const& cu = lookup();
 
-    pref << cu.nick() << '!' << cu.user() << '@' << cu.host();
+    std::string prefix = cu.nick();
+    prefix += '!';
+    prefix += cu.user();
+    prefix += '@';
+    prefix += cu.host();
 
-    auto i = std::find_if(std::begin(_ref->users()), std::end(_ref->users()),
-        [&pref] (luna_user& u) {
-            return u.matches(pref.str());
-        });
-
-    if (i != std::end(_ref->users())) {
-        return mond::write(s, mond::object<luna_user_proxy>(*_ref, i->id()));
+    if (luna_user const* u = _ref->match_user(prefix)) {
+        return mond::write(s, mond::object<luna_user_proxy>(*_ref, *u));
     }
 
     return mond::write(s, mond::nil{});
@@ -270,23 +578,21 @@ int luna_channel_user_proxy::match(lua_State* s) const
 
 
 
-irc::channel_user& luna_channel_user_proxy::lookup() const
+irc::channel& luna_channel_user_proxy::lookup_channel() const
 {
-    auto& channels = _ref->environment().channels();
+    return resolve_channel(*_ref, _channel, _handle);
+}
 
-    if (channels.find(_channel) == std::end(channels)) {
-        throw mond::error{"no such channel: " + _channel};
-    }
+irc::channel_user const& luna_channel_user_proxy::lookup() const
+{
+    irc::channel const& chan = lookup_channel();
 
-    for (auto& iter : channels.at(_channel)->users()) {
-        if (iter.second->uid() == _uid) {
-            return *(iter.second);
-        }
-    }
+    irc::network_user* user = _ref->environment().resolve(_user);
+    irc::channel_user const* cu = user ? chan.users().find(*user) : nullptr;
 
-    std::ostringstream err;
+    if (not cu) {
+        throw mond::error{"user no longer in channel " + chan.name()};
+    }
 
-    err << "user " << _uid << " not found in channel " << _channel;
-    throw mond::error{err.str()};
+    return *cu;
 }
-
@@ -21,9 +21,13 @@
 #ifndef LUNA_LUA_LUNA_CHANNEL_PROXY_HH_INCLUDED
 #define LUNA_LUA_LUNA_CHANNEL_PROXY_HH_INCLUDED
 
+#include <irc/atom.hh>
+#include <irc/handle_table.hh>
+
 #include <lua.hpp>
 
 #include <ctime>
+#include <cstddef>
 #include <cstdint>
 
 #include <string>
@@ -33,9 +37,18 @@ class luna;
 namespace irc {
     class channel;
     class channel_user;
+    class network_user;
+    class list_mode;
+    struct list_entry;
+    struct member_query;
 }
 
 
+// Reads a member filter table such as {prefix = "o", host = "*.example.net"}
+// from the given stack index, raising a Lua error for unknown keys.
+irc::member_query check_member_query(lua_State* s, int arg);
+
+
 class luna_unknown_user_proxy {
 public:
     static constexpr char const* metatable = "luna.unknown_user";
@@ -58,26 +71,72 @@ class luna_channel_proxy {
 public:
     static constexpr char const* metatable = "luna.channel";
 
-    luna_channel_proxy(luna& ref, std::string name);
+    // Channels are known by name: proxies follow a channel we rejoined, or
+    // one that was only known by name when the proxy was made.
+    luna_channel_proxy(luna& ref, irc::channel const& channel);
 
     std::string name() const;
+    irc::atom name_atom() const;
     std::time_t created() const;
     std::tuple<
         std::string,
         std::string,
         std::time_t> topic() const;
 
+    std::tuple<
+        std::uint64_t,
+        std::uint64_t,
+        std::uint64_t> generations() const;
+
     int     users(lua_State* s) const;
+    int next_user(lua_State* s) const;
     int find_user(lua_State* s) const;
 
     int modes(lua_State* s) const;
+    int  list(lua_State* s) const;
+
+    int match_users(lua_State* s) const;
+    int  query_page(lua_State* s) const;
 
 private:
     irc::channel& lookup() const;
 
 private:
     luna* _ref;
-    std::string _name;
+    irc::atom_ref _name;
+
+    mutable irc::handle<irc::channel> _handle;
+};
+
+
+class luna_channel_list_proxy {
+public:
+    static constexpr char const* metatable = "luna.channel.list";
+
+    luna_channel_list_proxy(luna& ref, irc::channel const& channel, char mode);
+
+    std::string mode() const;
+    std::size_t size() const;
+
+    int get(lua_State* s) const;
+    int find(lua_State* s) const;
+    int matching(lua_State* s) const;
+
+    int channel(lua_State* s) const;
+
+private:
+    int push_entry(lua_State* s, irc::list_entry const& e) const;
+
+    // nullptr while the list is empty
+    irc::list_mode const* lookup() const;
+
+private:
+    luna* _ref;
+
+    irc::atom_ref _channel;
+    mutable irc::handle<irc::channel> _handle;
+
+    char _mode;
 };
 
 
@@ -85,25 +144,33 @@ class luna_channel_user_proxy {
 public:
     static constexpr char const* metatable = "luna.channel.user";
 
-    luna_channel_user_proxy(luna& ref, std::string channel, uint64_t uid);
+    luna_channel_user_proxy(
+        luna& ref,
+        irc::channel const& channel,
+        irc::channel_user const& user);
 
     std::string repr() const;
 
     std::tuple<std::string, std::string, std::string> user_info() const;
+    std::string account() const;
     int match(lua_State* s) const;
 
     std::string modes() const;
+    std::string prefix() const;
     int channel(lua_State* s) const;
 
 
 private:
-    irc::channel_user& lookup() const;
+    irc::channel& lookup_channel() const;
+    irc::channel_user const& lookup() const;
 
 private:
     luna* _ref;
 
-    std::string _channel;
-    uint64_t _uid;
+    irc::atom_ref _channel;
+    mutable irc::handle<irc::channel> _handle;
+
+    irc::handle<irc::network_user> _user;
 
 };
 
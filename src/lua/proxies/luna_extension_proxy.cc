@@ -67,6 +67,27 @@ int luna_extension_proxy::is_self(lua_State* s) const
     return 1;
 }
 
+int luna_extension_proxy::memory_info(lua_State* s) const
+{
+    luna_script const* scr = dynamic_cast<luna_script const*>(&lookup());
+
+    if (not scr) {
+        lua_pushnil(s);
+        return 1;
+    }
+
+    script_allocator::counters const& c = scr->_alloc.stats();
+
+    lua_pushnumber(s, static_cast<lua_Number>(c.bytes));
+    lua_pushnumber(s, static_cast<lua_Number>(c.reserved));
+    lua_pushnumber(s, static_cast<lua_Number>(c.peak));
+    lua_pushnumber(s, static_cast<lua_Number>(c.allocations));
+    lua_pushnumber(s, static_cast<lua_Number>(c.failures));
+    lua_pushnumber(s, static_cast<lua_Number>(scr->_alloc.limit()));
+
+    return 6;
+}
+
 
 luna_extension& luna_extension_proxy::lookup() const
 {
@@ -42,6 +42,9 @@ public:
 
     int is_self(lua_State* s) const;
 
+    //! Memory used by a Lua script's state, nil for other extensions.
+    int memory_info(lua_State* s) const;
+
 private:
     luna_extension& lookup() const;
 
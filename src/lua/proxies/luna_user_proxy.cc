@@ -19,7 +19,6 @@
 
 #include "luna_user_proxy.hh"
 
-#include "config.hh"
 #include "luna.hh"
 #include "luna_user.hh"
 
@@ -31,9 +30,9 @@
 #include <utility>
 
 
-luna_user_proxy::luna_user_proxy(luna& ref, std::string id)
+luna_user_proxy::luna_user_proxy(luna& ref, luna_user const& user)
     : _ref{&ref},
-      _id{std::move(id)}
+      _handle{user.handle()}
 {
 }
 
@@ -64,8 +63,7 @@ void luna_user_proxy::set_id(std::string id)
     luna_user& user = lookup();
 
     user.set_id(id);
-    _id = id;
-    _ref->save_users(userfile);
+    _ref->users_changed();
 }
 
 void luna_user_proxy::set_hostmask(std::string hostmask)
@@ -73,7 +71,7 @@ void luna_user_proxy::set_hostmask(std::string hostmask)
     luna_user& user = lookup();
 
     user.set_hostmask(hostmask);
-    _ref->save_users(userfile);
+    _ref->users_changed();
 }
 
 void luna_user_proxy::set_title(std::string title)
@@ -81,7 +79,7 @@ void luna_user_proxy::set_title(std::string title)
     luna_user& user = lookup();
 
     user.set_title(title);
-    _ref->save_users(userfile);
+    _ref->users_modified();
 }
 
 void luna_user_proxy::set_flags(std::string flags)
@@ -89,19 +87,16 @@ void luna_user_proxy::set_flags(std::string flags)
     luna_user& user = lookup();
 
     user.set_flags(flags_from_string(flags));
-    _ref->save_users(userfile);
+    _ref->users_modified();
 }
 
 
 luna_user& luna_user_proxy::lookup() const
 {
-    auto u = std::find_if(std::begin(_ref->users()), std::end(_ref->users()),
-        [this] (luna_user& u2) {
-            return u2.id() == _id;
-        });
+    luna_user* u = _ref->resolve(_handle);
 
-    if (u == std::end(_ref->users())) {
-        throw mond::error{"no such user: " + _id};
+    if (not u) {
+        throw mond::error{"user has been removed"};
     }
 
     return *u;
@@ -21,6 +21,8 @@
 #ifndef LUNA_LUA_LUNA_USER_PROXY_HH_INCLUDED
 #define LUNA_LUA_LUNA_USER_PROXY_HH_INCLUDED
 
+#include <irc/handle_table.hh>
+
 #include <string>
 
 class luna;
@@ -30,7 +32,7 @@ class luna_user_proxy {
 public:
     static constexpr char const* metatable = "luna.user";
 
-    luna_user_proxy(luna& ref, std::string id);
+    luna_user_proxy(luna& ref, luna_user const& user);
 
     std::string id() const;
     std::string hostmask() const;
@@ -47,7 +49,7 @@ private:
 
 private:
     luna* _ref;
-    std::string _id;
+    irc::handle<luna_user> _handle;
 };
 
 #endif // defined LUNA_LUA_LUNA_USER_PROXY_HH_INCLUDED
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "script_allocator.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+
+constexpr std::size_t script_allocator::max_pooled;
+constexpr std::size_t script_allocator::chunk_size;
+constexpr std::size_t script_allocator::class_count;
+
+
+script_allocator::script_allocator(std::size_t limit)
+    : _limit{limit}
+{
+}
+
+script_allocator::~script_allocator()
+{
+    for (void* chunk : _chunks) {
+        std::free(chunk);
+    }
+
+    for (auto const& block : _loose) {
+        std::free(block.first);
+    }
+}
+
+void* script_allocator::alloc(
+    void* ud,
+    void* ptr,
+    std::size_t osize,
+    std::size_t nsize)
+{
+    script_allocator& a = *static_cast<script_allocator*>(ud);
+
+    // Without a block, osize tells what kind of object is to be allocated
+    if (not ptr) {
+        return nsize ? a.allocate(nsize) : nullptr;
+    }
+
+    if (nsize == 0) {
+        a.deallocate(ptr, osize);
+        return nullptr;
+    }
+
+    return a.reallocate(ptr, osize, nsize);
+}
+
+script_allocator::counters const& script_allocator::stats() const
+{
+    return _stats;
+}
+
+std::size_t script_allocator::limit() const
+{
+    return _limit;
+}
+
+void script_allocator::set_limit(std::size_t limit)
+{
+    _limit = limit;
+}
+
+void* script_allocator::allocate(std::size_t size)
+{
+    void* p = take(size);
+
+    if (not p) {
+        ++_stats.failures;
+        return nullptr;
+    }
+
+    ++_stats.allocations;
+    _stats.bytes += size;
+
+    return p;
+}
+
+void script_allocator::deallocate(void* ptr, std::size_t size)
+{
+    give(ptr, size);
+
+    _stats.bytes -= size;
+}
+
+void* script_allocator::reallocate(
+    void* ptr,
+    std::size_t osize,
+    std::size_t nsize)
+{
+    bool opooled = osize <= max_pooled;
+    bool npooled = nsize <= max_pooled;
+
+    void* p;
+
+    if (opooled and npooled and size_class(osize) == size_class(nsize)) {
+        p = ptr;
+    } else if (not opooled and not npooled) {
+        p = (nsize <= osize or fits(nsize - osize))
+            ? std::realloc(ptr, nsize)
+            : nullptr;
+
+        if (p) {
+            _stats.reserved -= osize;
+            reserve(nsize);
+        }
+    } else if ((p = take(nsize))) {
+        std::memcpy(p, ptr, std::min(osize, nsize));
+        give(ptr, osize);
+    } else if (not opooled) {
+        // A large block shrinking into the pooled range while the pool has
+        // no room left: malloc() keeps it, and it has to go back to free()
+        try {
+            _loose.reserve(_loose.size() + 1);
+        } catch (std::bad_alloc const&) {
+            ++_stats.failures;
+            return nullptr;
+        }
+
+        _loose.emplace_back(ptr, osize);
+
+        if (void* q = std::realloc(ptr, nsize)) {
+            _loose.back() = {q, nsize};
+            _stats.reserved -= osize - nsize;
+        }
+
+        p = _loose.back().first;
+    }
+
+    if (not p) {
+        // Lua relies on shrinking to always work, and the block is large
+        // enough. Freed with its new size, it only ends up in a smaller
+        // class.
+        if (nsize < osize) {
+            _stats.bytes -= osize - nsize;
+            return ptr;
+        }
+
+        ++_stats.failures;
+        return nullptr;
+    }
+
+    _stats.bytes = _stats.bytes - osize + nsize;
+
+    return p;
+}
+
+void* script_allocator::take(std::size_t size)
+{
+    if (size > max_pooled) {
+        void* p = fits(size) ? std::malloc(size) : nullptr;
+
+        if (p) {
+            reserve(size);
+        }
+
+        return p;
+    }
+
+    std::size_t cls = size_class(size);
+
+    if (free_block* b = _free[cls]) {
+        _free[cls] = b->next;
+        return b;
+    }
+
+    std::size_t bytes = class_size(cls);
+
+    if (static_cast<std::size_t>(_bump_end - _bump) < bytes) {
+        // What is left of the old chunk is too small for this class, but
+        // not for smaller ones
+        while (static_cast<std::size_t>(_bump_end - _bump) >= 16) {
+            std::size_t rest = std::min<std::size_t>(
+                _bump_end - _bump, max_pooled);
+            std::size_t c = size_class(rest);
+
+            if (class_size(c) > rest) {
+                --c;
+            }
+
+            give(_bump, class_size(c));
+            _bump += class_size(c);
+        }
+
+        char* chunk = fits(chunk_size)
+            ? static_cast<char*>(std::malloc(chunk_size))
+            : nullptr;
+
+        if (not chunk) {
+            return nullptr;
+        }
+
+        _chunks.push_back(chunk);
+        reserve(chunk_size);
+
+        _bump = chunk;
+        _bump_end = chunk + chunk_size;
+    }
+
+    void* p = _bump;
+    _bump += bytes;
+
+    return p;
+}
+
+void script_allocator::give(void* ptr, std::size_t size)
+{
+    if (size > max_pooled) {
+        std::free(ptr);
+        _stats.reserved -= size;
+        return;
+    }
+
+    if (not _loose.empty()) {
+        auto it = std::find_if(std::begin(_loose), std::end(_loose),
+            [ptr] (std::pair<void*, std::size_t> const& block) {
+                return block.first == ptr;
+            });
+
+        if (it != std::end(_loose)) {
+            std::free(ptr);
+            _stats.reserved -= it->second;
+
+            *it = _loose.back();
+            _loose.pop_back();
+            return;
+        }
+    }
+
+    std::size_t cls = size_class(size);
+
+    _free[cls] = new (ptr) free_block{_free[cls]};
+}
+
+bool script_allocator::fits(std::size_t size) const
+{
+    return not _limit
+        or size <= _limit - std::min(_limit, _stats.reserved);
+}
+
+void script_allocator::reserve(std::size_t size)
+{
+    _stats.reserved += size;
+    _stats.peak = std::max(_stats.peak, _stats.reserved);
+}
+
+std::size_t script_allocator::size_class(std::size_t size)
+{
+    if (size <= 128) {
+        return (size + 15) / 16 - 1;
+    } else if (size <= 256) {
+        return 8 + (size - 128 + 31) / 32 - 1;
+    } else {
+        return 12 + (size - 256 + 63) / 64 - 1;
+    }
+}
+
+std::size_t script_allocator::class_size(std::size_t cls)
+{
+    if (cls < 8) {
+        return (cls + 1) * 16;
+    } else if (cls < 12) {
+        return 128 + (cls - 7) * 32;
+    } else {
+        return 256 + (cls - 11) * 64;
+    }
+}
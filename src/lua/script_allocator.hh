@@ -0,0 +1,117 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_LUA_SCRIPT_ALLOCATOR_HH_INCLUDED
+#define LUNA_LUA_SCRIPT_ALLOCATOR_HH_INCLUDED
+
+#include <array>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+/*! \brief Memory for one script's Lua state, counted and optionally capped.
+ *
+ * Lua allocates lots of small, short lived blocks (strings, tables,
+ * closures) and tells the allocator their size when freeing them. Blocks up
+ * to max_pooled bytes are rounded up to a size class and kept in free lists
+ * per class, carved from larger chunks; anything bigger goes to malloc.
+ * The pool only ever takes back blocks it carved itself.
+ * Chunks are only given back when the allocator is destroyed, after the
+ * state.
+ *
+ * The limit applies to what the allocator holds, chunks and malloc()ed
+ * blocks, rather than to what Lua asked for: blocks freed to the pool still
+ * count, as does what rounding up to size classes wastes. Allocations that
+ * would take the script over it fail, which Lua reports as a "not enough
+ * memory" error in the script.
+ */
+class script_allocator {
+public:
+    struct counters {
+        std::size_t bytes = 0;       //!< In use right now, as requested
+        std::size_t reserved = 0;    //!< Held in chunks and malloc()ed blocks
+        std::size_t peak = 0;        //!< Most bytes ever reserved at once
+        std::uint64_t allocations = 0;
+        std::uint64_t failures = 0;  //!< Allocations refused or failed
+    };
+
+    static constexpr std::size_t max_pooled = 512;
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    //! \param limit Most bytes reserved at once, 0 for no limit.
+    explicit script_allocator(std::size_t limit = 0);
+    ~script_allocator();
+
+    script_allocator(script_allocator const&)            = delete;
+    script_allocator& operator=(script_allocator const&) = delete;
+
+    //! A lua_Alloc, with the allocator as `ud'.
+    static void* alloc(void* ud, void* ptr, std::size_t osize,
+        std::size_t nsize);
+
+    counters const& stats() const;
+
+    std::size_t limit() const;
+    void set_limit(std::size_t limit);
+
+private:
+    void* allocate(std::size_t size);
+    void deallocate(void* ptr, std::size_t size);
+    void* reallocate(void* ptr, std::size_t osize, std::size_t nsize);
+
+    // A block of `size' bytes from the pool or malloc, and back. Only
+    // counts what is reserved, and fails if that would exceed the limit.
+    void* take(std::size_t size);
+    void give(void* ptr, std::size_t size);
+
+    // Whether `size' more bytes may be reserved, and reserving them
+    bool fits(std::size_t size) const;
+    void reserve(std::size_t size);
+
+    static std::size_t size_class(std::size_t size);
+    static std::size_t class_size(std::size_t cls);
+
+private:
+    // 16 byte steps up to 128, then 32 byte steps up to 256 and 64 byte
+    // steps up to 512
+    static constexpr std::size_t class_count = 8 + 4 + 4;
+
+    struct free_block {
+        free_block* next;
+    };
+
+    std::array<free_block*, class_count> _free{};
+
+    // Unused rest of the newest chunk
+    char* _bump = nullptr;
+    char* _bump_end = nullptr;
+
+    std::vector<void*> _chunks;
+
+    // Blocks of pooled size that malloc() holds, with the size it holds:
+    // large blocks shrunk while the pool had no room. Nearly always empty.
+    std::vector<std::pair<void*, std::size_t>> _loose;
+
+    std::size_t _limit;
+    counters _stats;
+};
+
+#endif // defined LUNA_LUA_SCRIPT_ALLOCATOR_HH_INCLUDED
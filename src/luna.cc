@@ -32,6 +32,7 @@
 #include <irc/irc_except.hh>
 #include <irc/irc_helpers.hh>
 #include <irc/environment.hh>
+#include <irc/network_user.hh>
 
 #include <mond/mond.hh>
 
@@ -72,22 +73,24 @@ std::string get_compiler_string()
 }
 
 luna::luna(std::string const& cfgfile)
-    : irc::client{"", "", ""}
+    : irc::client{"", "", ""},
+      _shared_log{varlog, varsnapshot},
+      _user_store{userdb}
 {
-    read_shared_vars(varfile);
-    read_users(userfile);
+    read_shared_vars();
+    read_users();
 
     // TODO: idle_interval in config
     set_idle_interval(idle_interval);
 
-    luna_extension::shared_vars["luna.version"]  = luna_version;
-    luna_extension::shared_vars["luna.compiled"] = __DATE__ " " __TIME__;
-    luna_extension::shared_vars["luna.compiler"] = get_compiler_string();
+    set_shared_var("luna.version",  luna_version);
+    set_shared_var("luna.compiled", __DATE__ " " __TIME__);
+    set_shared_var("luna.compiler", get_compiler_string());
 
     if (luna_extension::shared_vars.find("luna.trigger") ==
             std::end(luna_extension::shared_vars)) {
 
-        luna_extension::shared_vars["luna.trigger"] = "!";
+        set_shared_var("luna.trigger", "!");
     }
 
     read_config(cfgfile);
@@ -96,8 +99,9 @@ luna::luna(std::string const& cfgfile)
 
 luna::~luna()
 {
-    save_users(userfile);
-    save_shared_vars(varfile);
+    if (_users_dirty) {
+        save_users();
+    }
 }
 
 
@@ -148,10 +152,45 @@ void luna::read_config(std::string const& filename)
         }
     }
 
+    if (auto v = s["journal_socket"]) {
+        _journal_socket = std::make_unique<journal_socket>(
+            v.get<std::string>());
+    }
+
     if (auto autojoin = s["autojoin"]) {
         _autojoin = autojoin.get<std::vector<std::string>>();
     }
 
+    if (auto v = s["script_memory_limit"]) {
+        _script_memory_limit = v.get<std::size_t>() * 1024 * 1024;
+    }
+
+    ingress_filter::limits ingress = _ingress.get_limits();
+
+    using num_type = tokenbucket::num_type;
+
+    if (auto v = s["ingress_burst"]) { ingress.burst = v.get<num_type>(); }
+    if (auto v = s["ingress_rate"])  { ingress.rate  = v.get<num_type>(); }
+
+    if (auto v = s["ingress_sources"]) {
+        ingress.sources = v.get<std::size_t>();
+    }
+
+    if (auto v = s["ingress_offenders"]) {
+        ingress.offenders = v.get<std::size_t>();
+    }
+
+    if (auto v = s["ingress_penalty"]) {
+        ingress.penalty = std::chrono::seconds{v.get<int>()};
+    }
+
+    if (not ingress.burst or not ingress.rate or not ingress.sources) {
+        throw std::runtime_error{
+            "ingress_burst, ingress_rate and ingress_sources must not be 0"};
+    }
+
+    _ingress.set_limits(ingress);
+
     if (auto scripts = s["scripts"]) {
         _logger.info() << "Loading scripts...";
 
@@ -167,18 +206,86 @@ void luna::read_config(std::string const& filename)
     _logger.info() << "  server host: " << _server;
     _logger.info() << "  server port: " << _port;
     _logger.info() << "  use SSL....: " << (use_ssl() ? "yes" : "no");
+
+    if (_script_memory_limit) {
+        _logger.info() << "  script mem.: "
+                       << _script_memory_limit / (1024 * 1024) << " MiB";
+    }
+
+    _logger.info() << "  ingress....: "
+                   << ingress.burst << " burst, " << ingress.rate << "/s, "
+                   << ingress.penalty.count() << " s penalty";
+
+    if (_journal_socket) {
+        _logger.info() << "  journal....: " << _journal_socket->path();
+    }
 }
 
 
-void luna::read_shared_vars(std::string const& filename)
+void luna::read_shared_vars()
 {
     _logger.info() << "Reading shared variables";
 
+    bool found = _shared_log.open(luna_extension::shared_vars);
+
+    std::string err = _shared_log.take_error();
+
+    if (not err.empty()) {
+        _logger.warn() << "  " << err;
+    }
+
+    if (not found) {
+        import_shared_vars(varfile);
+    }
+
+    ++luna_extension::shared_vars_version;
+}
+
+void luna::reload_shared_vars()
+{
+    _shared_log.reload(luna_extension::shared_vars);
+
+    ++luna_extension::shared_vars_version;
+}
+
+void luna::save_shared_vars()
+{
+    _shared_log.sync();
+}
+
+void luna::set_shared_var(std::string const& key, std::string const& value)
+{
+    auto it = luna_extension::shared_vars.find(key);
+
+    // Scripts like to set what is already there
+    if (it != std::end(luna_extension::shared_vars) and it->second == value) {
+        return;
+    }
+
+    luna_extension::shared_vars[key] = value;
+    ++luna_extension::shared_vars_version;
+
+    _shared_log.set(key, value);
+}
+
+void luna::clear_shared_var(std::string const& key)
+{
+    if (luna_extension::shared_vars.erase(key)) {
+        ++luna_extension::shared_vars_version;
+
+        _shared_log.erase(key);
+    }
+}
+
+void luna::import_shared_vars(std::string const& filename)
+{
     std::ifstream shared{filename};
 
     if (not shared) {
-        _logger.error()
-            << "  Error loading shared variables: " << std::strerror(errno);
+        if (errno != ENOENT) {
+            _logger.error()
+                << "  Error loading shared variables: " << std::strerror(errno);
+        }
 
         return;
     }
@@ -211,13 +318,37 @@ void luna::read_shared_vars(std::string const& filename)
             }
         }
 
-        luna_extension::shared_vars[key] = rvalue;
+        set_shared_var(key, rvalue);
+    }
+
+    _logger.info() << "  Imported `" << filename << "'";
+}
+
+void luna::read_users()
+{
+    _logger.info() << "Reading userlist `" << userdb << "'";
+
+    std::vector<user_store::entry> entries;
+
+    if (not _user_store.load(entries)) {
+        import_users(userfile);
+        return;
     }
+
+    for (user_store::entry& e : entries) {
+        add_user(luna_user{
+            std::move(e.id), std::move(e.hostmask), std::move(e.title),
+            e.flags});
+    }
+
+    _users_dirty = false;
+
+    _logger.info() << "  Loaded " << entries.size() << " users";
 }
 
-void luna::read_users(std::string const& filename)
+void luna::import_users(std::string const& filename)
 {
-    _logger.info() << "Reading userlist `" << filename << "'";
+    _logger.info() << "Importing userlist `" << filename << "'";
 
     std::ifstream userlist{filename};
 
@@ -226,6 +357,8 @@ void luna::read_users(std::string const& filename)
         return;
     }
 
+    clear_users();
+
     int lineno = 0;
 
     std::string line;
@@ -253,35 +386,18 @@ void luna::read_users(std::string const& filename)
 
         _logger.info() << "  Loaded user: " << "`" << id << "': " << hostmask;
 
-        _users.emplace_back(id, hostmask, title, flags_from_string(flags));
+        add_user(luna_user{id, hostmask, title, flags_from_string(flags)});
     }
 }
 
 
-void luna::save_shared_vars(std::string const& filename)
+void luna::save_users()
 {
-    std::ofstream shared{filename};
-
-    for (auto const& i : luna_extension::shared_vars) {
-        std::string val;
-
-        val.reserve(i.second.size());
-
-        for (char c : i.second) {
-            switch (c) {
-            case '\r': val.append("\\r");  break;
-            case '\n': val.append("\\n");  break;
-            case '\\': val.append("\\\\"); break;
-            default:   val.push_back(c);
-            }
-        }
-
-        shared << std::quoted(i.first) << " "
-               << std::quoted(val)     << std::endl;
-    }
+    _user_store.save(_users);
+    _users_dirty = false;
 }
 
-void luna::save_users(std::string const& filename)
+void luna::export_users(std::string const& filename)
 {
     std::ofstream userlist{filename};
 
@@ -300,11 +416,117 @@ std::vector<std::unique_ptr<luna_extension>> const& luna::extensions()
     return _exts;
 }
 
-std::vector<luna_user>& luna::users()
+std::list<luna_user> const& luna::users() const
 {
     return _users;
 }
 
+luna_user& luna::add_user(luna_user user)
+{
+    _users.push_back(std::move(user));
+
+    luna_user& res = _users.back();
+    res._handle = _user_handles.insert(res);
+
+    _user_index.invalidate();
+    users_modified();
+
+    return res;
+}
+
+void luna::remove_user(luna_user const& user)
+{
+    auto iter = std::find_if(std::begin(_users), std::end(_users),
+        [&user] (luna_user const& u) {
+            return &u == &user;
+        });
+
+    if (iter != std::end(_users)) {
+        _user_handles.erase(iter->_handle);
+        _users.erase(iter);
+
+        _user_index.invalidate();
+        users_modified();
+    }
+}
+
+void luna::clear_users()
+{
+    _user_handles.clear();
+    _users.clear();
+
+    _user_index.invalidate();
+    users_modified();
+}
+
+luna_user* luna::resolve(irc::handle<luna_user> h) const
+{
+    return _user_handles.get(h);
+}
+
+luna_user* luna::find_user(std::string const& id)
+{
+    return _user_index.find(id);
+}
+
+luna_user* luna::match_user(std::string const& prefix)
+{
+    return _user_index.match(prefix);
+}
+
+void luna::users_changed()
+{
+    _user_index.invalidate();
+    users_modified();
+}
+
+void luna::users_modified()
+{
+    if (not _users_dirty) {
+        _users_dirty = true;
+        _users_dirty_since = std::chrono::steady_clock::now();
+    }
+}
+
+
+void luna::interests_changed()
+{
+    _subscribers_dirty = true;
+}
+
+void luna::collect_subscribers()
+{
+    for (std::size_t ev = 0; ev < luna_extension::event_count; ++ev) {
+        std::vector<std::size_t>& subs = _subscribers[ev];
+
+        subs.clear();
+
+        for (std::size_t i = 0; i < _exts.size(); ++i) {
+            if (_exts[i] and _exts[i]->interested_in(
+                    static_cast<luna_extension::event>(ev))) {
+                subs.push_back(i);
+            }
+        }
+    }
+
+    _subscribers_dirty = false;
+}
+
+void luna::compact_extensions()
+{
+    _exts.erase(
+        std::remove_if(std::begin(_exts), std::end(_exts),
+            [] (std::unique_ptr<luna_extension> const& scr) {
+                return not scr;
+            }),
+        std::end(_exts));
+
+    _exts_unloaded = false;
+
+    // Indices have moved
+    collect_subscribers();
+}
+
 
 void luna::run()
 {
@@ -328,6 +550,8 @@ void luna::load_script(std::string const& script)
         _exts.push_back(std::move(s));
         _exts.back()->init();
 
+        interests_changed();
+
     } catch (mond::runtime_error const& e) {
         _logger.error() << "  Could not load script `" << script << "': "
                         << "Lua error: " << e.what();
@@ -342,13 +566,18 @@ void luna::on_message(irc::message const& msg)
 {
     _logger.debug() << "<< " << msg;
 
+    if (not admit(msg)) {
+        return;
+    }
+
     if (irc::rfc1459_equal(msg.command, irc::command::INVITE)) {
         if (msg.args.size() > 0) {
             on_invite(msg.prefix, msg.args[1]);
         }
 
     } else if (irc::rfc1459_equal(msg.command, irc::command::JOIN)) {
-        if (msg.args.size() > 0) {
+        if (msg.args.size() > 0
+                and not _netsplits.join(msg.prefix, msg.args[0])) {
             on_join(msg.prefix, msg.args[0]);
         }
 
@@ -358,7 +587,9 @@ void luna::on_message(irc::message const& msg)
         }
 
     } else if (irc::rfc1459_equal(msg.command, irc::command::QUIT)) {
-        if (msg.args.size() > 0) {
+        if (msg.args.size() > 0
+                and not _netsplits.quit(
+                    msg.prefix, msg.args[0], user_channels(msg.prefix))) {
             on_quit(msg.prefix, msg.args[0]);
         }
 
@@ -411,11 +642,13 @@ void luna::on_message(irc::message const& msg)
             }
         }
     } else if (irc::rfc1459_equal(msg.command, irc::command::RPL_ENDOFWHO)) {
-        dispatch_event(&luna_extension::on_channel_sync,
+        dispatch_channel_event(luna_extension::event::channel_sync,
+            msg.args[1], &luna_extension::on_channel_sync,
             msg.args[1], luna_extension::sync_type::users);
 
     } else if (irc::rfc1459_equal(msg.command, irc::command::RPL_ENDOFBANLIST)) {
-        dispatch_event(&luna_extension::on_channel_sync,
+        dispatch_channel_event(luna_extension::event::channel_sync,
+            msg.args[1], &luna_extension::on_channel_sync,
             msg.args[1], luna_extension::sync_type::bans);
 
     }
@@ -436,14 +669,19 @@ void luna::on_connect()
 
     _connected = std::time(nullptr);
 
-    dispatch_event(&luna_extension::on_connect);
+    dispatch_event(luna_extension::event::connect, &luna_extension::on_connect);
 }
 
 void luna::on_disconnect()
 {
     _logger.info() << "Disconnected.";
 
-    dispatch_event(&luna_extension::on_disconnect);
+    _mode_batch.clear();
+    _netsplits.clear();
+    _ingress.clear();
+
+    dispatch_event(
+        luna_extension::event::disconnect, &luna_extension::on_disconnect);
 
     _connected = 0;
 
@@ -454,9 +692,31 @@ void luna::on_disconnect()
 
 void luna::on_idle()
 {
+    flush_modes();
     work_through_queue();
 
-    dispatch_event(&luna_extension::on_idle);
+    on_netsplits();
+
+    if (_journal_socket) {
+        _journal_socket->pump(journal());
+    }
+
+    std::string err = _shared_log.take_error();
+
+    if (not err.empty()) {
+        _logger.error() << "Shared variables: " << err;
+    }
+
+    if (_users_dirty and std::chrono::steady_clock::now() - _users_dirty_since
+            >= std::chrono::milliseconds{users_save_delay}) {
+        save_users();
+    }
+
+    if (not (err = _user_store.take_error()).empty()) {
+        _logger.error() << "Users: " << err;
+    }
+
+    dispatch_event(luna_extension::event::idle, &luna_extension::on_idle);
 }
 
 
@@ -466,18 +726,21 @@ void luna::on_raw(irc::message const& msg)
     _bytes_recvd += n;
     _bytes_recvd_sess += n;
 
-    dispatch_event(&luna_extension::on_message, msg);
+    dispatch_event(
+        luna_extension::event::message, &luna_extension::on_message, msg);
 }
 
 
 void luna::on_invite(std::string const& source, std::string const& channel)
 {
-    dispatch_event(&luna_extension::on_invite, source, channel);
+    dispatch_channel_event(luna_extension::event::invite, channel,
+        &luna_extension::on_invite, source, channel);
 }
 
 void luna::on_join(std::string const& source, std::string const& channel)
 {
-    dispatch_event(&luna_extension::on_join, source, channel);
+    dispatch_channel_event(luna_extension::event::join, channel,
+        &luna_extension::on_join, source, channel);
 }
 
 void luna::on_part(
@@ -485,17 +748,20 @@ void luna::on_part(
     std::string const& channel,
     std::string const& reason)
 {
-    dispatch_event(&luna_extension::on_part, source, channel, reason);
+    dispatch_channel_event(luna_extension::event::part, channel,
+        &luna_extension::on_part, source, channel, reason);
 }
 
 void luna::on_quit(std::string const& source, std::string const& reason)
 {
-    dispatch_event(&luna_extension::on_quit, source, reason);
+    dispatch_event(luna_extension::event::quit,
+        &luna_extension::on_quit, source, reason);
 }
 
 void luna::on_nick(std::string const& source, std::string const& new_nick)
 {
-    dispatch_event(&luna_extension::on_nick, source, new_nick);
+    dispatch_event(luna_extension::event::nick,
+        &luna_extension::on_nick, source, new_nick);
 }
 
 void luna::on_kick(
@@ -504,7 +770,8 @@ void luna::on_kick(
     std::string const& kicked,
     std::string const& reason)
 {
-    dispatch_event(&luna_extension::on_kick, source, channel, kicked, reason);
+    dispatch_channel_event(luna_extension::event::kick, channel,
+        &luna_extension::on_kick, source, channel, kicked, reason);
 }
 
 void luna::on_topic(
@@ -512,7 +779,8 @@ void luna::on_topic(
     std::string const& channel,
     std::string const& new_topic)
 {
-    dispatch_event(&luna_extension::on_topic, source, channel, new_topic);
+    dispatch_channel_event(luna_extension::event::topic, channel,
+        &luna_extension::on_topic, source, channel, new_topic);
 }
 
 void luna::on_privmsg(
@@ -520,7 +788,8 @@ void luna::on_privmsg(
     std::string const& target,
     std::string const& msg)
 {
-    dispatch_event(&luna_extension::on_privmsg, source, target, msg);
+    dispatch_channel_event(luna_extension::event::privmsg, target,
+        &luna_extension::on_privmsg, source, target, msg);
 }
 
 void luna::on_notice(
@@ -528,7 +797,8 @@ void luna::on_notice(
     std::string const& target,
     std::string const& msg)
 {
-    dispatch_event(&luna_extension::on_notice, source, target, msg);
+    dispatch_channel_event(luna_extension::event::notice, target,
+        &luna_extension::on_notice, source, target, msg);
 }
 
 void luna::on_ctcp_request(
@@ -539,8 +809,8 @@ void luna::on_ctcp_request(
 {
     handle_core_ctcp(source, target, ctcp, args);
 
-    dispatch_event(&luna_extension::on_ctcp_request,
-        source, target, ctcp, args);
+    dispatch_channel_event(luna_extension::event::ctcp_request, target,
+        &luna_extension::on_ctcp_request, source, target, ctcp, args);
 }
 
 void luna::on_ctcp_response(
@@ -549,8 +819,8 @@ void luna::on_ctcp_response(
     std::string const& ctcp,
     std::string const& args)
 {
-    dispatch_event(&luna_extension::on_ctcp_response,
-        source, target, ctcp, args);
+    dispatch_channel_event(luna_extension::event::ctcp_response, target,
+        &luna_extension::on_ctcp_response, source, target, ctcp, args);
 }
 
 void luna::on_mode(
@@ -559,7 +829,26 @@ void luna::on_mode(
     std::string const& mode,
     std::string const& arg)
 {
-    dispatch_event(&luna_extension::on_mode, source, target, mode, arg);
+    dispatch_channel_event(luna_extension::event::mode, target,
+        &luna_extension::on_mode, source, target, mode, arg);
+}
+
+void luna::on_netsplits()
+{
+    for (irc::netsplit_event const& ev : _netsplits.flush()) {
+        _logger.info()
+            << (ev.type == irc::netsplit_event::kind::split
+                ? "Netsplit" : "Netjoin") << " between " << ev.server1
+            << " and " << ev.server2 << ": " << ev.users.size() << " users";
+
+        if (ev.type == irc::netsplit_event::kind::split) {
+            dispatch_event(luna_extension::event::netsplit,
+                &luna_extension::on_netsplit, ev);
+        } else {
+            dispatch_event(luna_extension::event::netjoin,
+                &luna_extension::on_netjoin, ev);
+        }
+    }
 }
 
 
@@ -589,6 +878,29 @@ void luna::pretty_print_exception(std::exception_ptr p, int lvl) const
 }
 
 
+bool luna::admit(irc::message const& msg)
+{
+    // Only what users say to us or channels, everything else keeps scripts'
+    // idea of the network in sync
+    if (not irc::is_user_prefix(msg.prefix)
+            or not (irc::rfc1459_equal(msg.command, irc::command::PRIVMSG)
+                 or irc::rfc1459_equal(msg.command, irc::command::NOTICE)
+                 or irc::rfc1459_equal(msg.command, irc::command::INVITE))) {
+        return true;
+    }
+
+    bool honor_ignores = luna_extension::shared_vars.count("luna.auto_ignore");
+    std::uint64_t offenders = _ingress.stats().offenders;
+
+    ingress_filter::verdict v = _ingress.check(msg.prefix, honor_ignores);
+
+    if (_ingress.stats().offenders != offenders) {
+        _logger.warn() << "Ignoring " << msg.prefix << " for flooding";
+    }
+
+    return v == ingress_filter::verdict::pass;
+}
+
 void luna::handle_core_ctcp(
     std::string const& prefix,
     std::string const& target,
@@ -601,6 +913,15 @@ void luna::handle_core_ctcp(
         std::tie(rtarget, std::ignore, std::ignore) = irc::split_prefix(prefix);
     }
 
+    bool core = irc::rfc1459_equal(ctcp, "VERSION")
+             or irc::rfc1459_equal(ctcp, "PING")
+             or irc::rfc1459_equal(ctcp, "TIME");
+
+    // Many hosts asking at once still add up to a flood of replies
+    if (not core or not _ingress.allow_ctcp_reply()) {
+        return;
+    }
+
 
     if (irc::rfc1459_equal(ctcp, "VERSION")) {
         std::ostringstream version_reply;
@@ -695,6 +1016,30 @@ void luna::work_through_queue()
     }
 }
 
+std::vector<std::string> luna::user_channels(std::string const& user) const
+{
+    std::vector<std::string> res;
+
+    if (irc::network_user const* u = environment().lookup_user(user)) {
+        for (irc::channel const* c : u->channels()) {
+            res.push_back(c->name());
+        }
+    }
+
+    return res;
+}
+
+void luna::flush_modes()
+{
+    if (_mode_batch.empty() or not connected()) {
+        return;
+    }
+
+    for (irc::message const& msg : _mode_batch.flush(environment())) {
+        send_message(msg);
+    }
+}
+
 
 luna* lref = nullptr;
 
@@ -714,7 +1059,6 @@ int main(int argc, char** argv)
     signal(SIGINT, cleanup);
 
     cl.run();
-    cl.save_users("users.txt");
 
     return 0;
 }
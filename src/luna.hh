@@ -23,17 +23,29 @@
 
 #include "logging.hh"
 #include "tokenbucket.hh"
+#include "journal_socket.hh"
+#include "luna_extension.hh"
+#include "user_index.hh"
+#include "ingress_filter.hh"
+#include "shared_var_log.hh"
+#include "user_store.hh"
 
 #include <irc/client.hh>
 #include <irc/channel.hh>
 #include <irc/channel_user.hh>
+#include <irc/mode_batcher.hh>
+#include <irc/handle_table.hh>
+#include <irc/netsplit.hh>
 
 #include <string>
+#include <array>
+#include <list>
+#include <vector>
+#include <chrono>
 #include <ctime>
 #include <csignal>
 
 class luna_user;
-class luna_extension;
 
 class luna final : public irc::client {
 public:
@@ -44,14 +56,54 @@ public:
 
     void read_config(std::string const& filename);
 
-    void read_shared_vars(std::string const& filename);
-    void read_users(std::string const& filename);
+    void read_shared_vars();
+    void read_users();
 
-    void save_shared_vars(std::string const& filename);
-    void save_users(std::string const& filename);
+    // Changes are written as they happen, this only asks for them to be
+    // synced right away
+    void save_shared_vars();
+
+    // Has the users written now rather than when they are due, without
+    // waiting for it
+    void save_users();
+
+    // The text format, one user per line. Importing replaces all users.
+    void import_users(std::string const& filename);
+    void export_users(std::string const& filename);
+
+    void reload_shared_vars();
+
+    void set_shared_var(std::string const& key, std::string const& value);
+    void clear_shared_var(std::string const& key);
 
     std::vector<std::unique_ptr<luna_extension>> const& extensions();
-    std::vector<luna_user>& users();
+    std::list<luna_user> const& users() const;
+
+    // Registered users stay in place, handles to them are valid until
+    // they are removed.
+    luna_user& add_user(luna_user user);
+    void    remove_user(luna_user const& user);
+    void    clear_users();
+
+    // nullptr if the user was removed
+    luna_user* resolve(irc::handle<luna_user> h) const;
+
+    // By id, case insensitively, or nullptr
+    luna_user* find_user(std::string const& id);
+
+    // The first user whose hostmask matches `prefix', or nullptr
+    luna_user* match_user(std::string const& prefix);
+
+    // To be called after changing the id or hostmask of a user
+    void users_changed();
+
+    // To be called after changing anything else about a user. Users are
+    // written some time after the first change, so a burst of changes only
+    // costs one write.
+    void users_modified();
+
+    // Extensions call this when their interested_in() answers change.
+    void interests_changed();
 
     using irc::client::run;
 
@@ -121,11 +173,18 @@ protected:
         std::string const& mode,
         std::string const& arg);
 
+    void on_netsplits();
+
     virtual void pretty_print_exception(
         std::exception_ptr p,
         int lvl) const override;
 
 private:
+    void import_shared_vars(std::string const& filename);
+
+    //! Whether a message is worth dispatching at all, see ingress_filter.
+    bool admit(irc::message const& msg);
+
     void handle_core_ctcp(
         std::string const& prefix,
         std::string const& target,
@@ -133,29 +192,65 @@ private:
         std::string const& args);
 
     template <typename Ret, typename... Args>
-    void dispatch_event(Ret (luna_extension::*fn)(Args...), Args&&... args)
+    void dispatch_event(
+        luna_extension::event ev,
+        Ret (luna_extension::*fn)(Args...),
+        Args&&... args)
     {
-        std::size_t i = 0;
+        dispatch_to(ev, nullptr, fn, std::forward<Args>(args)...);
+    }
 
-        // Since the list can grow while we iterate it, keep updating size.
-        while (i < _exts.size()) {
-            if (_exts[i]) {
-                (_exts[i].get()->*fn)(std::forward<Args>(args)...);
-            }
+    // For events in a channel, or with a channel as target
+    template <typename Ret, typename... Args>
+    void dispatch_channel_event(
+        luna_extension::event ev,
+        std::string const& channel,
+        Ret (luna_extension::*fn)(Args...),
+        Args&&... args)
+    {
+        dispatch_to(ev, &channel, fn, std::forward<Args>(args)...);
+    }
+
+    template <typename Ret, typename... Args>
+    void dispatch_to(
+        luna_extension::event ev,
+        std::string const* channel,
+        Ret (luna_extension::*fn)(Args...),
+        Args&&... args)
+    {
+        if (_subscribers_dirty and (_dispatch_depth == 0)) {
+            collect_subscribers();
+        }
 
-            ++i;
+        {
+            dispatch_scope scope{_dispatch_depth};
+
+            std::vector<std::size_t> const& subs =
+                _subscribers[static_cast<std::size_t>(ev)];
+
+            // Handlers may load scripts or dispatch events of their own,
+            // which can only ever append to _exts, so indices stay valid
+            // until we're done. Interests are checked again in case they
+            // were dropped.
+            for (std::size_t i = 0; i < subs.size(); ++i) {
+                luna_extension* ext = _exts[subs[i]].get();
+
+                if (ext and (channel
+                        ? ext->interested_in(ev, *channel)
+                        : ext->interested_in(ev))) {
+                    (ext->*fn)(std::forward<Args>(args)...);
+                }
+            }
         }
 
-        // Unloadind a script only resets the unique_ptr to nullptr. Drop all
-        // unloaded scripts from the list when it's safe to shrink.
-        _exts.erase(
-            std::remove_if(std::begin(_exts), std::end(_exts),
-                [] (std::unique_ptr<luna_extension> const& scr) {
-                    return not scr;
-                }),
-            std::end(_exts));
+        if (_exts_unloaded and (_dispatch_depth == 0)) {
+            compact_extensions();
+        }
     }
 
+    void collect_subscribers();
+    void compact_extensions();
+
     void handle_direct_message(
         std::string const& prefix,
         std::string const& target,
@@ -171,6 +266,9 @@ private:
             std::string const&));
 
     void work_through_queue();
+    void flush_modes();
+
+    std::vector<std::string> user_channels(std::string const& user) const;
 
 private:
     logger _logger{"luna", logging_level::INFO, logging_flags::ANSI};
@@ -179,12 +277,64 @@ private:
 
     std::queue<irc::message> _message_queue;
 
+    // Leave room for our own prefix when the server relays mode changes.
+    irc::mode_batcher _mode_batch{128};
+
+    // Netsplit QUITs and netjoin JOINs are reported per burst.
+    irc::netsplit_tracker _netsplits;
+
+    // Only if configured
+    std::unique_ptr<journal_socket> _journal_socket;
+
     std::string _server = "";
     uint16_t _port      = 6667;
 
+    // Most bytes a script's Lua state may use, 0 for no limit
+    std::size_t _script_memory_limit = 0;
+
     std::vector<std::unique_ptr<luna_extension>> _exts;
+
+    // Indices into _exts of the extensions interested in each event, in
+    // load order. Unloading an extension only resets its unique_ptr, the
+    // list is compacted once no event is being dispatched anymore.
+    std::array<std::vector<std::size_t>, luna_extension::event_count>
+        _subscribers;
+
+    bool _subscribers_dirty = true;
+    bool _exts_unloaded     = false;
+
+    std::size_t _dispatch_depth = 0;
+
+    // Counts a dispatch for as long as it runs, even if a handler throws
+    struct dispatch_scope {
+        explicit dispatch_scope(std::size_t& counter)
+            : depth{counter}
+        {
+            ++depth;
+        }
+
+        ~dispatch_scope()
+        {
+            --depth;
+        }
+
+        std::size_t& depth;
+    };
+
     std::vector<std::string> _autojoin;
-    std::vector<luna_user>   _users;
+    std::list<luna_user>     _users;
+
+    irc::handle_table<luna_user> _user_handles;
+    user_index                   _user_index{_users};
+
+    // Checked before anything is dispatched
+    ingress_filter _ingress{_user_index};
+
+    shared_var_log _shared_log;
+
+    user_store _user_store;
+    bool _users_dirty = false;
+    std::chrono::steady_clock::time_point _users_dirty_since;
 
 private:
     friend class luna_script;
@@ -22,6 +22,8 @@
 irc::unordered_rfc1459_map<std::string, std::string>
     luna_extension::shared_vars{};
 
+std::uint64_t luna_extension::shared_vars_version = 0;
+
 
 luna_extension::luna_extension(luna& context)
     : _context{&context}
@@ -33,6 +35,18 @@ luna_extension::~luna_extension() { }
 void luna_extension::init() { }
 void luna_extension::destroy() { }
 
+bool luna_extension::interested_in(event ev) const
+{
+    return true;
+}
+
+bool luna_extension::interested_in(
+    event ev,
+    std::string const& channel) const
+{
+    return interested_in(ev);
+}
+
 void luna_extension::on_connect() { }
 void luna_extension::on_disconnect() { }
 void luna_extension::on_idle() { }
@@ -105,6 +119,10 @@ void luna_extension::on_mode(
     std::string const& mode,
     std::string const& arg) { }
 
+void luna_extension::on_netsplit(irc::netsplit_event const& split) { }
+
+void luna_extension::on_netjoin(irc::netsplit_event const& join) { }
+
 luna& luna_extension::context() const
 {
     return *_context;
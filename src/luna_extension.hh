@@ -22,8 +22,11 @@
 #define LUNA_LUNA_EXTENSION_HH_INCLUDED
 
 #include <irc/irc_utils.hh>
+#include <irc/netsplit.hh>
 
 #include <string>
+#include <cstddef>
+#include <cstdint>
 
 class luna;
 
@@ -31,11 +34,41 @@ class luna_extension {
 public:
     static irc::unordered_rfc1459_map<std::string, std::string> shared_vars;
 
+    // Bumped on every change to shared_vars, for caches built from them
+    static std::uint64_t shared_vars_version;
+
     enum class sync_type {
         users,
         bans
     };
 
+    // One per event handler below, for telling luna which ones to call.
+    enum class event {
+        connect,
+        disconnect,
+        idle,
+        message_send,
+        message,
+        invite,
+        channel_sync,
+        join,
+        part,
+        quit,
+        nick,
+        kick,
+        topic,
+        privmsg,
+        notice,
+        ctcp_request,
+        ctcp_response,
+        mode,
+        netsplit,
+        netjoin
+    };
+
+    static constexpr std::size_t event_count =
+        static_cast<std::size_t>(event::netjoin) + 1;
+
     luna_extension(luna& context);
     virtual ~luna_extension() = 0;
 
@@ -53,6 +86,13 @@ public:
     virtual void init();
     virtual void destroy();
 
+    // Whether to call the handler for an event at all, and for events in
+    // a channel (or sent to one) whether to call it for that channel. By
+    // default extensions hear about everything; call
+    // luna::interests_changed() when the answers change.
+    virtual bool interested_in(event ev) const;
+    virtual bool interested_in(event ev, std::string const& channel) const;
+
     virtual void on_connect();
     virtual void on_disconnect();
     virtual void on_idle();
@@ -128,6 +168,10 @@ public:
         std::string const& mode,
         std::string const& arg);
 
+    // Whole netsplits and netjoins, instead of on_quit/on_join for each user
+    virtual void on_netsplit(irc::netsplit_event const& split);
+    virtual void on_netjoin(irc::netsplit_event const& join);
+
 protected:
     luna& context() const;
 
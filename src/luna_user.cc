@@ -30,23 +30,23 @@ luna_user::luna_user(
     int flags)
 
     :       _id{std::move(id)},
-      _hostmask{std::move(hostmask)},
          _title{std::move(title)},
          _flags{flags}
 {
+    set_hostmask(std::move(hostmask));
 }
 
-std::string luna_user::id() const
+std::string const& luna_user::id() const
 {
     return _id;
 }
 
-std::string luna_user::hostmask() const
+std::string const& luna_user::hostmask() const
 {
     return _hostmask;
 }
 
-std::string luna_user::title() const
+std::string const& luna_user::title() const
 {
     return _title;
 }
@@ -65,6 +65,13 @@ void luna_user::set_id(std::string newid)
 void luna_user::set_hostmask(std::string newhostmask)
 {
     _hostmask = std::move(newhostmask);
+
+    try {
+        _mask = std::regex{_hostmask, std::regex::icase};
+        _mask_valid = true;
+    } catch (std::regex_error const& e) {
+        _mask_valid = false;
+    }
 }
 
 void luna_user::set_title(std::string newtitle)
@@ -80,15 +87,24 @@ void luna_user::set_flags(int newflags)
 
 bool luna_user::matches(const std::string& prefix) const
 {
+    if (not _mask_valid) {
+        return false;
+    }
+
     try {
-        return std::regex_search(prefix,
-            std::regex{_hostmask, std::regex::icase});
+        return std::regex_search(prefix, _mask);
     } catch (std::regex_error const& e) {
         return false;
     }
 }
 
 
+irc::handle<luna_user> luna_user::handle() const
+{
+    return _handle;
+}
+
+
 bool luna_user::operator==(luna_user const& other) const
 {
     return _id == other._id;
@@ -20,7 +20,10 @@
 #ifndef LUNA_LUNA_USER_HH_INCLUDED
 #define LUNA_LUNA_USER_HH_INCLUDED
 
+#include <irc/handle_table.hh>
+
 #include <string>
+#include <regex>
 
 class luna_user {
 public:
@@ -37,10 +40,10 @@ public:
         std::string title,
         int flags);
 
-    std::string id()       const;
-    std::string hostmask() const;
-    std::string title()    const;
-    int         flags()    const;
+    std::string const& id()       const;
+    std::string const& hostmask() const;
+    std::string const& title()    const;
+    int                flags()    const;
 
     void set_id(std::string newid);
     void set_hostmask(std::string newhostmask);
@@ -49,14 +52,25 @@ public:
 
     bool matches(std::string const& prefix) const;
 
+    // Assigned when the user is added to the bot's list, see luna::add_user()
+    irc::handle<luna_user> handle() const;
+
     bool operator==(luna_user const& other) const;
     bool operator!=(luna_user const& other) const;
 
 private:
+    friend class luna;
+
+    irc::handle<luna_user> _handle;
+
     std::string _id;
     std::string _hostmask;
     std::string _title;
     int         _flags;
+
+    // _hostmask compiled, if it is a valid regex
+    std::regex _mask;
+    bool       _mask_valid;
 };
 
 int flags_from_string(std::string const& flags);
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message_watchers.hh"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include <cctype>
+
+
+void message_watchers::add(
+    std::string const& id,
+    std::string const& pattern,
+    bool plain)
+{
+    remove(id);
+
+    _watchers.push_back(watcher{
+        id, pattern, plain,
+        plain ? pattern : required_literal(pattern),
+        0, 0});
+
+    _dirty = true;
+}
+
+bool message_watchers::remove(std::string const& id)
+{
+    auto it = std::find_if(std::begin(_watchers), std::end(_watchers),
+        [&] (watcher const& w) { return w.id == id; });
+
+    if (it == std::end(_watchers)) {
+        return false;
+    }
+
+    _watchers.erase(it);
+    _dirty = true;
+
+    return true;
+}
+
+void message_watchers::record_hit(std::string const& id)
+{
+    for (watcher& w : _watchers) {
+        if (w.id == id) {
+            ++w.hits;
+            return;
+        }
+    }
+}
+
+std::vector<message_watchers::watcher> const& message_watchers::list() const
+{
+    return _watchers;
+}
+
+std::int32_t message_watchers::child(std::int32_t n, unsigned char c) const
+{
+    auto const& next = _nodes[n].next;
+
+    auto it = std::lower_bound(std::begin(next), std::end(next),
+        std::make_pair(c, std::int32_t{0}));
+
+    return (it != std::end(next) and it->first == c) ? it->second : -1;
+}
+
+void message_watchers::build()
+{
+    _nodes.assign(1, node{});
+    _always.clear();
+
+    for (std::size_t i = 0; i < _watchers.size(); ++i) {
+        std::string const& lit = _watchers[i].literal;
+
+        if (lit.empty()) {
+            _always.push_back(i);
+            continue;
+        }
+
+        std::int32_t n = 0;
+
+        for (char ch : lit) {
+            unsigned char c = static_cast<unsigned char>(ch);
+            std::int32_t next = child(n, c);
+
+            if (next < 0) {
+                next = static_cast<std::int32_t>(_nodes.size());
+                _nodes.emplace_back();
+
+                auto& edges = _nodes[n].next;
+                edges.insert(
+                    std::upper_bound(std::begin(edges), std::end(edges),
+                        std::make_pair(c, std::int32_t{0})),
+                    std::make_pair(c, next));
+            }
+
+            n = next;
+        }
+
+        _nodes[n].watchers.push_back(i);
+    }
+
+    // Fail links breadth first, so the ones of shorter prefixes are known
+    std::vector<std::int32_t> order;
+    std::deque<std::int32_t> queue{0};
+
+    while (not queue.empty()) {
+        std::int32_t n = queue.front();
+        queue.pop_front();
+
+        order.push_back(n);
+
+        for (auto const& edge : _nodes[n].next) {
+            node& target = _nodes[edge.second];
+
+            if (n != 0) {
+                std::int32_t f = _nodes[n].fail, next;
+
+                while ((next = child(f, edge.first)) < 0 and f != 0) {
+                    f = _nodes[f].fail;
+                }
+
+                target.fail = (next >= 0) ? next : 0;
+            }
+
+            target.output_link = _nodes[target.fail].watchers.empty()
+                ? _nodes[target.fail].output_link
+                : target.fail;
+
+            queue.push_back(edge.second);
+        }
+    }
+
+    _classes.fill(0);
+    _class_count = 1;
+
+    for (watcher const& w : _watchers) {
+        for (char ch : w.literal) {
+            std::uint16_t& cls = _classes[static_cast<unsigned char>(ch)];
+
+            if (cls == 0) {
+                cls = static_cast<std::uint16_t>(_class_count++);
+            }
+        }
+    }
+
+    // Parents come before children in `order', and fail links point to
+    // shallower nodes, so every row copied from is complete.
+    _delta.assign(_nodes.size() * _class_count, 0);
+
+    for (std::int32_t n : order) {
+        std::int32_t* row = &_delta[n * _class_count];
+
+        if (n != 0) {
+            std::copy_n(&_delta[_nodes[n].fail * _class_count],
+                _class_count, row);
+        }
+
+        for (auto const& edge : _nodes[n].next) {
+            row[_classes[edge.first]] = edge.second;
+        }
+    }
+
+    _output.resize(_nodes.size());
+
+    for (std::size_t n = 0; n < _nodes.size(); ++n) {
+        _output[n] = _nodes[n].watchers.empty()
+            ? _nodes[n].output_link
+            : static_cast<std::int32_t>(n);
+    }
+
+    _dirty = false;
+}
+
+void message_watchers::candidates(
+    std::string const& message,
+    std::vector<std::string const*>& ids)
+{
+    if (_dirty) {
+        build();
+    }
+
+    _found.assign(std::begin(_always), std::end(_always));
+
+    if (_nodes.size() > 1) {
+        std::int32_t n = 0;
+
+        for (char ch : message) {
+            n = _delta[n * _class_count
+                       + _classes[static_cast<unsigned char>(ch)]];
+
+            for (std::int32_t o = _output[n]; o >= 0;
+                    o = _nodes[o].output_link) {
+                _found.insert(std::end(_found),
+                    std::begin(_nodes[o].watchers),
+                    std::end(_nodes[o].watchers));
+            }
+        }
+    }
+
+    std::sort(std::begin(_found), std::end(_found));
+    _found.erase(std::unique(std::begin(_found), std::end(_found)),
+        std::end(_found));
+
+    for (std::size_t i : _found) {
+        ++_watchers[i].candidates;
+        ids.push_back(&_watchers[i].id);
+    }
+}
+
+// Walks the pattern like Lua's matcher would, collecting runs of single
+// characters that every match contains in that order. Anything optional or
+// repeated ends a run, anything that matches more than one character does
+// too.
+std::string message_watchers::required_literal(std::string const& pattern)
+{
+    std::string best, run;
+
+    auto end_run = [&] {
+        if (run.size() > best.size()) {
+            best = run;
+        }
+
+        run.clear();
+    };
+
+    // Past the `]' of a set starting at `q', one right at its start is part
+    // of the set
+    auto skip_set = [&] (std::size_t q) {
+        if (++q < pattern.size() and pattern[q] == '^') {
+            ++q;
+        }
+
+        if (q < pattern.size()) {
+            ++q;
+        }
+
+        while (q < pattern.size() and pattern[q] != ']') {
+            q += (pattern[q] == '%') ? 2 : 1;
+        }
+
+        return std::min(pattern.size(), q + 1);
+    };
+
+    std::size_t p = 0;
+
+    if (not pattern.empty() and pattern[0] == '^') {
+        ++p;
+    }
+
+    while (p < pattern.size()) {
+        char c = pattern[p];
+
+        // Captures and position captures match nothing themselves
+        if (c == '(' or c == ')') {
+            ++p;
+            continue;
+        }
+
+        if ((c == '$') and (p + 1 == pattern.size())) {
+            break;
+        }
+
+        bool literal = false;
+        std::size_t item_end = p + 1;
+
+        if (c == '%') {
+            if (p + 1 >= pattern.size()) {
+                break;
+            }
+
+            char e = pattern[p + 1];
+
+            if (e == 'b') {
+                // %bxy, balanced and of any length
+                end_run();
+                p += 4;
+                continue;
+            }
+
+            if (e == 'f') {
+                // %f[set], a frontier that matches nothing itself
+                end_run();
+                p = skip_set(p + 2);
+                continue;
+            }
+
+            // %a, %d, ... or an escaped character
+            literal = not std::isalnum(static_cast<unsigned char>(e));
+            c = e;
+            item_end = p + 2;
+        } else if (c == '[') {
+            item_end = skip_set(p);
+        } else {
+            literal = c != '.';
+        }
+
+        char quantifier = (item_end < pattern.size()) ? pattern[item_end] : 0;
+        bool quantified = quantifier == '*' or quantifier == '+'
+                       or quantifier == '-' or quantifier == '?';
+
+        // `x+' still needs one x
+        if (literal and (not quantified or quantifier == '+')) {
+            run += c;
+        }
+
+        if (not literal or quantified) {
+            end_run();
+        }
+
+        p = item_end + (quantified ? 1 : 0);
+    }
+
+    end_run();
+
+    return best;
+}
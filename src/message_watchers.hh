@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_MESSAGE_WATCHERS_HH_INCLUDED
+#define LUNA_MESSAGE_WATCHERS_HH_INCLUDED
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*! \brief Message watchers, and which of them a message may concern.
+ *
+ * Every Lua pattern (or plain string) watched for contributes the longest
+ * literal any match has to contain. All of those are looked for in one pass
+ * over a message with an Aho-Corasick automaton. Only watchers whose literal
+ * was found, or that have none, are candidates; confirming the match with
+ * the pattern itself is left to the caller.
+ */
+class message_watchers {
+public:
+    struct watcher {
+        std::string id;
+        std::string pattern;
+        bool plain;
+
+        // Contained in every match, empty if nothing is
+        std::string literal;
+
+        std::uint64_t candidates;
+        std::uint64_t hits;
+    };
+
+    //! Adds a watcher, replacing one with the same id.
+    void add(std::string const& id, std::string const& pattern, bool plain);
+
+    bool remove(std::string const& id);
+
+    void record_hit(std::string const& id);
+
+    /*! \brief The ids of watchers that may match \p message.
+     *
+     * In the order the watchers were added.
+     */
+    void candidates(
+        std::string const& message,
+        std::vector<std::string const*>& ids);
+
+    std::vector<watcher> const& list() const;
+
+    //! The longest literal in every match of a Lua pattern.
+    static std::string required_literal(std::string const& pattern);
+
+private:
+    void build();
+
+private:
+    struct node {
+        // Sorted by character
+        std::vector<std::pair<unsigned char, std::int32_t>> next;
+
+        std::int32_t fail = 0;
+
+        // Nearest node down the fail chain ending a literal, or -1
+        std::int32_t output_link = -1;
+
+        // Watchers whose literal ends here
+        std::vector<std::size_t> watchers;
+    };
+
+    std::int32_t child(std::int32_t n, unsigned char c) const;
+
+private:
+    std::vector<watcher> _watchers;
+
+    // Watchers without a literal, candidates for every message
+    std::vector<std::size_t> _always;
+
+    std::vector<node> _nodes;
+    bool _dirty = true;
+
+    // The automaton with all fail links followed in advance, by node and
+    // class of character. Characters in no literal share class 0.
+    std::array<std::uint16_t, 256> _classes;
+    std::size_t _class_count;
+    std::vector<std::int32_t> _delta;
+
+    // Per node, the first node down the fail chain (itself included) that
+    // ends a literal, or -1
+    std::vector<std::int32_t> _output;
+
+    // Scratch space for candidates()
+    std::vector<std::size_t> _found;
+};
+
+#endif // defined LUNA_MESSAGE_WATCHERS_HH_INCLUDED
@@ -0,0 +1,382 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "shared_var_log.hh"
+
+#include "file_io.hh"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+
+namespace {
+
+// Magic, CRC of everything past it, padding, number of variables (64 bits)
+constexpr char snapshot_magic[8] = {'L', 'U', 'N', 'A', 'V', 'A', 'R', '1'};
+constexpr std::size_t snapshot_header_size = 24;
+
+// CRC of the rest, operation, key length, value length
+constexpr std::size_t record_header_size = 13;
+
+// How long changes may pile up before they are written, to share one sync
+constexpr std::chrono::milliseconds batch_delay{50};
+
+/* Applies the records in [data, data + size) to vars, up to the first one
+ * that is cut short or fails its CRC. Returns how many bytes were good.
+ */
+std::size_t replay(
+    char const* data,
+    std::size_t size,
+    shared_var_log::var_map& vars)
+{
+    std::size_t pos = 0;
+
+    while (size - pos >= record_header_size) {
+        char const* rec = data + pos;
+
+        std::uint32_t klen = get_raw<std::uint32_t>(rec + 5);
+        std::uint32_t vlen = get_raw<std::uint32_t>(rec + 9);
+
+        std::size_t body = size - pos - record_header_size;
+
+        if (klen > body or vlen > body - klen) {
+            break;
+        }
+
+        std::size_t len = record_header_size + klen + vlen;
+
+        if (get_raw<std::uint32_t>(rec) != crc32(rec + 4, len - 4)) {
+            break;
+        }
+
+        std::string key{rec + record_header_size, klen};
+
+        switch (static_cast<std::uint8_t>(rec[4])) {
+        case 1:
+            vars[key].assign(rec + record_header_size + klen, vlen);
+            break;
+        case 2:
+            vars.erase(key);
+            break;
+        }
+
+        pos += len;
+    }
+
+    return pos;
+}
+
+}
+
+
+shared_var_log::shared_var_log(std::string log_path, std::string snapshot_path)
+    : _log_path{std::move(log_path)},
+      _snapshot_path{std::move(snapshot_path)}
+{
+}
+
+shared_var_log::~shared_var_log()
+{
+    if (_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stop = true;
+        }
+
+        _wake.notify_one();
+        _writer.join();
+    }
+
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+bool shared_var_log::open(var_map& vars)
+{
+    std::size_t valid;
+
+    bool found = read_snapshot(vars);
+    found = read_log(vars, valid) or found;
+
+    _fd = ::open(_log_path.c_str(),
+        O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (_fd < 0) {
+        throw file_error("could not open", _log_path);
+    }
+
+    struct stat st;
+
+    if (::fstat(_fd, &st) == 0
+            and static_cast<std::size_t>(st.st_size) > valid) {
+        _error = "dropped " + std::to_string(st.st_size - valid)
+               + " damaged bytes at the end of `" + _log_path + "'";
+
+        if (::ftruncate(_fd, valid) < 0) {
+            throw file_error("could not truncate", _log_path);
+        }
+    }
+
+    if (::stat(_snapshot_path.c_str(), &st) == 0) {
+        _snapshot_size = st.st_size;
+    }
+
+    _log_size = valid;
+    _written = vars;
+    _writer = std::thread{&shared_var_log::run, this};
+
+    return found;
+}
+
+void shared_var_log::reload(var_map& vars)
+{
+    if (_writer.joinable()) {
+        std::unique_lock<std::mutex> lock{_mutex};
+
+        _sync_now = true;
+        _wake.notify_one();
+
+        _idle.wait(lock, [this] { return _pending.empty() and not _busy; });
+    }
+
+    std::size_t valid;
+
+    vars.clear();
+    read_snapshot(vars);
+    read_log(vars, valid);
+}
+
+void shared_var_log::set(std::string const& key, std::string const& value)
+{
+    append(op::set, key, value);
+}
+
+void shared_var_log::erase(std::string const& key)
+{
+    append(op::erase, key, "");
+}
+
+void shared_var_log::sync()
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _sync_now = true;
+    }
+
+    _wake.notify_one();
+}
+
+std::string shared_var_log::take_error()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    std::string error;
+    error.swap(_error);
+
+    return error;
+}
+
+void shared_var_log::append(
+    op o,
+    std::string const& key,
+    std::string const& value)
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        std::size_t start = _pending.size();
+
+        put_raw(_pending, std::uint32_t{0});
+        put_raw(_pending, static_cast<std::uint8_t>(o));
+        put_raw(_pending, static_cast<std::uint32_t>(key.size()));
+        put_raw(_pending, static_cast<std::uint32_t>(value.size()));
+        _pending.append(key);
+        _pending.append(value);
+
+        std::uint32_t crc = crc32(&_pending[start + 4],
+            _pending.size() - start - 4);
+        std::memcpy(&_pending[start], &crc, sizeof(crc));
+    }
+
+    _wake.notify_one();
+}
+
+bool shared_var_log::read_snapshot(var_map& vars) const
+{
+    mapped_file snap{_snapshot_path};
+
+    if (not snap.exists()) {
+        return false;
+    }
+
+    char const* data = snap.data();
+    std::size_t size = snap.size();
+
+    auto damaged = [&] {
+        return std::runtime_error{
+            "shared variable snapshot `" + _snapshot_path + "' is damaged"};
+    };
+
+    if (size < snapshot_header_size
+            or std::memcmp(data, snapshot_magic, sizeof(snapshot_magic)) != 0
+            or get_raw<std::uint32_t>(data + 8)
+                   != crc32(data + 16, size - 16)) {
+        throw damaged();
+    }
+
+    std::uint64_t count = get_raw<std::uint64_t>(data + 16);
+    std::size_t pos = snapshot_header_size;
+
+    vars.reserve(vars.size() + count);
+
+    for (std::uint64_t i = 0; i < count; ++i) {
+        if (size - pos < 8) {
+            throw damaged();
+        }
+
+        std::uint32_t klen = get_raw<std::uint32_t>(data + pos);
+        std::uint32_t vlen = get_raw<std::uint32_t>(data + pos + 4);
+
+        pos += 8;
+
+        if (klen > size - pos or vlen > size - pos - klen) {
+            throw damaged();
+        }
+
+        vars[std::string{data + pos, klen}].assign(data + pos + klen, vlen);
+
+        pos += klen + vlen;
+    }
+
+    return true;
+}
+
+bool shared_var_log::read_log(var_map& vars, std::size_t& valid) const
+{
+    mapped_file log{_log_path};
+
+    valid = log.exists() ? replay(log.data(), log.size(), vars) : 0;
+
+    return log.exists();
+}
+
+void shared_var_log::run()
+{
+    std::unique_lock<std::mutex> lock{_mutex};
+
+    for (;;) {
+        _wake.wait(lock, [this] { return _stop or not _pending.empty(); });
+
+        if (_pending.empty()) {
+            break;
+        }
+
+        if (not _stop and not _sync_now) {
+            _wake.wait_for(lock, batch_delay,
+                [this] { return _stop or _sync_now; });
+        }
+
+        std::string batch;
+        batch.swap(_pending);
+
+        _sync_now = false;
+        _busy = true;
+
+        lock.unlock();
+
+        bool written = write_all(_fd, batch.data(), batch.size())
+                   and ::fdatasync(_fd) == 0;
+
+        if (written) {
+            _log_size += batch.size();
+        } else {
+            fail(file_error("could not write", _log_path).what());
+
+            // A failed write may have left half a record behind, which would
+            // hide everything appended after it.
+            if (::ftruncate(_fd, _log_size) < 0) {
+                fail(file_error("could not truncate", _log_path).what());
+            }
+
+            _unsaved = true;
+        }
+
+        replay(batch.data(), batch.size(), _written);
+
+        // What did not make it into the log is only kept by a new snapshot,
+        // retried every round until one is written.
+        if (_unsaved or (_log_size > compact_threshold
+                         and _log_size > 2 * _snapshot_size)) {
+            compact();
+        }
+
+        lock.lock();
+
+        _busy = false;
+        _idle.notify_all();
+    }
+}
+
+void shared_var_log::compact()
+{
+    std::string snap{snapshot_magic, sizeof(snapshot_magic)};
+
+    put_raw(snap, std::uint32_t{0});
+    put_raw(snap, std::uint32_t{0});
+    put_raw(snap, static_cast<std::uint64_t>(_written.size()));
+
+    for (auto const& kv : _written) {
+        put_raw(snap, static_cast<std::uint32_t>(kv.first.size()));
+        put_raw(snap, static_cast<std::uint32_t>(kv.second.size()));
+        snap.append(kv.first);
+        snap.append(kv.second);
+    }
+
+    std::uint32_t crc = crc32(&snap[16], snap.size() - 16);
+    std::memcpy(&snap[8], &crc, sizeof(crc));
+
+    try {
+        replace_file(_snapshot_path, snap);
+    } catch (std::runtime_error const& e) {
+        return fail(e.what());
+    }
+
+    _snapshot_size = snap.size();
+    _unsaved = false;
+
+    if (::ftruncate(_fd, 0) < 0) {
+        return fail(file_error("could not truncate", _log_path).what());
+    }
+
+    _log_size = 0;
+}
+
+void shared_var_log::fail(std::string error)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _error = std::move(error);
+}
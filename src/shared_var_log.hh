@@ -0,0 +1,131 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_SHARED_VAR_LOG_HH_INCLUDED
+#define LUNA_SHARED_VAR_LOG_HH_INCLUDED
+
+#include <irc/irc_utils.hh>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+/*! \brief Persists shared variables as a snapshot plus a log of changes.
+ *
+ * Every change is appended to the log as a CRC-framed record. Records are
+ * handed to a writer thread, which writes whatever piled up since its last
+ * round in one go and syncs it with a single fdatasync(), so setting a
+ * variable never waits for the disk.
+ *
+ * Once the log outgrows the snapshot, the writer thread also writes a new
+ * snapshot of everything it has written so far, renames it over the old one
+ * and truncates the log. Replaying a record twice does no harm, so a crash
+ * in between loses nothing.
+ *
+ * Snapshots are read through mmap() and parsed in place. A record cut short
+ * at the end of the log, as left by a crash, is dropped.
+ */
+class shared_var_log {
+public:
+    using var_map = irc::unordered_rfc1459_map<std::string, std::string>;
+
+    shared_var_log(std::string log_path, std::string snapshot_path);
+
+    //! Writes out and syncs everything still pending.
+    ~shared_var_log();
+
+    shared_var_log(shared_var_log const&)            = delete;
+    shared_var_log& operator=(shared_var_log const&) = delete;
+
+    /*! \brief Reads snapshot and log into \p vars and starts writing.
+     *
+     * Throws std::runtime_error if the files can not be opened, or the
+     * snapshot is damaged.
+     *
+     * \return Whether there was anything to read at all.
+     */
+    bool open(var_map& vars);
+
+    /*! \brief Reads snapshot and log into \p vars again.
+     *
+     * Waits for pending changes to be written first.
+     */
+    void reload(var_map& vars);
+
+    void set(std::string const& key, std::string const& value);
+    void erase(std::string const& key);
+
+    //! Makes the writer sync what it has now, instead of when it gets to it.
+    void sync();
+
+    //! The last error the writer ran into, cleared once taken.
+    std::string take_error();
+
+    //! How large the log may grow before it is compacted, at least.
+    static constexpr std::size_t compact_threshold = 64 * 1024;
+
+private:
+    enum class op : std::uint8_t {
+        set   = 1,
+        erase = 2
+    };
+
+    void append(op o, std::string const& key, std::string const& value);
+
+    // Both return false if the file does not exist
+    bool read_snapshot(var_map& vars) const;
+    bool read_log(var_map& vars, std::size_t& valid) const;
+
+    void run();
+    void compact();
+    void fail(std::string error);
+
+private:
+    std::string _log_path;
+    std::string _snapshot_path;
+
+    int _fd = -1;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+
+    // Guarded by _mutex
+    std::string _pending;
+    bool _busy = false;
+    bool _sync_now = false;
+    bool _stop = false;
+    std::string _error;
+
+    // Owned by the writer thread: what is on disk, and how much of it is log
+    var_map _written;
+    std::size_t _log_size = 0;
+    std::size_t _snapshot_size = 0;
+
+    // Whether _written holds changes that are in neither log nor snapshot
+    bool _unsaved = false;
+
+    std::thread _writer;
+};
+
+#endif // defined LUNA_SHARED_VAR_LOG_HH_INCLUDED
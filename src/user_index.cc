@@ -0,0 +1,340 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "user_index.hh"
+
+#include "luna_user.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+char fold(char c)
+{
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+// The position of the `]' closing the class opening at \p i
+std::size_t skip_class(std::string const& mask, std::size_t i)
+{
+    for (++i; i < mask.size() and mask[i] != ']'; ++i) {
+        if (mask[i] == '\\') {
+            ++i;
+        }
+    }
+
+    return i;
+}
+
+/* The characters every match of the regex \p mask has to contain in a row,
+ * right after (or before) an \p anchor character, case-folded. Empty if
+ * that can't be told from the top level of the mask alone.
+ *
+ * Only literal characters count. Anything else (groups, classes, `.',
+ * anchors, escapes like `\d') ends a run of them, and a quantifier takes
+ * the character before it out of the run.
+ */
+std::string required_literal(std::string const& mask, char anchor, bool after)
+{
+    constexpr int gap = -1;
+
+    // Literal characters, as unsigned, and gaps
+    std::vector<int> seq;
+
+    for (std::size_t i = 0; i < mask.size(); ++i) {
+        char c = mask[i];
+
+        switch (c) {
+        case '|':
+            // Any of the alternatives could match
+            return {};
+
+        case '(': {
+            int depth = 0;
+
+            for (; i < mask.size(); ++i) {
+                if (mask[i] == '\\') {
+                    ++i;
+                } else if (mask[i] == '[') {
+                    i = skip_class(mask, i);
+                } else if (mask[i] == '(') {
+                    ++depth;
+                } else if (mask[i] == ')' and --depth == 0) {
+                    break;
+                }
+            }
+
+            seq.push_back(gap);
+            break;
+        }
+
+        case '[':
+            i = skip_class(mask, i);
+            seq.push_back(gap);
+            break;
+
+        case '\\':
+            if (i + 1 < mask.size() and not std::isalnum(
+                    static_cast<unsigned char>(mask[i + 1]))) {
+                seq.push_back(static_cast<unsigned char>(mask[++i]));
+            } else {
+                // Classes, assertions and references, or characters by code
+                // (`\x41') that are better not taken literally
+                while (i + 1 < mask.size() and std::isalnum(
+                        static_cast<unsigned char>(mask[i + 1]))) {
+                    ++i;
+                }
+
+                seq.push_back(gap);
+            }
+            break;
+
+        case '*':
+        case '?':
+        case '{':
+            if (not seq.empty()) {
+                seq.back() = gap;
+            }
+
+            if (c == '{') {
+                i = std::min(mask.find('}', i), mask.size());
+            }
+
+            // Lazy quantifiers
+            if (i + 1 < mask.size() and mask[i + 1] == '?') {
+                ++i;
+            }
+            break;
+
+        case '+':
+            seq.push_back(gap);
+
+            if (i + 1 < mask.size() and mask[i + 1] == '?') {
+                ++i;
+            }
+            break;
+
+        case '.':
+        case '^':
+        case '$':
+            seq.push_back(gap);
+            break;
+
+        default:
+            seq.push_back(static_cast<unsigned char>(c));
+        }
+    }
+
+    for (std::size_t i = 0; i < seq.size(); ++i) {
+        if (seq[i] != static_cast<unsigned char>(anchor)) {
+            continue;
+        }
+
+        std::string run;
+
+        if (after) {
+            for (std::size_t j = i + 1; j < seq.size() and seq[j] != gap; ++j) {
+                run += fold(static_cast<char>(seq[j]));
+            }
+        } else {
+            for (std::size_t j = i; j > 0 and seq[j - 1] != gap; --j) {
+                run.insert(run.begin(), fold(static_cast<char>(seq[j - 1])));
+            }
+        }
+
+        if (not run.empty()) {
+            return run;
+        }
+    }
+
+    return {};
+}
+
+}
+
+
+user_index::user_index(std::list<luna_user>& users, std::size_t cache_size)
+    : _users{&users},
+      _cache_size{cache_size}
+{
+}
+
+luna_user* user_index::find(std::string const& id)
+{
+    if (not _by_id_valid) {
+        _by_id.clear();
+
+        // The first of several users with the same id wins, as it did
+        // when they were searched in order.
+        for (luna_user& u : *_users) {
+            _by_id.emplace(u.id(), &u);
+        }
+
+        _by_id_valid = true;
+    }
+
+    auto it = _by_id.find(id);
+
+    return (it != std::end(_by_id)) ? it->second : nullptr;
+}
+
+luna_user* user_index::match(std::string const& prefix)
+{
+    auto it = _cached.find(prefix);
+
+    if (it != std::end(_cached)) {
+        _recent.splice(std::begin(_recent), _recent, it->second);
+
+        return it->second->second;
+    }
+
+    if (not _masks_valid) {
+        build_masks();
+    }
+
+    std::vector<std::size_t> filed;
+
+    candidates(_by_host, prefix, '@', true,  filed);
+    candidates(_by_nick, prefix, '!', false, filed);
+
+    std::sort(std::begin(filed), std::end(filed));
+
+    // The first match in list order, as if all users were tried
+    luna_user* found = nullptr;
+    auto f = std::begin(filed);
+    auto u = std::begin(_unfiled);
+
+    while (not found and (f != std::end(filed) or u != std::end(_unfiled))) {
+        std::size_t pos = (u == std::end(_unfiled)
+                           or (f != std::end(filed) and *f < *u))
+            ? *f++
+            : *u++;
+
+        if (_ordered[pos]->matches(prefix)) {
+            found = _ordered[pos];
+        }
+    }
+
+    if (_cache_size == 0) {
+        return found;
+    }
+
+    if (_recent.size() >= _cache_size) {
+        _cached.erase(_recent.back().first);
+        _recent.pop_back();
+    }
+
+    _recent.emplace_front(prefix, found);
+    _cached.emplace(prefix, std::begin(_recent));
+
+    return found;
+}
+
+void user_index::invalidate()
+{
+    _by_id_valid = false;
+    _masks_valid = false;
+
+    _recent.clear();
+    _cached.clear();
+}
+
+
+void user_index::literal_index::add(std::string key, std::size_t user)
+{
+    if (std::find(std::begin(lengths), std::end(lengths), key.size())
+            == std::end(lengths)) {
+        lengths.push_back(key.size());
+    }
+
+    users[std::move(key)].push_back(user);
+}
+
+void user_index::build_masks()
+{
+    _ordered.clear();
+    _by_host = literal_index{};
+    _by_nick = literal_index{};
+    _unfiled.clear();
+
+    for (luna_user& u : *_users) {
+        std::size_t pos = _ordered.size();
+        _ordered.push_back(&u);
+
+        std::string key = required_literal(u.hostmask(), '@', true);
+
+        if (not key.empty()) {
+            _by_host.add(std::move(key), pos);
+        } else if (not (key = required_literal(u.hostmask(), '!', false))
+                           .empty()) {
+            _by_nick.add(std::move(key), pos);
+        } else {
+            _unfiled.push_back(pos);
+        }
+    }
+
+    _masks_valid = true;
+}
+
+void user_index::candidates(
+    literal_index const& idx,
+    std::string const& prefix,
+    char anchor,
+    bool after,
+    std::vector<std::size_t>& out) const
+{
+    if (idx.users.empty()) {
+        return;
+    }
+
+    std::string key;
+
+    // Usually there is just the one anchor in a prefix
+    for (std::size_t at = prefix.find(anchor); at != std::string::npos;
+            at = prefix.find(anchor, at + 1)) {
+        for (std::size_t len : idx.lengths) {
+            if (after ? (prefix.size() - at - 1 < len) : (at < len)) {
+                continue;
+            }
+
+            key.assign(prefix, after ? at + 1 : at - len, len);
+            std::transform(std::begin(key), std::end(key), std::begin(key),
+                fold);
+
+            auto it = idx.users.find(key);
+
+            if (it != std::end(idx.users)) {
+                out.insert(std::end(out),
+                    std::begin(it->second), std::end(it->second));
+            }
+        }
+    }
+
+    // The same user may turn up under several anchors
+    if (prefix.find(anchor) != prefix.rfind(anchor)) {
+        std::sort(std::begin(out), std::end(out));
+        out.erase(std::unique(std::begin(out), std::end(out)), std::end(out));
+    }
+}
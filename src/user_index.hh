@@ -0,0 +1,105 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_USER_INDEX_HH_INCLUDED
+#define LUNA_USER_INDEX_HH_INCLUDED
+
+#include <irc/irc_utils.hh>
+
+#include <list>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+
+class luna_user;
+
+/*! \brief Looks up registered users by id and by prefix.
+ *
+ * Hostmasks are compiled by luna_user itself. Most of them spell out a host
+ * right after the `@', or a nick right before the `!', and can only match
+ * prefixes with that host or nick, so users are filed under those by their
+ * case-folded text. Matching a prefix only tries the users filed under its
+ * host and nick, plus those whose hostmask has neither (`.*@.*\.isp\.net'
+ * for instance), in order until one matches. The results are kept for the
+ * most recently seen prefixes, as the same few users tend to talk a lot.
+ *
+ * Anything cached is thrown away by invalidate(), which has to be called
+ * whenever users are added, removed or change their id or hostmask.
+ */
+class user_index {
+public:
+    explicit user_index(
+        std::list<luna_user>& users,
+        std::size_t cache_size = 512);
+
+    //! By id, case insensitively. nullptr if there is no such user.
+    luna_user* find(std::string const& id);
+
+    //! The first user whose hostmask matches \p prefix, or nullptr.
+    luna_user* match(std::string const& prefix);
+
+    void invalidate();
+
+private:
+    // Users filed by the text following `@' (or preceding `!') in their
+    // hostmasks, by position in the list
+    struct literal_index {
+        std::unordered_map<std::string, std::vector<std::size_t>> users;
+
+        // Of the keys in `users', each length once
+        std::vector<std::size_t> lengths;
+
+        void add(std::string key, std::size_t user);
+    };
+
+    void build_masks();
+
+    // Adds the positions of the users \p idx may hold for \p prefix
+    void candidates(
+        literal_index const& idx,
+        std::string const& prefix,
+        char anchor,
+        bool after,
+        std::vector<std::size_t>& out) const;
+
+private:
+    std::list<luna_user>* _users;
+
+    std::vector<luna_user*> _ordered;
+    literal_index _by_host;
+    literal_index _by_nick;
+    std::vector<std::size_t> _unfiled;
+    bool _masks_valid = false;
+
+    irc::unordered_rfc1459_map<std::string, luna_user*> _by_id;
+    bool _by_id_valid = false;
+
+    // Most recently used first, misses (nullptr) included
+    std::list<std::pair<std::string, luna_user*>> _recent;
+    std::unordered_map<
+        std::string,
+        std::list<std::pair<std::string, luna_user*>>::iterator> _cached;
+
+    std::size_t _cache_size;
+};
+
+#endif // defined LUNA_USER_INDEX_HH_INCLUDED
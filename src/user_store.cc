@@ -0,0 +1,209 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "user_store.hh"
+
+#include "file_io.hh"
+#include "luna_user.hh"
+
+#include <cstring>
+
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+// Magic, CRC of everything past it, padding, number of users (64 bits)
+constexpr char store_magic[8] = {'L', 'U', 'N', 'A', 'U', 'S', 'R', '1'};
+constexpr std::size_t header_size = 24;
+
+// Flags, then the lengths of id, hostmask and title
+constexpr std::size_t entry_header_size = 16;
+
+}
+
+
+user_store::user_store(std::string path)
+    : _path{std::move(path)},
+      _writer{&user_store::run, this}
+{
+}
+
+user_store::~user_store()
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stop = true;
+    }
+
+    _wake.notify_one();
+    _writer.join();
+}
+
+bool user_store::load(std::vector<entry>& users) const
+{
+    mapped_file file{_path};
+
+    if (not file.exists()) {
+        return false;
+    }
+
+    char const* data = file.data();
+    std::size_t size = file.size();
+
+    auto damaged = [&] {
+        return std::runtime_error{"user file `" + _path + "' is damaged"};
+    };
+
+    if (size < header_size
+            or std::memcmp(data, store_magic, sizeof(store_magic)) != 0
+            or get_raw<std::uint32_t>(data + 8)
+                   != crc32(data + 16, size - 16)) {
+        throw damaged();
+    }
+
+    std::uint64_t count = get_raw<std::uint64_t>(data + 16);
+    std::size_t pos = header_size;
+
+    users.reserve(users.size() + count);
+
+    for (std::uint64_t i = 0; i < count; ++i) {
+        if (size - pos < entry_header_size) {
+            throw damaged();
+        }
+
+        std::uint32_t flags = get_raw<std::uint32_t>(data + pos);
+        std::size_t idlen   = get_raw<std::uint32_t>(data + pos + 4);
+        std::size_t masklen = get_raw<std::uint32_t>(data + pos + 8);
+        std::size_t titlen  = get_raw<std::uint32_t>(data + pos + 12);
+
+        pos += entry_header_size;
+
+        if (idlen + masklen + titlen > size - pos) {
+            throw damaged();
+        }
+
+        char const* p = data + pos;
+
+        users.push_back(entry{
+            std::string{p, idlen},
+            std::string{p + idlen, masklen},
+            std::string{p + idlen + masklen, titlen},
+            static_cast<int>(flags)});
+
+        pos += idlen + masklen + titlen;
+    }
+
+    return true;
+}
+
+void user_store::save(std::list<luna_user> const& users)
+{
+    std::string out{store_magic, sizeof(store_magic)};
+
+    put_raw(out, std::uint32_t{0});
+    put_raw(out, std::uint32_t{0});
+    put_raw(out, static_cast<std::uint64_t>(users.size()));
+
+    for (luna_user const& u : users) {
+        std::string const& id       = u.id();
+        std::string const& hostmask = u.hostmask();
+        std::string const& title    = u.title();
+
+        put_raw(out, static_cast<std::uint32_t>(u.flags()));
+        put_raw(out, static_cast<std::uint32_t>(id.size()));
+        put_raw(out, static_cast<std::uint32_t>(hostmask.size()));
+        put_raw(out, static_cast<std::uint32_t>(title.size()));
+
+        out.append(id);
+        out.append(hostmask);
+        out.append(title);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+
+        _pending = std::move(out);
+        _has_pending = true;
+    }
+
+    _wake.notify_one();
+}
+
+void user_store::flush()
+{
+    std::unique_lock<std::mutex> lock{_mutex};
+
+    _idle.wait(lock, [this] { return not _has_pending and not _busy; });
+}
+
+std::string user_store::take_error()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    std::string error;
+    error.swap(_error);
+
+    return error;
+}
+
+void user_store::run()
+{
+    std::unique_lock<std::mutex> lock{_mutex};
+
+    for (;;) {
+        _wake.wait(lock, [this] { return _stop or _has_pending; });
+
+        if (not _has_pending) {
+            break;
+        }
+
+        std::string out = std::move(_pending);
+
+        _pending.clear();
+        _has_pending = false;
+        _busy = true;
+
+        lock.unlock();
+
+        std::uint32_t crc = crc32(&out[16], out.size() - 16);
+        std::memcpy(&out[8], &crc, sizeof(crc));
+
+        std::string error;
+
+        try {
+            replace_file(_path, out);
+        } catch (std::runtime_error const& e) {
+            error = e.what();
+        }
+
+        lock.lock();
+
+        if (not error.empty()) {
+            _error = std::move(error);
+        }
+
+        _busy = false;
+        _idle.notify_all();
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2014 Lukas Niederbremer
+ *
+ * This file is part of Luna++.
+ *
+ * Luna++ is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Luna++ is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Luna++.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef LUNA_USER_STORE_HH_INCLUDED
+#define LUNA_USER_STORE_HH_INCLUDED
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class luna_user;
+
+/*! \brief Keeps registered users in a binary file.
+ *
+ * The whole list is written at once, by a thread of its own, to a temporary
+ * file that then replaces the old one. The caller only puts the list into
+ * the file's format, a single pass of copying bytes. Lists handed over while
+ * one is still being written replace each other, only the latest one is
+ * written next.
+ *
+ * When to hand one over is up to the caller, see luna::users_modified().
+ */
+class user_store {
+public:
+    struct entry {
+        std::string id;
+        std::string hostmask;
+        std::string title;
+        int flags;
+    };
+
+    explicit user_store(std::string path);
+
+    //! Writes what was handed over last, if it wasn't yet.
+    ~user_store();
+
+    user_store(user_store const&)            = delete;
+    user_store& operator=(user_store const&) = delete;
+
+    /*! \brief Reads all users.
+     *
+     * Throws std::runtime_error if the file is damaged or can't be read.
+     *
+     * \return Whether the file exists.
+     */
+    bool load(std::vector<entry>& users) const;
+
+    //! Has \p users written, without waiting for it.
+    void save(std::list<luna_user> const& users);
+
+    //! Waits until everything handed over is written.
+    void flush();
+
+    //! The last error the writer ran into, cleared once taken.
+    std::string take_error();
+
+private:
+    void run();
+
+private:
+    std::string _path;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+
+    // Guarded by _mutex
+    std::string _pending;
+    bool _has_pending = false;
+    bool _busy = false;
+    bool _stop = false;
+    std::string _error;
+
+    std::thread _writer;
+};
+
+#endif // defined LUNA_USER_STORE_HH_INCLUDED
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+#
+# A minimal IRC server for driving luna++ on the loopback interface, used by
+# bench/dispatch.sh and check/run.sh. It accepts one client, registers it,
+# answers its JOINs with a NAMES list and its PINGs, and then either
+#
+#   fake_ircd.py PORT scenario FILE [LOG]
+#       sends the lines of FILE, waiting 50 ms after each. "SLEEP <seconds>"
+#       waits longer, "WAIT <seconds> <text>" waits at most that long for
+#       the client to send a line containing text. "$NICK" is replaced with
+#       the client's nick, blank lines and lines starting with "#" are
+#       skipped. Lines from the client are written to LOG if given.
+#
+#   fake_ircd.py PORT flood N
+#       sends N messages to #test in one go, then "END", and keeps the
+#       connection open until the client closes it.
+
+import select
+import socket
+import sys
+import time
+
+
+class Server:
+    def __init__(self, port, log=None):
+        listener = socket.socket()
+        listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        listener.bind(("127.0.0.1", port))
+        listener.listen(1)
+
+        self.conn, _ = listener.accept()
+        self.conn.setblocking(False)
+        listener.close()
+
+        self.buf = b""
+        self.received = []
+        self.nick = None
+        self.joined = False
+        self.log = open(log, "w") if log else None
+
+    def send(self, line):
+        self.conn.setblocking(True)
+        self.conn.sendall((line + "\r\n").encode())
+        self.conn.setblocking(False)
+
+    def pump(self, seconds):
+        """Handles what the client sends for a while, False once it left."""
+        end = time.time() + seconds
+
+        while True:
+            left = end - time.time()
+
+            if left <= 0:
+                return True
+
+            if not select.select([self.conn], [], [], left)[0]:
+                continue
+
+            data = self.conn.recv(65536)
+
+            if not data:
+                return False
+
+            self.buf += data
+
+            while b"\r\n" in self.buf:
+                line, self.buf = self.buf.split(b"\r\n", 1)
+                self.handle(line.decode("utf-8", "replace"))
+
+    def wait(self, seconds, text):
+        """Handles what the client sends until a line contains text."""
+        end = time.time() + seconds
+
+        while not any(text in line for line in self.received):
+            if time.time() >= end or not self.pump(0.1):
+                return
+
+    def handle(self, line):
+        self.received.append(line)
+
+        if self.log:
+            self.log.write(line + "\n")
+            self.log.flush()
+
+        words = line.split(" ")
+
+        if words[0] == "NICK":
+            if self.nick:
+                self.send(":%s!luna@bot.host NICK :%s" % (self.nick, words[1]))
+
+            self.nick = words[1]
+        elif words[0] == "USER":
+            self.send(":irc.test 001 %s :Welcome" % self.nick)
+            self.send(":irc.test 005 %s PREFIX=(ov)@+ CHANTYPES=# "
+                      "CHANMODES=beI,k,l,imnpstc :are supported" % self.nick)
+            self.send(":irc.test 376 %s :End of MOTD" % self.nick)
+        elif words[0] == "JOIN":
+            for channel in words[1].split(","):
+                self.send(":%s!luna@bot.host JOIN %s" % (self.nick, channel))
+                self.send(":irc.test 353 %s = %s :@%s alice +bob"
+                          % (self.nick, channel, self.nick))
+                self.send(":irc.test 366 %s %s :End of NAMES"
+                          % (self.nick, channel))
+
+            self.joined = True
+        elif words[0] == "PING":
+            self.send(":irc.test PONG irc.test :" + words[1].lstrip(":"))
+
+
+def scenario(server, path):
+    server.pump(1.0)
+
+    for line in open(path):
+        line = line.rstrip("\n")
+
+        if not line or line.startswith("#"):
+            continue
+
+        if line.startswith("SLEEP "):
+            server.pump(float(line[6:]))
+            continue
+
+        if line.startswith("WAIT "):
+            seconds, text = line[5:].split(" ", 1)
+            server.wait(float(seconds), text)
+            continue
+
+        server.send(line.replace("$NICK", server.nick or "luna"))
+        server.pump(0.05)
+
+    server.pump(1.0)
+
+
+def flood(server, count):
+    while not server.joined:
+        if not server.pump(0.1):
+            return
+
+    server.pump(0.5)
+
+    data = "".join(":alice!a@alice.host PRIVMSG #test :hello there %d\r\n" % i
+                   for i in range(count))
+    data += ":alice!a@alice.host PRIVMSG #test :END\r\n"
+
+    server.conn.setblocking(True)
+    server.conn.sendall(data.encode())
+    server.conn.setblocking(False)
+
+    while server.pump(1.0):
+        pass
+
+
+def main():
+    if len(sys.argv) < 4 or sys.argv[2] not in ("scenario", "flood"):
+        sys.exit("usage: fake_ircd.py PORT scenario FILE [LOG] | "
+                 "fake_ircd.py PORT flood N")
+
+    port = int(sys.argv[1])
+
+    if sys.argv[2] == "scenario":
+        scenario(Server(port, sys.argv[4] if len(sys.argv) > 4 else None),
+                 sys.argv[3])
+    else:
+        flood(Server(port), int(sys.argv[3]))
+
+
+if __name__ == "__main__":
+    main()